@@ -6,7 +6,11 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
 #include "bst.h"
+#include "thread-pool.h"
 
 struct KeyError { };
 
@@ -21,22 +25,31 @@ class AVLNode : public Node<Key, Value>
 public:
     // Constructor/destructor.
     AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    template<typename K, typename... Args>
+    AVLNode(std::piecewise_construct_t, AVLNode<Key, Value>* parent, K&& key, Args&&... valueArgs);
+    template<typename... Args>
+    AVLNode(std::in_place_t, AVLNode<Key, Value>* parent, Args&&... itemArgs);
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
-    // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // Getter/setter for the number of nodes in this node's subtree.
+    uint32_t getSize() const;
+    void setSize(uint32_t size);
+
+    // Getters for parent, left, and right. These hide the Node versions since they
+    // return pointers to AVLNodes - not plain Nodes. They are resolved statically,
+    // see the Node class in bst.h for more information.
+    AVLNode<Key, Value>* getParent() const;
+    AVLNode<Key, Value>* getLeft() const;
+    AVLNode<Key, Value>* getRight() const;
 
 protected:
     int8_t balance_;    // effectively a signed char
+    uint32_t size_;     // subtree size, fits in the padding after balance_
 };
 
 /*
@@ -51,7 +64,30 @@ protected:
 */
 template<class Key, class Value>
 AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+    Node<Key, Value>(key, value, parent), balance_(0), size_(1)
+{
+
+}
+
+/**
+* In-place constructors, see the matching Node constructors in bst.h.
+*/
+template<class Key, class Value>
+template<typename K, typename... Args>
+AVLNode<Key, Value>::AVLNode(std::piecewise_construct_t, AVLNode<Key, Value>* parent, K&& key, Args&&... valueArgs) :
+    Node<Key, Value>(std::piecewise_construct, parent, std::forward<K>(key), std::forward<Args>(valueArgs)...),
+    balance_(0),
+    size_(1)
+{
+
+}
+
+template<class Key, class Value>
+template<typename... Args>
+AVLNode<Key, Value>::AVLNode(std::in_place_t, AVLNode<Key, Value>* parent, Args&&... itemArgs) :
+    Node<Key, Value>(std::in_place, parent, std::forward<Args>(itemArgs)...),
+    balance_(0),
+    size_(1)
 {
 
 }
@@ -93,7 +129,25 @@ void AVLNode<Key, Value>::updateBalance(int8_t diff)
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
+* A getter for the subtree size of a AVLNode.
+*/
+template<class Key, class Value>
+uint32_t AVLNode<Key, Value>::getSize() const
+{
+    return size_;
+}
+
+/**
+* A setter for the subtree size of a AVLNode.
+*/
+template<class Key, class Value>
+void AVLNode<Key, Value>::setSize(uint32_t size)
+{
+    size_ = size;
+}
+
+/**
+* Hides Node::getParent since a static_cast is necessary to make sure
 * that our node is a AVLNode.
 */
 template<class Key, class Value>
@@ -103,7 +157,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Hidden for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
@@ -112,7 +166,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Hidden for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
@@ -128,138 +182,374 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 */
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+template <class Key, class Value, class Compare = std::less<Key>, class Alloc = HeapNodeAllocator>
+class AVLTree : public BinarySearchTree<Key, Value, Compare, Alloc>
 {
 public:
+    AVLTree();
+    explicit AVLTree(const Alloc& alloc);
+    explicit AVLTree(const Compare& comp, const Alloc& alloc = Alloc());
+    AVLTree(AVLTree&& other);
+    AVLTree& operator=(AVLTree&& other);
+    virtual ~AVLTree();
     virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
+    void insert(std::pair<Key, Value>&& new_item);
+    template<typename... Args>
+    std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool> try_emplace(Key&& key, Args&&... args);
     virtual void remove(const Key& key);  // TODO
+    virtual bool isBalanced() const;
+
+    // Bulk construction. Both replace the current contents.
+    template<typename InputIt>
+    void assignSorted(InputIt first, InputIt last);
+    template<typename InputIt>
+    void assign(InputIt first, InputIt last);
+    template<typename InputIt>
+    void insertBatch(InputIt first, InputIt last);
+
+    // Order statistics, O(log n) each.
+    std::size_t size() const;
+    typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator select(std::size_t k) const;
+    std::size_t rank(const Key& key) const;
+    std::size_t countRange(const Key& lo, const Key& hi) const;
+
+    // Moving key ranges between trees, O(log n) each. Nodes are relinked,
+    // never copied, as long as both trees' allocation policies compare equal.
+    void join(const std::pair<const Key, Value>& pivot, AVLTree& right);
+    void join(AVLTree& right);
+    std::pair<AVLTree, AVLTree> split(const Key& key);
+    AVLTree extract(const Key& lo, const Key& hi);
+
+    // Set operations with other, which is left empty. Divide and conquer
+    // on split/join; with a pool, the halves of large subproblems run in
+    // parallel. unionWith keeps other's value for a key in both trees.
+    void unionWith(AVLTree& other, ThreadPool* pool = NULL);
+    void intersectWith(AVLTree& other, ThreadPool* pool = NULL);
+    void differenceWith(AVLTree& other, ThreadPool* pool = NULL);
+
+    // Subproblems with fewer nodes than this run sequentially.
+    static const std::size_t PARALLEL_GRAIN = 8192;
 protected:
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    virtual void destroyNode(Node<Key, Value>* node);
 
     // Add helper functions here
     void insertFix(AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
     void rotationFix(AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2, AVLNode<Key,Value>* n3);
     void rotateLeft(AVLNode<Key,Value>* n1);
     void rotateRight(AVLNode<Key,Value>* n1);
-    void removeFix(AVLNode<Key,Value>* current);
+    static AVLNode<Key,Value>* rotateLeftNode(AVLNode<Key,Value>* n1);
+    static AVLNode<Key,Value>* rotateRightNode(AVLNode<Key,Value>* n1);
+    void removeFix(AVLNode<Key,Value>* current, int8_t diff);
+    static uint32_t subtreeSize(AVLNode<Key,Value>* node);
+    std::size_t countBelow(const Key& key, bool inclusive) const;
+    virtual Node<Key, Value>* insertFrom(Node<Key, Value>* start, const Key& key, const Value& value);
+    virtual void linkNode(Node<Key, Value>* parent, Node<Key, Value>* node, bool left);
+    int height() const;
+    static int subtreeHeight(AVLNode<Key,Value>* node);
+    void unlinkNode(AVLNode<Key,Value>* node);
+    static bool growFix(AVLNode<Key,Value>* node, AVLNode<Key,Value>*& top);
+    static AVLNode<Key,Value>* joinNodes(AVLNode<Key,Value>* left, int leftH, AVLNode<Key,Value>* pivot,
+                                  AVLNode<Key,Value>* right, int rightH, int& height);
+    void splitNodes(AVLNode<Key,Value>* node, int h, const Key& key,
+                    AVLNode<Key,Value>*& less, int& lessH, AVLNode<Key,Value>*& greater, int& greaterH,
+                    AVLNode<Key,Value>** found = NULL);
+    static AVLNode<Key,Value>* splitLast(AVLNode<Key,Value>* node, int h, AVLNode<Key,Value>*& last, int& height);
+    // Incremental invariant checks; insert and remove run them when
+    // built with -DAVL_VALIDATE.
+    void validatePath(AVLNode<Key,Value>* node) const;
+    void validateNode(AVLNode<Key,Value>* node) const;
+    static AVLNode<Key,Value>* joinNodes2(AVLNode<Key,Value>* left, int leftH, AVLNode<Key,Value>* right, int rightH, int& height);
+
+    enum SetOp { SET_UNION, SET_INTERSECTION, SET_DIFFERENCE };
+    // Nodes a set operation drops, chained through their parent pointers
+    // and freed once the (possibly parallel) recursion is over.
+    struct DropList
+    {
+        AVLNode<Key,Value>* head;
+        AVLNode<Key,Value>* tail;
+    };
+    static void drop(DropList& dropped, AVLNode<Key,Value>* subtree);
+    static void appendDrops(DropList& to, const DropList& from);
+    void setOperation(SetOp op, AVLTree& other, ThreadPool* pool);
+    AVLNode<Key,Value>* setNodes(SetOp op, AVLNode<Key,Value>* a, int aH, AVLNode<Key,Value>* b, int bH,
+                                 int& height, DropList& dropped, ThreadPool* pool);
+    void checkJoinable(const AVLTree& right, const Key* pivot) const;
+    void mergeRebuild(const std::vector<std::pair<Key, Value> >& items);
+    AVLNode<Key,Value>* relinkSorted(AVLNode<Key,Value>** nodes, std::size_t count, AVLNode<Key,Value>* parent, int& height);
+    template<typename ForwardIt>
+    AVLNode<Key,Value>* buildSorted(ForwardIt& it, std::size_t count, AVLNode<Key,Value>* parent, int& height);
+    template<typename InputIt>
+    void assignSortedRange(InputIt first, InputIt last, std::input_iterator_tag);
+    template<typename ForwardIt>
+    void assignSortedRange(ForwardIt first, ForwardIt last, std::forward_iterator_tag);
 
 
 
 };
 
-template<typename Key,typename Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* current) {
+/**
+* Default constructor for an AVLTree using the default allocation policy.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc>::AVLTree() :
+    BinarySearchTree<Key, Value, Compare, Alloc>()
+{
+
+}
+
+/**
+* Constructor taking an allocation policy.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc>::AVLTree(const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Compare, Alloc>(alloc)
+{
+
+}
+
+/**
+* Constructor taking a key comparator (and optionally an allocation policy).
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc>::AVLTree(const Compare& comp, const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Compare, Alloc>(comp, alloc)
+{
+
+}
+
+/**
+* Move constructor, see BinarySearchTree.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc>::AVLTree(AVLTree&& other) :
+    BinarySearchTree<Key, Value, Compare, Alloc>(std::move(other))
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc>& AVLTree<Key, Value, Compare, Alloc>::operator=(AVLTree&& other)
+{
+    BinarySearchTree<Key, Value, Compare, Alloc>::operator=(std::move(other));
+    return *this;
+}
+
+/**
+* The nodes are cleared here, while destroyNode still frees them as AVLNodes.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc>::~AVLTree()
+{
+    this->clear();
+}
+
+/**
+* Frees a node as an AVLNode so the policy gets back the right block size.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::destroyNode(Node<Key, Value>* node)
+{
+    this->freeNode(static_cast<AVLNode<Key, Value>*>(node));
+}
+
+/**
+* Rotates current's right child up into current's place, moving root_ if
+* current was the root.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::rotateLeft(AVLNode<Key,Value>* current) {
+    AVLNode<Key,Value>* top = rotateLeftNode(current);
+    if (top != NULL && top->getParent() == NULL) {
+        this->root_ = top;
+    }
+}
+
+/**
+* The rotation itself, which only touches the nodes involved (so it also
+* works on detached subtrees). Returns the node now on top, or NULL if
+* current has no right child.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+AVLNode<Key,Value>* AVLTree<Key, Value, Compare, Alloc>::rotateLeftNode(AVLNode<Key,Value>* current) {
     AVLNode<Key,Value>* parent = current->getParent();
     AVLNode<Key, Value>* right = current->getRight();
-    if (current == this->root_) {
-        this->root_ = right;
-    }
-    AVLNode<Key,Value>* tempRotate;
     if (right == NULL) {
-        return;
+        return NULL;
     }
-    if (right->getLeft() == NULL) {
-        tempRotate = NULL;
+    BST_STAT(rotations);
+    AVLNode<Key,Value>* tempRotate = right->getLeft(); //inner subtree changes sides
+    current->setRight(tempRotate);
+    if (tempRotate != NULL) {
+        tempRotate->setParent(current);
     }
-    else {
-        tempRotate = right->getLeft();
+    right->setLeft(current);
+    current->setParent(right);
+    right->setParent(parent);
+    right->setSize(current->getSize()); //right takes over the whole subtree
+    current->setSize(1 + subtreeSize(current->getLeft()) + subtreeSize(current->getRight()));
+    if (parent == NULL) {
+        //nothing above to relink
     }
-    for (int i = 0; i < 1; i++) {
-        current->setRight(tempRotate);
-        current->setParent(right);
+    else if (parent->getLeft() == current) {
+        parent->setLeft(right);
     }
-    for (int i = 0; i < 1; i++) {
-        right->setParent(parent);
-        right->setLeft(current);
+    else {
+        parent->setRight(right);
     }
-    if (parent != NULL) {
-        if (parent->getRight() == current) {
-            parent->setLeft(right);
+    return right;
+}
+
+/**
+* current's subtree on the side given by diff just lost one level of
+* height (diff is +1 for the left side, -1 for the right, matching the
+* sign of the balance change). Rotates where needed and walks the height
+* loss up until it is absorbed.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::removeFix(AVLNode<Key,Value>* current, int8_t diff) {
+    while (current != NULL) {
+        AVLNode<Key,Value>* parent = current->getParent();
+        int8_t nextDiff = 0; //decided before any rotation moves current
+        if (parent != NULL) {
+            nextDiff = current == parent->getLeft() ? 1 : -1;
         }
-        else if (parent->getLeft() == current) {
-            parent->setRight(right);
+        current->updateBalance(diff);
+        if (current->getBalance() == 1 || current->getBalance() == -1) {
+            return; //height unchanged
         }
-    }
-    if (tempRotate == NULL) {
-        // do nothing
-    }
-    else if (tempRotate != NULL) {
-        tempRotate->setParent(current);
+        if (current->getBalance() == 2) {
+            AVLNode<Key,Value>* child = current->getRight();
+            if (child->getBalance() == 0) { //single rotation, height unchanged
+                rotateLeft(current);
+                current->setBalance(1);
+                child->setBalance(-1);
+                return;
+            }
+            if (child->getBalance() == 1) {
+                rotateLeft(current);
+                current->setBalance(0);
+                child->setBalance(0);
+            }
+            else { //right-left
+                AVLNode<Key,Value>* grandchild = child->getLeft();
+                rotateRight(child);
+                rotateLeft(current);
+                current->setBalance(grandchild->getBalance() == 1 ? -1 : 0);
+                child->setBalance(grandchild->getBalance() == -1 ? 1 : 0);
+                grandchild->setBalance(0);
+            }
+        }
+        else if (current->getBalance() == -2) {
+            AVLNode<Key,Value>* child = current->getLeft();
+            if (child->getBalance() == 0) {
+                rotateRight(current);
+                current->setBalance(-1);
+                child->setBalance(1);
+                return;
+            }
+            if (child->getBalance() == -1) {
+                rotateRight(current);
+                current->setBalance(0);
+                child->setBalance(0);
+            }
+            else { //left-right
+                AVLNode<Key,Value>* grandchild = child->getRight();
+                rotateLeft(child);
+                rotateRight(current);
+                current->setBalance(grandchild->getBalance() == -1 ? 1 : 0);
+                child->setBalance(grandchild->getBalance() == 1 ? -1 : 0);
+                grandchild->setBalance(0);
+            }
+        }
+        //balance is 0 here: this subtree got shorter, tell the parent
+        current = parent;
+        diff = nextDiff;
     }
 }
 
-template<typename Key, typename Value>
-void AVLTree<Key, Value>::removeFix(AVLNode<Key,Value>* current) {
-    //Not done in time.
+/**
+* Returns the number of nodes below (and including) node.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+uint32_t AVLTree<Key, Value, Compare, Alloc>::subtreeSize(AVLNode<Key,Value>* node)
+{
+    return node == NULL ? 0 : node->getSize();
 }
 
-template<class Key,class Value>
-void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* current) {
+/**
+* Rotates current's left child up into current's place, moving root_ if
+* current was the root.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::rotateRight(AVLNode<Key,Value>* current) {
+    AVLNode<Key,Value>* top = rotateRightNode(current);
+    if (top != NULL && top->getParent() == NULL) {
+        this->root_ = top;
+    }
+}
+
+/**
+* Mirror image of rotateLeftNode.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key,Value>* AVLTree<Key, Value, Compare, Alloc>::rotateRightNode(AVLNode<Key,Value>* current) {
     AVLNode<Key,Value>* parent = current->getParent();
     AVLNode<Key, Value>* left = current->getLeft();
-    if (current == this->root_) {
-        this->root_ = left;
-    }
-    AVLNode<Key,Value>* tempRotate;
     if (left == NULL) {
-        return;
-    }
-    if (left->getRight() == NULL) {
-        tempRotate = NULL;
-    }
-    else {
-        tempRotate = left->getLeft();
-    }
-    for (int i = 0; i < 1; i++) {
-        current->setLeft(tempRotate);
-        current->setParent(left);
+        return NULL;
     }
-    for (int i = 0; i < 1; i++) {
-        left->setParent(parent);
-        left->setRight(current);
+    BST_STAT(rotations);
+    AVLNode<Key,Value>* tempRotate = left->getRight(); //inner subtree changes sides
+    current->setLeft(tempRotate);
+    if (tempRotate != NULL) {
+        tempRotate->setParent(current);
     }
-    if (parent != NULL) {
-        for (int i = 0; i < 1; i++) {
-            if (parent->getRight() == current) {
-                parent->setRight(left);
-            }
-            else if (parent->getLeft() == current) {
-                parent->setLeft(left);
-            }
-        }
+    left->setRight(current);
+    current->setParent(left);
+    left->setParent(parent);
+    left->setSize(current->getSize()); //left takes over the whole subtree
+    current->setSize(1 + subtreeSize(current->getLeft()) + subtreeSize(current->getRight()));
+    if (parent == NULL) {
+        //nothing above to relink
     }
-    if (tempRotate == NULL) {
-        // do nothing
+    else if (parent->getLeft() == current) {
+        parent->setLeft(left);
     }
-    else if (tempRotate != NULL) {
-        tempRotate->setParent(current);
+    else {
+        parent->setRight(left);
     }
+    return left;
 }
 
-template<typename Key,typename Value>
-void AVLTree<Key, Value>::rotationFix(AVLNode<Key,Value>* current, AVLNode<Key,Value>* parent, AVLNode<Key,Value>* leaf) {
-    /*CASES:
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::rotationFix(AVLNode<Key,Value>* current, AVLNode<Key,Value>* parent, AVLNode<Key,Value>* leaf) {
+    /*parent is out of balance (+/-2) after leaf was added below current.
+    CASES:
     Needs left-right rotation, which has initial arrangement
-       current 
-      / 
-     parent
-      \ 
+       parent
+      /
+     current
+      \
        leaf
     Then needs right-left rotation, which has initial arrangement
         parent
-         \ 
+         \
           current
          /
         leaf
-    Or needs left-left
+    Or needs a single left rotation
         parent
-           \ 
+           \
             current
-              \ 
+              \
               leaf
-     OR needs right-right
-          parent 
+     OR needs a single right rotation
+          parent
             /
        current
          /
@@ -267,127 +557,1139 @@ void AVLTree<Key, Value>::rotationFix(AVLNode<Key,Value>* current, AVLNode<Key,V
     if (current == parent->getLeft() && leaf == current->getRight()) { //left,then right rotation
         rotateLeft(current);
         rotateRight(parent);
+        current->setBalance(leaf->getBalance() == 1 ? -1 : 0);
+        parent->setBalance(leaf->getBalance() == -1 ? 1 : 0);
         leaf->setBalance(0);
     }
     else if (current == parent->getRight() && leaf == current->getLeft()) { //right-left
         rotateRight(current);
         rotateLeft(parent);
+        current->setBalance(leaf->getBalance() == -1 ? 1 : 0);
+        parent->setBalance(leaf->getBalance() == 1 ? -1 : 0);
         leaf->setBalance(0);
     }
-    else if (current == parent->getRight() && leaf == current->getRight()) { //right
+    else if (current == parent->getRight()) { //right-right
         rotateLeft(parent);
         parent->setBalance(0);
         current->setBalance(0);
     }
-    else {
+    else { //left-left
         rotateRight(parent);
         parent->setBalance(0);
         current->setBalance(0);
     }
 }
-template<typename Key, typename Value>
-void AVLTree<Key, Value>::insertFix(AVLNode<Key,Value>* current, AVLNode<Key,Value>* fixedNode) {
+
+/**
+* current's subtree just grew by one level (fixedNode is the child it grew
+* through). Walks the growth up until it is absorbed or a rotation fixes it.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::insertFix(AVLNode<Key,Value>* current, AVLNode<Key,Value>* fixedNode) {
     //base case: current is null OR current's parent doesn't exist.
     //in order to avoid bad access.
     if (current == NULL || current->getParent() == NULL) {
         return;
     }
+    BST_STAT(insertFixSteps);
+    AVLNode<Key,Value>* parent = current->getParent();
+    if (current != parent->getLeft()) {
+        parent->updateBalance(1);
+    }
     else {
-        AVLNode<Key,Value>* parent = current->getParent();
-        if (current != parent->getLeft()) {
-            parent->updateBalance(1);
+        parent->updateBalance(-1);
+    }
+    if (parent->getBalance() == 0) { //growth absorbed, nothing above changes.
+        return;
+    }
+    if (parent->getBalance() == 1 || parent->getBalance() == -1) { //parent grew too
+        insertFix(parent,current);
+    }
+    else { //parent is off by two: rotate
+        rotationFix(current,parent,fixedNode);
+    }
+}
+
+/*
+ * Recall: If key is already in the tree, you should 
+ * overwrite the current value with the updated value.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::insert (const std::pair<const Key, Value> &new_item)
+{ //same search as the bst; linkNode below does the rebalancing
+    std::pair<Node<Key, Value>*, bool> result =
+        this->template tryEmplaceNode<AVLNode<Key,Value> >(this->root_, new_item.first, new_item.second);
+    if (!result.second) { //if key already exists in tree, just switch in the value
+        result.first->setValue(new_item.second);
+    }
+}
+
+/**
+* Moves the key and value into the tree, see BinarySearchTree::insert.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::insert(std::pair<Key, Value>&& new_item)
+{
+    std::pair<Node<Key, Value>*, bool> result =
+        this->template tryEmplaceNode<AVLNode<Key,Value> >(this->root_, std::move(new_item.first), std::move(new_item.second));
+    if (!result.second) {
+        result.first->getValue() = std::move(new_item.second);
+    }
+}
+
+/**
+* In-place insertion, see BinarySearchTree::emplace.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool>
+AVLTree<Key, Value, Compare, Alloc>::emplace(Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result =
+        this->template emplaceNode<AVLNode<Key,Value> >(std::forward<Args>(args)...);
+    return std::make_pair(this->makeIterator(result.first), result.second);
+}
+
+/**
+* In-place insertion, see BinarySearchTree::try_emplace.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool>
+AVLTree<Key, Value, Compare, Alloc>::try_emplace(const Key& key, Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result =
+        this->template tryEmplaceNode<AVLNode<Key,Value> >(this->root_, key, std::forward<Args>(args)...);
+    return std::make_pair(this->makeIterator(result.first), result.second);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool>
+AVLTree<Key, Value, Compare, Alloc>::try_emplace(Key&& key, Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result =
+        this->template tryEmplaceNode<AVLNode<Key,Value> >(this->root_, std::move(key), std::forward<Args>(args)...);
+    return std::make_pair(this->makeIterator(result.first), result.second);
+}
+
+/**
+* Links a new leaf under parent, then updates the balances up the tree
+* and rotates where needed.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::linkNode(Node<Key, Value>* parentNode, Node<Key, Value>* node, bool left)
+{
+    BinarySearchTree<Key, Value, Compare, Alloc>::linkNode(parentNode, node, left);
+    AVLNode<Key,Value>* parent = static_cast<AVLNode<Key,Value>*>(parentNode);
+    AVLNode<Key,Value>* opNode = static_cast<AVLNode<Key,Value>*>(node);
+    if (parent != NULL) { //New tree! balance is already 0.
+        for (AVLNode<Key,Value>* up = parent; up != NULL; up = up->getParent()) {
+            up->setSize(up->getSize() + 1);
         }
-        else {
+        if (left) {
             parent->updateBalance(-1);
         }
-        if (parent->getBalance() == 0) { //if node is balanced, just return.
-            return;
+        else {
+            parent->updateBalance(1);
         }
-        if (parent->getBalance() != 0) {
-            insertFix(parent,current);
+        if (parent->getBalance() != 0) { //otherwise parent's height did not change, no need for action.
+            insertFix(parent,opNode);
+        }
+    }
+#ifdef AVL_VALIDATE
+    validatePath(opNode);
+#endif
+}
+
+/*
+ * Recall: The writeup specifies that if a node has 2 children you
+ * should swap with the predecessor and then remove.
+ */
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>:: remove(const Key& key)
+{
+    AVLNode<Key,Value>* removeThis = static_cast<AVLNode<Key,Value>*>(this->internalFind(key));
+    if (removeThis == NULL) {
+        return;
+    }
+    unlinkNode(removeThis);
+    destroyNode(removeThis);
+}
+
+/**
+* Takes a node out of the tree without freeing it and rebalances.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::unlinkNode(AVLNode<Key,Value>* removeThis)
+{
+    if (removeThis->getLeft() != NULL && removeThis->getRight() != NULL) { //2 children: trade places with the predecessor
+        nodeSwap(removeThis, static_cast<AVLNode<Key,Value>*>(this->predecessor(removeThis)));
+    }
+    //removeThis now has at most one child, which moves up into its place
+    AVLNode<Key,Value>* parent = removeThis->getParent();
+    AVLNode<Key,Value>* child = removeThis->getLeft() != NULL ? removeThis->getLeft() : removeThis->getRight();
+    int8_t diff = 0;
+    if (child != NULL) {
+        child->setParent(parent);
+    }
+    if (parent == NULL) {
+        this->root_ = child;
+    }
+    else if (removeThis == parent->getLeft()) {
+        parent->setLeft(child);
+        diff = 1;
+    }
+    else {
+        parent->setRight(child);
+        diff = -1;
+    }
+    for (AVLNode<Key,Value>* up = parent; up != NULL; up = up->getParent()) {
+        up->setSize(up->getSize() - 1);
+    }
+    removeThis->setParent(NULL);
+    removeThis->setLeft(NULL);
+    removeThis->setRight(NULL);
+    removeThis->setBalance(0);
+    removeThis->setSize(1);
+    removeFix(parent, diff);
+#ifdef AVL_VALIDATE
+    validatePath(parent);
+#endif
+}
+
+/**
+* A health check in O(1). Every update keeps the AVL invariant, so the
+* check reads the maintained balance at the root: it must lie in [-1, 1],
+* and the root must have no parent. Built with -DAVL_VALIDATE, the root
+* and its children are also checked against their actual heights, sizes
+* and links, at O(log n).
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool AVLTree<Key, Value, Compare, Alloc>::isBalanced() const
+{
+    AVLNode<Key,Value>* root = static_cast<AVLNode<Key,Value>*>(this->root_);
+    if (root == NULL) {
+        return true;
+    }
+    if (root->getParent() != NULL || root->getBalance() < -1 || root->getBalance() > 1) {
+        return false;
+    }
+#ifdef AVL_VALIDATE
+    try {
+        validatePath(root);
+    }
+    catch (const std::logic_error&) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+/**
+* Re-checks every node from node up to the root, and their children.
+* An insert or remove only changes links, balances and sizes along that
+* path, and the nodes a rotation moves down end up as children of it, so
+* this covers everything the update touched in O(log^2 n).
+* Throws std::logic_error at the first broken invariant.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::validatePath(AVLNode<Key,Value>* node) const
+{
+    if (node != NULL && node->getParent() == NULL && node != this->root_) {
+        throw std::logic_error("AVLTree: node lost its parent link");
+    }
+    for (AVLNode<Key,Value>* current = node; current != NULL; current = current->getParent()) {
+        validateNode(current);
+        if (current->getLeft() != NULL) {
+            validateNode(current->getLeft());
+        }
+        if (current->getRight() != NULL) {
+            validateNode(current->getRight());
+        }
+    }
+}
+
+/**
+* Checks one node against its children: links, key order, subtree size,
+* and a balance factor that matches the child heights and lies in [-1, 1].
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::validateNode(AVLNode<Key,Value>* node) const
+{
+    AVLNode<Key,Value>* left = node->getLeft();
+    AVLNode<Key,Value>* right = node->getRight();
+    if ((left != NULL && left->getParent() != node) || (right != NULL && right->getParent() != node)) {
+        throw std::logic_error("AVLTree: child does not point back at its parent");
+    }
+    if ((left != NULL && !this->comp_(left->getKey(), node->getKey())) ||
+        (right != NULL && !this->comp_(node->getKey(), right->getKey()))) {
+        throw std::logic_error("AVLTree: keys out of order");
+    }
+    if (node->getSize() != 1 + subtreeSize(left) + subtreeSize(right)) {
+        throw std::logic_error("AVLTree: wrong subtree size");
+    }
+    int balance = subtreeHeight(right) - subtreeHeight(left);
+    if (balance != node->getBalance() || balance < -1 || balance > 1) {
+        throw std::logic_error("AVLTree: wrong or out of range balance");
+    }
+}
+
+/**
+* Returns the number of items in the tree.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+std::size_t AVLTree<Key, Value, Compare, Alloc>::size() const
+{
+    return subtreeSize(static_cast<AVLNode<Key,Value>*>(this->root_));
+}
+
+/**
+* Returns an iterator to the item with the k-th smallest key (counting
+* from 0), or end() if the tree has k items or fewer.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+AVLTree<Key, Value, Compare, Alloc>::select(std::size_t k) const
+{
+    AVLNode<Key,Value>* current = static_cast<AVLNode<Key,Value>*>(this->root_);
+    while (current != NULL) {
+        std::size_t leftSize = subtreeSize(current->getLeft());
+        if (k < leftSize) {
+            current = current->getLeft();
+        }
+        else if (k == leftSize) {
+            break;
         }
         else {
-            rotationFix(current,parent,fixedNode);
+            k -= leftSize + 1;
+            current = current->getRight();
         }
     }
+    return this->makeIterator(current);
+}
 
+/**
+* Returns the number of keys less than key; for a key in the tree, that is
+* its position in the sorted order.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+std::size_t AVLTree<Key, Value, Compare, Alloc>::rank(const Key& key) const
+{
+    return countBelow(key, false);
 }
 
-/*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
- */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
-{ //modifying code used in bst for use with avl
-    Value operativeValue = new_item.second;
-    Key operativeKey = new_item.first;
-
-    if (this->root_ == NULL){
-        AVLNode<Key,Value>* temp = new AVLNode<Key,Value>(operativeKey,operativeValue,NULL);
-        if (this->empty()) { //New tree! set balance to 0.
-            temp->setBalance(0);
-            this->root_ = temp;
+/**
+* Returns the number of keys k with lo <= k <= hi.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+std::size_t AVLTree<Key, Value, Compare, Alloc>::countRange(const Key& lo, const Key& hi) const
+{
+    if (this->comp_(hi, lo)) {
+        return 0;
+    }
+    return countBelow(hi, true) - countBelow(lo, false);
+}
+
+/**
+* Counts the keys less than key (or not greater than it when inclusive),
+* adding up the left subtree sizes along one descent.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+std::size_t AVLTree<Key, Value, Compare, Alloc>::countBelow(const Key& key, bool inclusive) const
+{
+    std::size_t count = 0;
+    AVLNode<Key,Value>* current = static_cast<AVLNode<Key,Value>*>(this->root_);
+    while (current != NULL) {
+        BST_STAT(nodeVisits);
+        BST_STAT(comparisons);
+        bool below = inclusive ? !this->comp_(key, current->getKey()) : this->comp_(current->getKey(), key);
+        if (below) { //current and its left subtree are all counted
+            count += subtreeSize(current->getLeft()) + 1;
+            current = current->getRight();
+        }
+        else {
+            current = current->getLeft();
         }
+    }
+    return count;
+}
+
+/**
+* Replaces the contents of the tree with the items of a range whose keys
+* are in strictly increasing order. The tree is built directly in its
+* final, perfectly balanced shape: O(n) time, one allocation per item and
+* no rotations.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename InputIt>
+void AVLTree<Key, Value, Compare, Alloc>::assignSorted(InputIt first, InputIt last)
+{
+    assignSortedRange(first, last, typename std::iterator_traits<InputIt>::iterator_category());
+}
+
+/**
+* Replaces the contents of the tree with the items of an unsorted range.
+* The range is copied and sorted first; if a key appears more than once,
+* the last occurrence wins, just as with repeated insert() calls.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename InputIt>
+void AVLTree<Key, Value, Compare, Alloc>::assign(InputIt first, InputIt last)
+{
+    std::vector<std::pair<Key, Value> > items(first, last);
+    this->sortBatch(items);
+    assignSorted(items.begin(), items.end());
+}
+
+/**
+* Single-pass iterators cannot be counted up front, so they are buffered.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename InputIt>
+void AVLTree<Key, Value, Compare, Alloc>::assignSortedRange(InputIt first, InputIt last, std::input_iterator_tag)
+{
+    std::vector<std::pair<Key, Value> > items(first, last);
+    assignSortedRange(items.begin(), items.end(), std::forward_iterator_tag());
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+template<typename ForwardIt>
+void AVLTree<Key, Value, Compare, Alloc>::assignSortedRange(ForwardIt first, ForwardIt last, std::forward_iterator_tag)
+{
+    this->clear();
+    std::size_t count = std::distance(first, last);
+    int height = 0;
+    this->root_ = buildSorted(first, count, NULL, height);
+}
+
+/**
+* Builds a balanced subtree out of the next count items of it, consuming
+* them in order. The right half gets the extra item when count is even,
+* so every balance is 0 or +1. height receives the subtree's height.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename ForwardIt>
+AVLNode<Key,Value>* AVLTree<Key, Value, Compare, Alloc>::buildSorted(ForwardIt& it, std::size_t count, AVLNode<Key,Value>* parent, int& height)
+{
+    if (count == 0) {
+        height = 0;
+        return NULL;
+    }
+    int leftH = 0;
+    int rightH = 0;
+    std::size_t leftCount = (count - 1) / 2;
+    AVLNode<Key,Value>* left = buildSorted(it, leftCount, NULL, leftH);
+    AVLNode<Key,Value>* current = NULL;
+    try {
+        current = this->template createNode<AVLNode<Key,Value> >((*it).first, (*it).second, parent);
+    }
+    catch (...) {
+        this->clearHelper(left);
+        throw;
+    }
+    ++it;
+    current->setLeft(left);
+    if (left != NULL) {
+        left->setParent(current);
+    }
+    try {
+        current->setRight(buildSorted(it, count - 1 - leftCount, current, rightH));
+    }
+    catch (...) {
+        this->clearHelper(current);
+        throw;
+    }
+    current->setBalance((int8_t)(rightH - leftH));
+    current->setSize((uint32_t)count);
+    height = 1 + std::max(leftH, rightH);
+    return current;
+}
+
+/**
+* Inserts a batch of items (sorted first, last duplicate wins). A batch
+* that is large next to the tree is merged with the existing nodes in one
+* linear pass and the tree is relinked into balanced shape once, instead
+* of being rebalanced once per key. Smaller batches are inserted key by
+* key, each descent starting from the previous key's node.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename InputIt>
+void AVLTree<Key, Value, Compare, Alloc>::insertBatch(InputIt first, InputIt last)
+{
+    std::vector<std::pair<Key, Value> > items(first, last);
+    this->sortBatch(items);
+    if (this->root_ == NULL) {
+        assignSorted(items.begin(), items.end());
         return;
     }
+    // Once m inserts at ~h steps each cost more than touching all n
+    // nodes once, merging wins.
+    if (items.size() * (std::size_t)height() >= size()) {
+        mergeRebuild(items);
+    }
     else {
-        AVLNode<Key,Value>* operativeRoot = static_cast<AVLNode<Key, Value>*>(this->root_); //avoid working directly with data member pointer
-        AVLNode<Key,Value>* opNode = new AVLNode<Key,Value>(operativeKey,operativeValue,operativeRoot);
-        while (operativeRoot != NULL) {
-            Key focusKey = operativeRoot->getKey();
-            if (focusKey == operativeKey) { //if key already exists in tree, just switch in the value
-                for (int i = 0; i < 1; i++) {
-                    operativeRoot->setValue(operativeValue);
-                    return;
-                }
+        this->insertSorted(items);
+    }
+}
+
+/**
+* Returns the height of the tree, following the taller child downwards.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+int AVLTree<Key, Value, Compare, Alloc>::height() const
+{
+    return subtreeHeight(static_cast<AVLNode<Key,Value>*>(this->root_));
+}
+
+/**
+* Returns the height of the subtree at node, following the taller child.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+int AVLTree<Key, Value, Compare, Alloc>::subtreeHeight(AVLNode<Key,Value>* node)
+{
+    int h = 0;
+    AVLNode<Key,Value>* current = node;
+    while (current != NULL) {
+        h++;
+        current = current->getBalance() > 0 ? current->getRight() : current->getLeft();
+    }
+    return h;
+}
+
+/**
+* Merges a sorted, duplicate free batch into the tree: existing nodes are
+* reused (their values overwritten on a key match), new nodes are created
+* for new keys, and everything is relinked into a balanced tree.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::mergeRebuild(const std::vector<std::pair<Key, Value> >& items)
+{
+    std::vector<AVLNode<Key,Value>*> merged;
+    std::vector<std::pair<AVLNode<Key,Value>*, std::size_t> > overwrites;
+    std::vector<AVLNode<Key,Value>*> created;
+    Node<Key, Value>* existing = this->getSmallestNode();
+    std::size_t i = 0;
+    try {
+        while (existing != NULL || i < items.size()) {
+            if (i == items.size() || (existing != NULL && this->comp_(existing->getKey(), items[i].first))) {
+                merged.push_back(static_cast<AVLNode<Key,Value>*>(existing));
+                existing = this->successor(existing);
             }
-            else if (operativeKey > focusKey) { //if key greater than current key, move right. If it was equal, then key would've been found.
-                for (int i = 0; i < 1; i++) {
-                    if (NULL == operativeRoot->getRight()) {
-                        operativeRoot->setRight(opNode);
-                        operativeRoot->updateBalance(1);
-                    }
-                }
-                operativeRoot = operativeRoot->getRight(); //move up right child
+            else if (existing == NULL || this->comp_(items[i].first, existing->getKey())) {
+                AVLNode<Key,Value>* fresh = this->template createNode<AVLNode<Key,Value> >(items[i].first, items[i].second, static_cast<AVLNode<Key,Value>*>(NULL));
+                created.push_back(fresh);
+                merged.push_back(fresh);
+                i++;
             }
-            else if (operativeKey < focusKey) { //if key is less than current key, move left
-                for (int i = 0; i < 1; i++) {
-                    if (NULL == operativeRoot->getLeft()) { 
-                        operativeRoot->setLeft(opNode);
-                        operativeRoot->updateBalance(-1);
-                    }
-                }
-                operativeRoot = operativeRoot->getLeft(); //move up left child
+            else { //key already present
+                merged.push_back(static_cast<AVLNode<Key,Value>*>(existing));
+                overwrites.push_back(std::make_pair(static_cast<AVLNode<Key,Value>*>(existing), i));
+                existing = this->successor(existing);
+                i++;
             }
         }
-        if (operativeRoot->getBalance() == 0) {
-            //no need for action.
-            return;
+    }
+    catch (...) { //the tree itself has not been touched yet
+        for (std::size_t j = 0; j < created.size(); j++) {
+            destroyNode(created[j]);
+        }
+        throw;
+    }
+    for (std::size_t j = 0; j < overwrites.size(); j++) {
+        overwrites[j].first->setValue(items[overwrites[j].second].second);
+    }
+    int h = 0;
+    this->root_ = relinkSorted(&merged[0], merged.size(), NULL, h);
+}
+
+/**
+* Links an in-order array of nodes into a balanced subtree, the same shape
+* buildSorted produces, and sets every balance on the way back up.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key,Value>* AVLTree<Key, Value, Compare, Alloc>::relinkSorted(AVLNode<Key,Value>** nodes, std::size_t count, AVLNode<Key,Value>* parent, int& height)
+{
+    if (count == 0) {
+        height = 0;
+        return NULL;
+    }
+    int leftH = 0;
+    int rightH = 0;
+    std::size_t mid = (count - 1) / 2;
+    AVLNode<Key,Value>* current = nodes[mid];
+    current->setParent(parent);
+    current->setLeft(relinkSorted(nodes, mid, current, leftH));
+    current->setRight(relinkSorted(nodes + mid + 1, count - 1 - mid, current, rightH));
+    current->setBalance((int8_t)(rightH - leftH));
+    current->setSize((uint32_t)count);
+    height = 1 + std::max(leftH, rightH);
+    return current;
+}
+
+/**
+* Inserts (or overwrites) key below start as an AVLNode; linkNode does the
+* rebalancing. Used by the batched insert.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+Node<Key, Value>* AVLTree<Key, Value, Compare, Alloc>::insertFrom(Node<Key, Value>* start, const Key& key, const Value& value)
+{
+    std::pair<Node<Key, Value>*, bool> result =
+        this->template tryEmplaceNode<AVLNode<Key,Value> >(start, key, value);
+    if (!result.second) {
+        result.first->setValue(value);
+    }
+    return result.first;
+}
+
+/**
+* Appends pivot and then every item of right to this tree, where all keys
+* here are less than pivot's and all keys of right greater. right ends up
+* empty. Throws std::invalid_argument if the keys are out of order.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::join(const std::pair<const Key, Value>& pivot, AVLTree& right)
+{
+    checkJoinable(right, &pivot.first);
+    if (this->alloc_ != right.alloc_) { //right's nodes cannot live here, copy them over
+        std::vector<std::pair<Key, Value> > items(1, pivot);
+        items.insert(items.end(), right.begin(), right.end());
+        right.clear();
+        insertBatch(items.begin(), items.end());
+        return;
+    }
+    AVLNode<Key,Value>* node = this->template createNode<AVLNode<Key,Value> >(pivot.first, pivot.second, static_cast<AVLNode<Key,Value>*>(NULL));
+    AVLNode<Key,Value>* left = static_cast<AVLNode<Key,Value>*>(this->root_);
+    AVLNode<Key,Value>* other = static_cast<AVLNode<Key,Value>*>(right.root_);
+    int leftH = height();
+    int rightH = right.height();
+    right.root_ = NULL;
+    int h;
+    this->root_ = joinNodes(left, leftH, node, other, rightH, h);
+}
+
+/**
+* Appends every item of right to this tree, where all keys here are less
+* than all keys of right. right's smallest node becomes the pivot.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::join(AVLTree& right)
+{
+    checkJoinable(right, NULL);
+    if (right.root_ == NULL) {
+        return;
+    }
+    if (this->alloc_ != right.alloc_) {
+        std::vector<std::pair<Key, Value> > items(right.begin(), right.end());
+        right.clear();
+        insertBatch(items.begin(), items.end());
+        return;
+    }
+    AVLNode<Key,Value>* pivot = static_cast<AVLNode<Key,Value>*>(right.getSmallestNode());
+    right.unlinkNode(pivot);
+    AVLNode<Key,Value>* left = static_cast<AVLNode<Key,Value>*>(this->root_);
+    AVLNode<Key,Value>* other = static_cast<AVLNode<Key,Value>*>(right.root_);
+    int leftH = height();
+    int rightH = right.height();
+    right.root_ = NULL;
+    int h;
+    this->root_ = joinNodes(left, leftH, pivot, other, rightH, h);
+}
+
+/**
+* Throws unless every key here is less than *pivot (when given) and every
+* key of right is greater. Only the two extreme keys are compared.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::checkJoinable(const AVLTree& right, const Key* pivot) const
+{
+    Node<Key, Value>* largest = this->getLargestNode();
+    Node<Key, Value>* smallest = right.getSmallestNode();
+    bool ordered = true;
+    if (pivot != NULL) {
+        ordered = (largest == NULL || this->comp_(largest->getKey(), *pivot)) &&
+                  (smallest == NULL || this->comp_(*pivot, smallest->getKey()));
+    }
+    else if (largest != NULL && smallest != NULL) {
+        ordered = this->comp_(largest->getKey(), smallest->getKey());
+    }
+    if (!ordered) {
+        throw std::invalid_argument("join: key ranges overlap");
+    }
+}
+
+/**
+* Splits the tree into the items with keys less than key and the rest.
+* This tree is left empty. Both results share its allocation policy.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+std::pair<AVLTree<Key, Value, Compare, Alloc>, AVLTree<Key, Value, Compare, Alloc> >
+AVLTree<Key, Value, Compare, Alloc>::split(const Key& key)
+{
+    AVLTree less(this->comp_, this->alloc_);
+    AVLTree greater(this->comp_, this->alloc_);
+    AVLNode<Key,Value>* root = static_cast<AVLNode<Key,Value>*>(this->root_);
+    int lessH, greaterH;
+    AVLNode<Key,Value>* lessRoot;
+    AVLNode<Key,Value>* greaterRoot;
+    splitNodes(root, height(), key, lessRoot, lessH, greaterRoot, greaterH);
+    this->root_ = NULL;
+    less.root_ = lessRoot;
+    greater.root_ = greaterRoot;
+    return std::make_pair(std::move(less), std::move(greater));
+}
+
+/**
+* Removes the items with lo <= key < hi (the same run range(lo, hi)
+* visits) and returns them as a tree sharing this tree's allocation policy.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLTree<Key, Value, Compare, Alloc> AVLTree<Key, Value, Compare, Alloc>::extract(const Key& lo, const Key& hi)
+{
+    AVLTree middle(this->comp_, this->alloc_);
+    if (!this->comp_(lo, hi)) {
+        return middle;
+    }
+    AVLNode<Key,Value>* below;
+    AVLNode<Key,Value>* rest;
+    AVLNode<Key,Value>* inside;
+    AVLNode<Key,Value>* above;
+    int belowH, restH, insideH, aboveH;
+    splitNodes(static_cast<AVLNode<Key,Value>*>(this->root_), height(), lo, below, belowH, rest, restH);
+    splitNodes(rest, restH, hi, inside, insideH, above, aboveH);
+    middle.root_ = inside;
+    if (above == NULL) {
+        this->root_ = below;
+        return middle;
+    }
+    //glue the outer parts back together around the smallest key above
+    this->root_ = above;
+    AVLNode<Key,Value>* pivot = static_cast<AVLNode<Key,Value>*>(this->getSmallestNode());
+    unlinkNode(pivot);
+    above = static_cast<AVLNode<Key,Value>*>(this->root_);
+    int h;
+    this->root_ = joinNodes(below, belowH, pivot, above, subtreeHeight(above), h);
+    return middle;
+}
+
+/**
+* Joins two detached subtrees of known heights around a detached pivot
+* node, where left < pivot < right. The shorter tree is hung off the
+* spine of the taller one where the heights meet and the growth is
+* rebalanced upwards, so the cost is O(|leftH - rightH| + 1). Returns the
+* joined tree; height receives its height. Only the nodes involved are
+* touched, so joins of disjoint subtrees can run in parallel.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key,Value>* AVLTree<Key, Value, Compare, Alloc>::joinNodes(AVLNode<Key,Value>* left, int leftH, AVLNode<Key,Value>* pivot,
+                                                                   AVLNode<Key,Value>* right, int rightH, int& height)
+{
+    pivot->setParent(NULL);
+    if (leftH <= rightH + 1 && rightH <= leftH + 1) { //close enough: pivot becomes the root
+        pivot->setLeft(left);
+        pivot->setRight(right);
+        if (left != NULL) {
+            left->setParent(pivot);
+        }
+        if (right != NULL) {
+            right->setParent(pivot);
+        }
+        pivot->setBalance((int8_t)(rightH - leftH));
+        pivot->setSize(1 + subtreeSize(left) + subtreeSize(right));
+        height = 1 + std::max(leftH, rightH);
+        return pivot;
+    }
+    bool leftTaller = leftH > rightH;
+    AVLNode<Key,Value>* tall = leftTaller ? left : right;
+    AVLNode<Key,Value>* shorter = leftTaller ? right : left;
+    int shortH = leftTaller ? rightH : leftH;
+    uint32_t added = subtreeSize(shorter) + 1;
+    tall->setParent(NULL);
+    //walk down the inner spine of the taller tree to a subtree of height shortH or shortH + 1
+    AVLNode<Key,Value>* parent = NULL;
+    AVLNode<Key,Value>* current = tall;
+    int currentH = leftTaller ? leftH : rightH;
+    while (currentH > shortH + 1) {
+        current->setSize(current->getSize() + added);
+        parent = current;
+        if (leftTaller) {
+            currentH -= current->getBalance() < 0 ? 2 : 1;
+            current = current->getRight();
         }
         else {
-            insertFix(operativeRoot,opNode);
+            currentH -= current->getBalance() > 0 ? 2 : 1;
+            current = current->getLeft();
         }
     }
+    AVLNode<Key,Value>* inner = leftTaller ? current : shorter;
+    AVLNode<Key,Value>* outer = leftTaller ? shorter : current;
+    pivot->setLeft(inner);
+    pivot->setRight(outer);
+    if (inner != NULL) {
+        inner->setParent(pivot);
+    }
+    if (outer != NULL) {
+        outer->setParent(pivot);
+    }
+    pivot->setBalance((int8_t)(leftTaller ? shortH - currentH : currentH - shortH));
+    pivot->setSize(1 + subtreeSize(inner) + subtreeSize(outer));
+    pivot->setParent(parent);
+    if (leftTaller) {
+        parent->setRight(pivot);
+    }
+    else {
+        parent->setLeft(pivot);
+    }
+    AVLNode<Key,Value>* top = tall;
+    bool grew = growFix(pivot, top); //pivot's subtree is one taller than current was
+    height = (leftTaller ? leftH : rightH) + (grew ? 1 : 0);
+    return top;
 }
 
-/*
- * Recall: The writeup specifies that if a node has 2 children you
- * should swap with the predecessor and then remove.
- */
-template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+/**
+* node's subtree just grew by one level. Unlike insertFix, the child that
+* tips a parent over may itself be balanced (a join hangs a whole tree
+* there), in which case the single rotation leaves the subtree taller and
+* the walk continues. Returns true if the whole tree grew. top holds the
+* root of the tree and is updated when a rotation replaces it.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool AVLTree<Key, Value, Compare, Alloc>::growFix(AVLNode<Key,Value>* node, AVLNode<Key,Value>*& top)
 {
-    return;
+    while (node->getParent() != NULL) {
+        AVLNode<Key,Value>* parent = node->getParent();
+        parent->updateBalance(node == parent->getLeft() ? -1 : 1);
+        if (parent->getBalance() == 0) {
+            return false;
+        }
+        if (parent->getBalance() == 1 || parent->getBalance() == -1) {
+            node = parent;
+            continue;
+        }
+        AVLNode<Key,Value>* sub; //the node on top after the rotation
+        bool taller = false;
+        if (parent->getBalance() == 2) {
+            if (node->getBalance() == -1) { //right-left
+                AVLNode<Key,Value>* grandchild = node->getLeft();
+                rotateRightNode(node);
+                sub = rotateLeftNode(parent);
+                node->setBalance(grandchild->getBalance() == -1 ? 1 : 0);
+                parent->setBalance(grandchild->getBalance() == 1 ? -1 : 0);
+                grandchild->setBalance(0);
+            }
+            else {
+                sub = rotateLeftNode(parent);
+                taller = node->getBalance() == 0;
+                parent->setBalance(taller ? 1 : 0);
+                node->setBalance(taller ? -1 : 0);
+            }
+        }
+        else {
+            if (node->getBalance() == 1) { //left-right
+                AVLNode<Key,Value>* grandchild = node->getRight();
+                rotateLeftNode(node);
+                sub = rotateRightNode(parent);
+                node->setBalance(grandchild->getBalance() == 1 ? -1 : 0);
+                parent->setBalance(grandchild->getBalance() == -1 ? 1 : 0);
+                grandchild->setBalance(0);
+            }
+            else {
+                sub = rotateRightNode(parent);
+                taller = node->getBalance() == 0;
+                parent->setBalance(taller ? -1 : 0);
+                node->setBalance(taller ? 1 : 0);
+            }
+        }
+        if (sub->getParent() == NULL) {
+            top = sub;
+        }
+        if (!taller) {
+            return false;
+        }
+        node = sub; //the rotated subtree is still one taller, keep going
+    }
+    return true;
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+/**
+* Splits the detached subtree at node (of height h) into the keys less
+* than key and the rest, rejoining the pieces on the way back up. When
+* found is given, a node equal to key is kept out of both halves and
+* returned through it (*found is left alone if there is none). The
+* joins telescope, so the whole split is O(h). Like joinNodes, it only
+* touches the nodes of the subtree.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::splitNodes(AVLNode<Key,Value>* node, int h, const Key& key,
+                                                     AVLNode<Key,Value>*& less, int& lessH, AVLNode<Key,Value>*& greater, int& greaterH,
+                                                     AVLNode<Key,Value>** found)
+{
+    if (node == NULL) {
+        less = greater = NULL;
+        lessH = greaterH = 0;
+        return;
+    }
+    AVLNode<Key,Value>* left = node->getLeft();
+    AVLNode<Key,Value>* right = node->getRight();
+    int leftH = h - 1 - (node->getBalance() > 0 ? 1 : 0);
+    int rightH = h - 1 - (node->getBalance() < 0 ? 1 : 0);
+    if (left != NULL) {
+        left->setParent(NULL);
+    }
+    if (right != NULL) {
+        right->setParent(NULL);
+    }
+    node->setLeft(NULL);
+    node->setRight(NULL);
+    bool isLess = this->comp_(node->getKey(), key);
+    if (!isLess && found != NULL && !this->comp_(key, node->getKey())) { //the caller wants the equal node on its own
+        *found = node;
+        less = left;
+        lessH = leftH;
+        greater = right;
+        greaterH = rightH;
+        return;
+    }
+    if (isLess) { //node and its left subtree go to less
+        AVLNode<Key,Value>* rightLess;
+        int rightLessH;
+        splitNodes(right, rightH, key, rightLess, rightLessH, greater, greaterH, found);
+        less = joinNodes(left, leftH, node, rightLess, rightLessH, lessH);
+    }
+    else { //node and its right subtree go to greater
+        AVLNode<Key,Value>* leftGreater;
+        int leftGreaterH;
+        splitNodes(left, leftH, key, less, lessH, leftGreater, leftGreaterH, found);
+        greater = joinNodes(leftGreater, leftGreaterH, node, right, rightH, greaterH);
+    }
+}
+
+/**
+* Takes the largest node out of the detached subtree at node (of height
+* h). Returns the rest of the subtree; last receives the detached node and
+* height the new height.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key,Value>* AVLTree<Key, Value, Compare, Alloc>::splitLast(AVLNode<Key,Value>* node, int h, AVLNode<Key,Value>*& last, int& height)
+{
+    AVLNode<Key,Value>* left = node->getLeft();
+    AVLNode<Key,Value>* right = node->getRight();
+    int leftH = h - 1 - (node->getBalance() > 0 ? 1 : 0);
+    int rightH = h - 1 - (node->getBalance() < 0 ? 1 : 0);
+    if (left != NULL) {
+        left->setParent(NULL);
+    }
+    node->setLeft(NULL);
+    node->setRight(NULL);
+    if (right == NULL) {
+        last = node;
+        last->setParent(NULL);
+        last->setBalance(0);
+        last->setSize(1);
+        height = leftH;
+        return left;
+    }
+    right->setParent(NULL);
+    int restH;
+    AVLNode<Key,Value>* rest = splitLast(right, rightH, last, restH);
+    return joinNodes(left, leftH, node, rest, restH, height);
+}
+
+/**
+* Joins two detached subtrees with left < right and no pivot, using the
+* largest node of left as one.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key,Value>* AVLTree<Key, Value, Compare, Alloc>::joinNodes2(AVLNode<Key,Value>* left, int leftH, AVLNode<Key,Value>* right, int rightH, int& height)
+{
+    if (left == NULL) {
+        height = rightH;
+        return right;
+    }
+    AVLNode<Key,Value>* last;
+    int restH;
+    AVLNode<Key,Value>* rest = splitLast(left, leftH, last, restH);
+    return joinNodes(rest, restH, last, right, rightH, height);
+}
+
+/**
+* Adds the keys of other to this tree. other's value wins for keys that
+* are in both.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::unionWith(AVLTree& other, ThreadPool* pool)
+{
+    setOperation(SET_UNION, other, pool);
+}
+
+/**
+* Keeps only the keys that other has too, with this tree's values.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::intersectWith(AVLTree& other, ThreadPool* pool)
+{
+    setOperation(SET_INTERSECTION, other, pool);
+}
+
+/**
+* Removes the keys that other has.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::differenceWith(AVLTree& other, ThreadPool* pool)
+{
+    setOperation(SET_DIFFERENCE, other, pool);
+}
+
+/**
+* Runs a set operation over both node sets, then frees the dropped nodes
+* on this thread: the allocation policies are not thread safe, while the
+* recursion itself only relinks nodes.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::setOperation(SetOp op, AVLTree& other, ThreadPool* pool)
+{
+    if (&other == this) {
+        if (op == SET_DIFFERENCE) {
+            this->clear();
+        }
+        return;
+    }
+    if (this->alloc_ != other.alloc_) { //other's nodes cannot live here: rebuild them first
+        AVLTree copy(this->comp_, this->alloc_);
+        copy.assignSorted(other.begin(), other.end());
+        other.clear();
+        setOperation(op, copy, pool);
+        return;
+    }
+    AVLNode<Key,Value>* a = static_cast<AVLNode<Key,Value>*>(this->root_);
+    AVLNode<Key,Value>* b = static_cast<AVLNode<Key,Value>*>(other.root_);
+    int aH = height();
+    int bH = other.height();
+    DropList dropped = { NULL, NULL };
+    int h;
+    this->root_ = setNodes(op, a, aH, b, bH, h, dropped, pool);
+    other.root_ = NULL;
+    AVLNode<Key,Value>* next = dropped.head;
+    while (next != NULL) {
+        AVLNode<Key,Value>* subtree = next;
+        next = next->getParent();
+        subtree->setParent(NULL);
+        this->clearHelper(subtree);
+    }
+}
+
+/**
+* The set operation on two detached subtrees. a's root splits b; the
+* halves recurse (in parallel when large enough and a pool is given) and
+* are joined back around a's root if the key stays. Nodes that leave the
+* result go on dropped.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+AVLNode<Key,Value>* AVLTree<Key, Value, Compare, Alloc>::setNodes(SetOp op, AVLNode<Key,Value>* a, int aH, AVLNode<Key,Value>* b, int bH,
+                                                                  int& height, DropList& dropped, ThreadPool* pool)
+{
+    if (a == NULL || b == NULL) {
+        bool keepA = op != SET_INTERSECTION;
+        bool keepB = op == SET_UNION;
+        drop(dropped, keepA ? NULL : a);
+        drop(dropped, keepB ? NULL : b);
+        AVLNode<Key,Value>* kept = a != NULL ? (keepA ? a : NULL) : (keepB ? b : NULL);
+        height = kept == NULL ? 0 : (a != NULL ? aH : bH);
+        return kept;
+    }
+    bool parallel = pool != NULL && subtreeSize(a) + subtreeSize(b) >= PARALLEL_GRAIN;
+    AVLNode<Key,Value>* left = a->getLeft();
+    AVLNode<Key,Value>* right = a->getRight();
+    int leftH = aH - 1 - (a->getBalance() > 0 ? 1 : 0);
+    int rightH = aH - 1 - (a->getBalance() < 0 ? 1 : 0);
+    if (left != NULL) {
+        left->setParent(NULL);
+    }
+    if (right != NULL) {
+        right->setParent(NULL);
+    }
+    a->setLeft(NULL);
+    a->setRight(NULL);
+
+    AVLNode<Key,Value>* bLess;
+    AVLNode<Key,Value>* bGreater;
+    AVLNode<Key,Value>* match = NULL;
+    int bLessH, bGreaterH;
+    splitNodes(b, bH, a->getKey(), bLess, bLessH, bGreater, bGreaterH, &match);
+
+    AVLNode<Key,Value>* lessPart;
+    AVLNode<Key,Value>* greaterPart;
+    int lessH, greaterH;
+    DropList greaterDropped = { NULL, NULL };
+    if (parallel) {
+        pool->invoke(
+            [&] { lessPart = setNodes(op, left, leftH, bLess, bLessH, lessH, dropped, pool); },
+            [&] { greaterPart = setNodes(op, right, rightH, bGreater, bGreaterH, greaterH, greaterDropped, pool); });
+    }
+    else {
+        lessPart = setNodes(op, left, leftH, bLess, bLessH, lessH, dropped, NULL);
+        greaterPart = setNodes(op, right, rightH, bGreater, bGreaterH, greaterH, greaterDropped, NULL);
+    }
+    appendDrops(dropped, greaterDropped);
+
+    bool keep = op == SET_UNION || (op == SET_INTERSECTION) == (match != NULL);
+    if (match != NULL) {
+        if (op == SET_UNION) {
+            a->getValue() = std::move(match->getValue());
+        }
+        drop(dropped, match);
+    }
+    if (keep) {
+        return joinNodes(lessPart, lessH, a, greaterPart, greaterH, height);
+    }
+    drop(dropped, a);
+    return joinNodes2(lessPart, lessH, greaterPart, greaterH, height);
+}
+
+/**
+* Puts a detached subtree (NULL is ignored) on the drop list.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::drop(DropList& dropped, AVLNode<Key,Value>* subtree)
+{
+    if (subtree == NULL) {
+        return;
+    }
+    subtree->setParent(NULL);
+    if (dropped.tail == NULL) {
+        dropped.head = subtree;
+    }
+    else {
+        dropped.tail->setParent(subtree);
+    }
+    dropped.tail = subtree;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::appendDrops(DropList& to, const DropList& from)
+{
+    if (from.head == NULL) {
+        return;
+    }
+    if (to.tail == NULL) {
+        to.head = from.head;
+    }
+    else {
+        to.tail->setParent(from.head);
+    }
+    to.tail = from.tail;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void AVLTree<Key, Value, Compare, Alloc>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    BinarySearchTree<Key, Value, Compare, Alloc>::nodeSwap(n1, n2);
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
+    uint32_t tempS = n1->getSize(); //sizes belong to the position, like balances
+    n1->setSize(n2->getSize());
+    n2->setSize(tempS);
 }
 
 
@@ -0,0 +1,1191 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include "bst.h"
+#include "avlbst.h"
+#include "btree.h"
+#include "concurrent-avl.h"
+#include "epoch.h"
+#include "flat-combining-avl.h"
+#include "lock-free-bst.h"
+#include "sharded-avl-map.h"
+#include "persistent-avl.h"
+#include "latency-histogram.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+// Keeps results alive so the timed loops are not optimized away.
+static volatile long sink;
+
+static double nsPer(Clock::time_point start, Clock::time_point stop, size_t ops)
+{
+    return chrono::duration<double, nano>(stop - start).count() / ops;
+}
+
+template<typename Tree>
+void lookupBench(const char* name, const vector<int>& keys)
+{
+    Tree tree;
+    for(size_t i = 0; i < keys.size(); i++) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    vector<int> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937(7));
+
+    long found = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < probes.size(); i++) {
+        if(tree.find(probes[i]) != tree.end()) {
+            found++;
+        }
+    }
+    Clock::time_point stop = Clock::now();
+    sink = found;
+    cout << left << setw(34) << name << setw(10) << keys.size()
+         << fixed << setprecision(1) << nsPer(start, stop, probes.size()) << " ns/find" << endl;
+}
+
+void printStats(const string& name, size_t n, const TreeStats& stats)
+{
+    cout << left << setw(34) << name << setw(10) << n << fixed << setprecision(2)
+         << setw(8) << (double)stats.comparisons / n << setw(8) << (double)stats.nodeVisits / n
+         << setw(10) << (double)stats.rotations / n << setw(11) << (double)stats.insertFixSteps / n
+         << (double)stats.nodeSwaps / n << endl;
+}
+
+/**
+* Counts per operation, from the BST_STATS counters, for inserting, finding
+* and removing keys in random order.
+*/
+template<typename Tree>
+void statsBench(const char* name, const vector<int>& keys)
+{
+    Tree tree;
+    Tree::stats();
+    for(size_t i = 0; i < keys.size(); i++) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    printStats(string(name) + ", insert", keys.size(), Tree::stats());
+    long found = 0;
+    for(size_t i = keys.size(); i-- > 0;) {
+        found += tree.find(keys[i]) != tree.end();
+    }
+    sink = found;
+    printStats(string(name) + ", find", keys.size(), Tree::stats());
+    for(size_t i = 0; i < keys.size(); i += 2) {
+        tree.remove(keys[i]);
+    }
+    printStats(string(name) + ", remove", (keys.size() + 1) / 2, Tree::stats());
+}
+
+void printLatency(const string& name, const LatencySummary& summary)
+{
+    cout << left << setw(34) << name << setw(10) << summary.count << right << setw(8) << summary.p50
+         << setw(8) << summary.p99 << setw(9) << summary.p999 << setw(11) << summary.max << left << endl;
+}
+
+/**
+* Tail latency per operation through TimedTree, for inserting, finding and
+* removing keys in random order. Ends with the cost of the timing itself:
+* the remaining keys found again, timed and untimed.
+*/
+template<typename Tree>
+void latencyBench(const char* name, const vector<int>& keys)
+{
+    typedef TimedTree<Tree> Timed;
+    Timed timed;
+    for(size_t i = 0; i < keys.size(); i++) {
+        timed.insert(make_pair(keys[i], (int)i));
+    }
+    long found = 0;
+    for(size_t i = keys.size(); i-- > 0;) {
+        found += timed.find(keys[i]) != timed.tree().end();
+    }
+    for(size_t i = 0; i < keys.size(); i += 2) {
+        timed.remove(keys[i]);
+    }
+    printLatency(string(name) + ", insert", timed.latency(Timed::INSERT));
+    printLatency(string(name) + ", find", timed.latency(Timed::FIND));
+    printLatency(string(name) + ", remove", timed.latency(Timed::REMOVE));
+
+    double untimedNs = 1e18;    // best of three, alternating, to keep drift out
+    double timedNs = 1e18;
+    for(int round = 0; round < 3; round++) {
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < keys.size(); i++) {
+            found += timed.tree().find(keys[i]) != timed.tree().end();
+        }
+        Clock::time_point middle = Clock::now();
+        for(size_t i = 0; i < keys.size(); i++) {
+            found += timed.find(keys[i]) != timed.tree().end();
+        }
+        Clock::time_point stop = Clock::now();
+        untimedNs = min(untimedNs, nsPer(start, middle, keys.size()));
+        timedNs = min(timedNs, nsPer(middle, stop, keys.size()));
+    }
+    sink = found;
+    cout << left << setw(34) << (string(name) + ", find") << setw(10) << keys.size() << fixed << setprecision(1)
+         << untimedNs << " ns untimed, " << timedNs << " ns timed" << endl;
+}
+
+// Looks up every key through the given probe type: std::string for plain
+// lookups, const char* to see what building a temporary key costs, and
+// string_view for a transparent comparator that needs no temporary.
+template<typename Tree, typename Probe>
+void stringLookupBench(const char* name, const vector<string>& keys)
+{
+    Tree tree;
+    for(size_t i = 0; i < keys.size(); i++) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    vector<const string*> order;
+    for(size_t i = 0; i < keys.size(); i++) {
+        order.push_back(&keys[i]);
+    }
+    shuffle(order.begin(), order.end(), mt19937(7));
+    vector<Probe> probes;
+    for(size_t i = 0; i < order.size(); i++) {
+        probes.push_back(Probe(order[i]->c_str()));
+    }
+
+    long found = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < probes.size(); i++) {
+        if(tree.find(probes[i]) != tree.end()) {
+            found++;
+        }
+    }
+    Clock::time_point stop = Clock::now();
+    sink = found;
+    cout << left << setw(34) << name << setw(10) << keys.size()
+         << fixed << setprecision(1) << nsPer(start, stop, probes.size()) << " ns/find" << endl;
+}
+
+// Sums windows of width keys, either through range() or the way it had
+// to be done before: walking from begin() and filtering.
+void windowBench(const vector<int>& keys, int width, size_t windows)
+{
+    AVLTree<int,int> tree;
+    for(size_t i = 0; i < keys.size(); i++) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    mt19937 rng(5);
+    vector<int> starts(windows);
+    for(size_t w = 0; w < windows; w++) {
+        starts[w] = (int)(rng() % keys.size());
+    }
+
+    long total = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t w = 0; w < windows; w++) {
+        for(pair<const int,int>& item : tree.range(starts[w], starts[w] + width)) {
+            total += item.second;
+        }
+    }
+    Clock::time_point mid = Clock::now();
+    size_t scanned = windows < 10 ? windows : 10;
+    for(size_t w = 0; w < scanned; w++) {
+        for(AVLTree<int,int>::iterator it = tree.begin(); it != tree.end() && it->first < starts[w] + width; ++it) {
+            if(it->first >= starts[w]) {
+                total += it->second;
+            }
+        }
+    }
+    Clock::time_point stop = Clock::now();
+    sink = total;
+    cout << left << setw(34) << "AVLTree window of" << setw(10) << width << fixed << setprecision(1)
+         << "range() " << nsPer(start, mid, windows) / 1000 << " us, "
+         << "filtered scan " << nsPer(mid, stop, scanned) / 1000 << " us" << endl;
+}
+
+// rank() and select() on random positions, against counting with an
+// iterator from begin() for a handful of them.
+void orderStatBench(const vector<int>& keys)
+{
+    AVLTree<int,int> tree;
+    for(size_t i = 0; i < keys.size(); i++) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+    vector<int> probes(keys);
+    shuffle(probes.begin(), probes.end(), mt19937(9));
+
+    long total = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < probes.size(); i++) {
+        total += (long)tree.rank(probes[i]);
+    }
+    Clock::time_point mid = Clock::now();
+    for(size_t i = 0; i < probes.size(); i++) {
+        total += tree.select((size_t)probes[i])->first;
+    }
+    Clock::time_point walk = Clock::now();
+    size_t walked = 10;
+    for(size_t i = 0; i < walked; i++) {
+        size_t position = 0;
+        for(AVLTree<int,int>::iterator it = tree.begin(); it != tree.end() && it->first < probes[i]; ++it) {
+            position++;
+        }
+        total += (long)position;
+    }
+    Clock::time_point stop = Clock::now();
+    sink = total;
+    cout << left << setw(34) << "AVLTree<int,int>" << setw(10) << keys.size() << fixed << setprecision(1)
+         << "rank " << nsPer(start, mid, probes.size()) << " ns, select " << nsPer(mid, walk, probes.size())
+         << " ns, counting walk " << nsPer(walk, stop, walked) / 1000 << " us" << endl;
+}
+
+// Moves a tenth of the keys to a second tree and back, once with
+// extract()/join() and once with an insert and remove loop.
+void sliceBench(size_t n)
+{
+    vector<pair<int,int> > sorted(n);
+    for(size_t i = 0; i < n; i++) {
+        sorted[i] = make_pair((int)i, (int)i);
+    }
+    int lo = (int)(n / 2);
+    int hi = lo + (int)(n / 10);
+
+    AVLTree<int,int> tree;
+    tree.assignSorted(sorted.begin(), sorted.end());
+    Clock::time_point start = Clock::now();
+    AVLTree<int,int> slice = tree.extract(lo, hi);
+    AVLTree<int,int> upper = tree.extract(hi, (int)n);
+    tree.join(slice);
+    tree.join(upper);
+    Clock::time_point mid = Clock::now();
+
+    AVLTree<int,int> other;
+    for(int k = lo; k < hi; k++) {
+        other.insert(make_pair(k, k));
+        tree.remove(k);
+    }
+    for(int k = lo; k < hi; k++) {
+        tree.insert(make_pair(k, k));
+        other.remove(k);
+    }
+    Clock::time_point stop = Clock::now();
+    sink = (long)tree.size();
+    cout << left << setw(34) << "AVLTree, slice of" << setw(10) << hi - lo << fixed << setprecision(1)
+         << "extract+join " << chrono::duration<double, micro>(mid - start).count() << " us, "
+         << "insert/remove loop " << chrono::duration<double, micro>(stop - mid).count() << " us" << endl;
+}
+
+/**
+* Times unionWith and intersectWith on two trees of n random keys each
+* (about half of them shared), sequentially and on pools of 1, 2, 4, ...
+* threads. The trees are rebuilt outside the timed part for every run.
+*/
+void setOpBench(size_t n)
+{
+    mt19937 gen(7);
+    vector<pair<int,int> > first;
+    vector<pair<int,int> > second;
+    for(size_t i = 0; i < 2 * n; i++) {
+        unsigned pick = gen() % 3; //one third in each tree only, one third in both
+        if (pick != 1) first.push_back(make_pair((int)i, (int)i));
+        if (pick != 0) second.push_back(make_pair((int)i, -(int)i));
+    }
+    size_t maxThreads = max<size_t>(thread::hardware_concurrency(), 4);
+    for(int op = 0; op < 2; op++) {
+        for(size_t threads = 0; threads <= maxThreads; threads = threads ? threads * 2 : 1) {
+            ThreadPool* pool = threads ? new ThreadPool(threads) : NULL;
+            AVLTree<int,int> a;
+            AVLTree<int,int> b;
+            a.assignSorted(first.begin(), first.end());
+            b.assignSorted(second.begin(), second.end());
+            Clock::time_point start = Clock::now();
+            if (op == 0) {
+                a.unionWith(b, pool);
+            }
+            else {
+                a.intersectWith(b, pool);
+            }
+            Clock::time_point stop = Clock::now();
+            sink = (long)a.size();
+            delete pool;
+            string name = string(op == 0 ? "unionWith" : "intersectWith") + ", " +
+                          (threads ? to_string(threads) + " thread" + (threads > 1 ? "s" : "") : string("sequential"));
+            cout << left << setw(34) << name << setw(10) << first.size() + second.size() << fixed << setprecision(1)
+                 << chrono::duration<double, milli>(stop - start).count() << " ms" << endl;
+        }
+    }
+}
+
+/**
+* An AVLTree behind one mutex, the way callers share a map today.
+*/
+class LockedAVLTree
+{
+public:
+    bool find(int key, int& value) const
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        AVLTree<int,int>::iterator it = tree_.find(key);
+        if (it == tree_.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+
+    void insert(const pair<const int,int>& item)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        tree_.insert(item);
+    }
+
+    void remove(int key)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        tree_.remove(key);
+    }
+
+private:
+    mutable std::mutex lock_;
+    AVLTree<int,int> tree_;
+};
+
+/**
+* Lookups per second summed over readers threads, while one writer keeps
+* inserting and removing keys. Each run lasts runMs milliseconds.
+*/
+template<typename Tree>
+void sharedReadBench(const char* name, size_t n, size_t readers, int runMs)
+{
+    Tree tree;
+    for(size_t i = 0; i < n; i += 2) {
+        tree.insert(make_pair((int)i, (int)i));
+    }
+    atomic<bool> stop(false);
+    atomic<long> lookups(0);
+    vector<thread> threads;
+    threads.push_back(thread([&] {
+        mt19937 gen(1);
+        while(!stop.load(memory_order_relaxed)) {
+            int k = (int)(gen() % n) | 1;
+            tree.insert(make_pair(k, k));
+            tree.remove(k);
+        }
+    }));
+    for(size_t r = 0; r < readers; r++) {
+        threads.push_back(thread([&, r] {
+            mt19937 gen((unsigned)r + 2);
+            long done = 0;
+            long found = 0;
+            int value;
+            while(!stop.load(memory_order_relaxed)) {
+                found += tree.find((int)(gen() % n), value);
+                done++;
+            }
+            sink = found;
+            lookups += done;
+        }));
+    }
+    this_thread::sleep_for(chrono::milliseconds(runMs));
+    stop = true;
+    for(size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    string label = string(name) + ", " + to_string(readers) + " reader" + (readers > 1 ? "s" : "");
+    cout << left << setw(34) << label << setw(10) << n / 2 << fixed << setprecision(2)
+         << lookups.load() / (runMs * 1000.0) << " M lookups/s" << endl;
+}
+
+/**
+* Cost of path copying: random inserts into AVLTree and PersistentAVLTree,
+* then the price of a snapshot and of scanning one.
+*/
+void persistentBench(const vector<int>& keys)
+{
+    AVLTree<int,int> plain;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < keys.size(); i++) {
+        plain.insert(make_pair(keys[i], (int)i));
+    }
+    Clock::time_point stop = Clock::now();
+    cout << left << setw(34) << "AVLTree insert" << setw(10) << keys.size()
+         << fixed << setprecision(1) << nsPer(start, stop, keys.size()) << " ns/op" << endl;
+
+    PersistentAVLTree<int,int> versions;
+    start = Clock::now();
+    for(size_t i = 0; i < keys.size(); i++) {
+        versions.insert(make_pair(keys[i], (int)i));
+    }
+    stop = Clock::now();
+    cout << left << setw(34) << "PersistentAVLTree insert" << setw(10) << keys.size()
+         << fixed << setprecision(1) << nsPer(start, stop, keys.size()) << " ns/op" << endl;
+
+    const size_t SNAPSHOTS = 100000;
+    long total = 0;
+    start = Clock::now();
+    for(size_t i = 0; i < SNAPSHOTS; i++) {
+        total += (long)versions.snapshot().size();
+    }
+    stop = Clock::now();
+    cout << left << setw(34) << "PersistentAVLTree snapshot()" << setw(10) << keys.size()
+         << fixed << setprecision(1) << nsPer(start, stop, SNAPSHOTS) << " ns/op" << endl;
+
+    PersistentAVLTree<int,int>::Snapshot view = versions.snapshot();
+    start = Clock::now();
+    for(PersistentAVLTree<int,int>::Snapshot::iterator it = view.begin(); it != view.end(); ++it) {
+        total += it->second;
+    }
+    stop = Clock::now();
+    sink = total;
+    cout << left << setw(34) << "Snapshot scan" << setw(10) << keys.size()
+         << fixed << setprecision(1) << nsPer(start, stop, keys.size()) << " ns/item" << endl;
+}
+
+/**
+* Tearing down a tree of n nodes: node by node, on a pool of 4 threads,
+* and by releasing a private arena.
+*/
+void teardownBench(size_t n)
+{
+    vector<pair<int,int> > items;
+    for(size_t i = 0; i < n; i++) {
+        items.push_back(make_pair((int)i, (int)i));
+    }
+    ThreadPool workers(4);
+    for(int mode = 0; mode < 2; mode++) {
+        AVLTree<int,int> tree;
+        tree.assignSorted(items.begin(), items.end());
+        Clock::time_point start = Clock::now();
+        tree.clear(mode == 0 ? NULL : &workers);
+        Clock::time_point stop = Clock::now();
+        cout << left << setw(34) << (mode == 0 ? "clear()" : "clear(pool of 4)") << setw(10) << n
+             << fixed << setprecision(1) << nsPer(start, stop, n) << " ns/node" << endl;
+    }
+    AVLTree<int,int,std::less<int>,PoolNodeAllocator> pooled((PoolNodeAllocator()));
+    pooled.assignSorted(items.begin(), items.end());
+    Clock::time_point start = Clock::now();
+    pooled.clear();
+    Clock::time_point stop = Clock::now();
+    cout << left << setw(34) << "clear(), arena release" << setw(10) << n
+         << fixed << setprecision(1) << nsPer(start, stop, n) << " ns/node" << endl;
+}
+
+/**
+* Price of epoch-based reclamation on one thread: an empty read-side
+* critical section, and retiring plus later freeing one node.
+*/
+void epochBench(size_t ops)
+{
+    EpochDomain domain;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < ops; i++) {
+        EpochDomain::Guard guard(domain);
+    }
+    Clock::time_point stop = Clock::now();
+    cout << left << setw(34) << "Guard enter + exit" << setw(10) << ops
+         << fixed << setprecision(1) << nsPer(start, stop, ops) << " ns/op" << endl;
+
+    EpochDomain::Deleter release = [](void* object, void*) { delete static_cast<AVLNode<int,int>*>(object); };
+    start = Clock::now();
+    for(size_t i = 0; i < ops; i++) {
+        EpochDomain::Guard guard(domain);
+        domain.retire(new AVLNode<int,int>((int)i, (int)i, NULL), release, NULL);
+    }
+    domain.drain();
+    stop = Clock::now();
+    cout << left << setw(34) << "new + retire + free" << setw(10) << ops
+         << fixed << setprecision(1) << nsPer(start, stop, ops) << " ns/op" << endl;
+}
+
+/**
+* A ShardedAVLMap split into equal key ranges over [0, 100000), the key
+* range contendedBench uses below.
+*/
+class RangeShardedMap : public ShardedAVLMap<int,int,16>
+{
+public:
+    RangeShardedMap() : ShardedAVLMap<int,int,16>(bounds()) { }
+
+private:
+    static vector<int> bounds()
+    {
+        vector<int> result;
+        for(int i = 1; i < 16; i++) {
+            result.push_back(i * 100000 / 16);
+        }
+        return result;
+    }
+};
+
+/**
+* Operations per second summed over threads, each running a write-heavy
+* mix (half lookups, a quarter inserts, a quarter removes) over keyRange
+* keys for runMs milliseconds.
+*/
+template<typename Tree>
+void contendedBench(const char* name, size_t keyRange, size_t threadCount, int runMs)
+{
+    vector<int> initial;
+    for(size_t i = 0; i < keyRange; i += 2) {
+        initial.push_back((int)i);
+    }
+    shuffle(initial.begin(), initial.end(), mt19937(5)); //random order, LockFreeBST does not rebalance
+    Tree tree;
+    for(size_t i = 0; i < initial.size(); i++) {
+        tree.insert(make_pair(initial[i], initial[i]));
+    }
+    atomic<bool> stop(false);
+    atomic<long> ops(0);
+    vector<thread> threads;
+    for(size_t t = 0; t < threadCount; t++) {
+        threads.push_back(thread([&, t] {
+            mt19937 gen((unsigned)t + 1);
+            long done = 0;
+            long found = 0;
+            int value;
+            while(!stop.load(memory_order_relaxed)) {
+                unsigned r = gen();
+                int k = (int)((r >> 2) % keyRange);
+                switch(r & 3) {
+                case 0:
+                    tree.insert(make_pair(k, k));
+                    break;
+                case 1:
+                    tree.remove(k);
+                    break;
+                default:
+                    found += tree.find(k, value);
+                }
+                done++;
+            }
+            sink = found;
+            ops += done;
+        }));
+    }
+    this_thread::sleep_for(chrono::milliseconds(runMs));
+    stop = true;
+    for(size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    string label = string(name) + ", " + to_string(threadCount) + " thread" + (threadCount > 1 ? "s" : "");
+    cout << left << setw(34) << label << setw(10) << keyRange << fixed << setprecision(2)
+         << ops.load() / (runMs * 1000.0) << " M ops/s" << endl;
+}
+
+template<typename Tree>
+void scanBench(const char* name, const vector<int>& keys)
+{
+    Tree tree;
+    for(size_t i = 0; i < keys.size(); i++) {
+        tree.insert(make_pair(keys[i], (int)i));
+    }
+
+    long total = 0;
+    Clock::time_point start = Clock::now();
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        total += it->second;
+    }
+    Clock::time_point stop = Clock::now();
+    sink = total;
+    cout << left << setw(34) << name << setw(10) << keys.size()
+         << fixed << setprecision(1) << nsPer(start, stop, keys.size()) << " ns/item" << endl;
+}
+
+template<typename Search>
+double nodeSearchNs(const int* keys, size_t count, const vector<int>& probes)
+{
+    long total = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < probes.size(); i++) {
+        total += Search::lowerBound(keys, count, probes[i]);
+    }
+    Clock::time_point stop = Clock::now();
+    sink = total;
+    return nsPer(start, stop, probes.size());
+}
+
+void nodeSearchBench(size_t count)
+{
+    vector<int> keys(nodeSearchSlots<int>(count));
+    for(size_t i = 0; i < count; i++) {
+        keys[i] = (int)(i * 16);
+    }
+    vector<int> probes(1000000);
+    mt19937 rng(3);
+    for(size_t i = 0; i < probes.size(); i++) {
+        probes[i] = (int)(rng() % (count * 16 + 16));
+    }
+    cout << left << setw(34) << "int keys per node" << setw(10) << count << fixed << setprecision(1)
+         << "scalar " << nodeSearchNs<ScalarNodeSearch<int> >(&keys[0], count, probes) << " ns, "
+         << "vector " << nodeSearchNs<NodeSearch<int> >(&keys[0], count, probes) << " ns" << endl;
+}
+
+template<typename Tree>
+void buildBench(const char* name, const vector<pair<int,int> >& sorted)
+{
+    {
+        Tree tree;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < sorted.size(); i++) {
+            tree.insert(sorted[i]);
+        }
+        Clock::time_point stop = Clock::now();
+        cout << left << setw(34) << name << setw(10) << sorted.size() << fixed << setprecision(1)
+             << "insert loop " << nsPer(start, stop, sorted.size()) << " ns/item, ";
+    }
+    {
+        Tree tree;
+        Clock::time_point start = Clock::now();
+        tree.assignSorted(sorted.begin(), sorted.end());
+        Clock::time_point stop = Clock::now();
+        cout << "assignSorted " << nsPer(start, stop, sorted.size()) << " ns/item" << endl;
+    }
+}
+
+template<typename Tree>
+double insertRounds(const vector<int>& base, const vector<vector<pair<int,int> > >& batches, bool batched)
+{
+    Tree tree;
+    vector<pair<int,int> > sorted;
+    for(size_t i = 0; i < base.size(); i++) {
+        sorted.push_back(make_pair(base[i], 0));
+    }
+    tree.assignSorted(sorted.begin(), sorted.end());
+
+    size_t items = 0;
+    Clock::time_point start = Clock::now();
+    for(size_t b = 0; b < batches.size(); b++) {
+        if(batched) {
+            tree.insertBatch(batches[b].begin(), batches[b].end());
+        }
+        else {
+            for(size_t i = 0; i < batches[b].size(); i++) {
+                tree.insert(batches[b][i]);
+            }
+        }
+        items += batches[b].size();
+    }
+    Clock::time_point stop = Clock::now();
+    return items / chrono::duration<double>(stop - start).count() / 1e6;
+}
+
+void batchBench(size_t n, size_t batchSize, size_t rounds, bool clustered)
+{
+    // the tree holds the even numbers, batches bring random odd ones
+    vector<int> base;
+    for(size_t i = 0; i < n; i++) {
+        base.push_back((int)(2 * i));
+    }
+    mt19937 rng(11);
+    vector<vector<pair<int,int> > > batches(rounds);
+    for(size_t b = 0; b < rounds; b++) {
+        size_t offset = rng() % n;
+        for(size_t i = 0; i < batchSize; i++) {
+            size_t k = clustered ? (offset + rng() % batchSize) % n : rng() % n;
+            batches[b].push_back(make_pair((int)(2 * k + 1), (int)i));
+        }
+    }
+    cout << left << setw(34) << (clustered ? "AVLTree, clustered batch of" : "AVLTree, random batch of") << setw(10) << batchSize << fixed << setprecision(2)
+         << "single inserts " << insertRounds<AVLTree<int,int> >(base, batches, false) << " M/s, "
+         << "insertBatch " << insertRounds<AVLTree<int,int> >(base, batches, true) << " M/s" << endl;
+}
+
+/*
+  Workload suite: BinarySearchTree, AVLTree and std::map under the same
+  workloads and key distributions. Run with --suite; see runSuite.
+*/
+
+/**
+* Zipfian ranks over [0, n) with skew theta, after Gray et al., "Quickly
+* Generating Billion-Record Synthetic Databases" (the YCSB generator).
+* Setup is O(n), every draw O(1).
+*/
+class ZipfGenerator
+{
+public:
+    ZipfGenerator(size_t n, double theta, unsigned seed) :
+        n_(n),
+        theta_(theta),
+        gen_(seed),
+        uniform_(0.0, 1.0)
+    {
+        zetan_ = 0;
+        for(size_t i = 1; i <= n; i++) {
+            zetan_ += 1.0 / pow((double)i, theta);
+        }
+        double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan_);
+    }
+
+    size_t next()
+    {
+        double u = uniform_(gen_);
+        double uz = u * zetan_;
+        if(uz < 1.0) {
+            return 0;
+        }
+        if(uz < 1.0 + pow(0.5, theta_)) {
+            return 1;
+        }
+        size_t rank = (size_t)(n_ * pow(eta_ * u - eta_ + 1.0, alpha_));
+        return rank < n_ ? rank : n_ - 1;
+    }
+
+private:
+    size_t n_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+    mt19937_64 gen_;
+    uniform_real_distribution<double> uniform_;
+};
+
+enum Distribution { UNIFORM, SEQUENTIAL, REVERSE, ZIPFIAN };
+static const char* const DISTRIBUTION_NAMES[] = { "uniform", "sequential", "reverse", "zipfian" };
+
+// The tree operations the suite needs, so std::map can stand in for ours.
+template<typename Tree>
+struct SuiteOps
+{
+    static void insert(Tree& tree, int key, int value) { tree.insert(make_pair(key, value)); }
+    static bool find(const Tree& tree, int key) { return tree.find(key) != tree.end(); }
+    static void erase(Tree& tree, int key) { tree.remove(key); }
+};
+
+template<>
+struct SuiteOps<map<int,int> >
+{
+    static void insert(map<int,int>& tree, int key, int value) { tree[key] = value; }
+    static bool find(const map<int,int>& tree, int key) { return tree.find(key) != tree.end(); }
+    static void erase(map<int,int>& tree, int key) { tree.erase(key); }
+};
+
+// One workload of one run. Latencies are in ns and include the cost of
+// reading the clock around the sampled operations.
+struct SuiteRow
+{
+    string structure;
+    string distribution;
+    size_t n;
+    string workload;
+    double opsPerSec;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+    long peakRssKb;
+    double vsMap;    // opsPerSec over std::map's for the same run, 0 if none
+};
+
+/**
+* Runs op(0) .. op(ops - 1) and fills in throughput and latency
+* percentiles. Only every k-th operation is timed on its own, about 50000
+* in all, so the clock reads barely touch the throughput.
+*/
+template<typename F>
+void timeWorkload(size_t ops, F op, SuiteRow& row)
+{
+    size_t every = max<size_t>(1, ops / 50000);
+    vector<double> samples;
+    samples.reserve(ops / every + 1);
+    Clock::time_point start = Clock::now();
+    for(size_t j = 0; j < ops; j++) {
+        if(j % every == 0) {
+            Clock::time_point before = Clock::now();
+            op(j);
+            samples.push_back(chrono::duration<double, nano>(Clock::now() - before).count());
+        }
+        else {
+            op(j);
+        }
+    }
+    Clock::time_point stop = Clock::now();
+    sort(samples.begin(), samples.end());
+    row.opsPerSec = ops / chrono::duration<double>(stop - start).count();
+    row.p50 = samples[samples.size() / 2];
+    row.p90 = samples[samples.size() * 9 / 10];
+    row.p99 = samples[samples.size() * 99 / 100];
+    row.max = samples.back();
+}
+
+/**
+* Every workload on one structure, distribution and size. Keys present in
+* the tree are even, misses are odd. The distribution sets both the
+* insertion order and the order of lookups; zipfian inserts in random
+* order and draws lookups from a zipfian (0.99) rank mapped through a
+* random permutation, so the hot keys are spread over the tree.
+*/
+template<typename Tree>
+vector<SuiteRow> runWorkloads(Distribution dist, size_t n)
+{
+    typedef SuiteOps<Tree> Ops;
+    mt19937 gen(17);
+    vector<int> order(n);
+    for(size_t i = 0; i < n; i++) {
+        order[i] = (int)(dist == REVERSE ? n - 1 - i : i);
+    }
+    if(dist == UNIFORM || dist == ZIPFIAN) {
+        shuffle(order.begin(), order.end(), gen);
+    }
+    size_t ops = min<size_t>(max<size_t>(n, 200000), 2000000);
+    vector<int> probes(ops);
+    if(dist == ZIPFIAN) {
+        ZipfGenerator zipf(n, 0.99, 23);
+        for(size_t j = 0; j < ops; j++) {
+            probes[j] = order[zipf.next()];
+        }
+    }
+    else if(dist == UNIFORM) {
+        for(size_t j = 0; j < ops; j++) {
+            probes[j] = (int)(gen() % n);
+        }
+    }
+    else {
+        for(size_t j = 0; j < ops; j++) {
+            probes[j] = order[j % n];
+        }
+    }
+
+    vector<SuiteRow> rows;
+    SuiteRow row = SuiteRow();
+    row.n = n;
+    Tree tree;
+    long found = 0;
+
+    row.workload = "insert";
+    timeWorkload(n, [&](size_t j) { Ops::insert(tree, 2 * order[j], order[j]); }, row);
+    rows.push_back(row);
+
+    row.workload = "find-hit";
+    timeWorkload(ops, [&](size_t j) { found += Ops::find(tree, 2 * probes[j]); }, row);
+    rows.push_back(row);
+
+    row.workload = "find-miss";
+    timeWorkload(ops, [&](size_t j) { found += Ops::find(tree, 2 * probes[j] + 1); }, row);
+    rows.push_back(row);
+
+    row.workload = "iterate";
+    typename Tree::iterator it = tree.begin();
+    timeWorkload(ops, [&](size_t) {
+        if(it == tree.end()) {
+            it = tree.begin();
+        }
+        found += it->second;
+        ++it;
+    }, row);
+    rows.push_back(row);
+
+    row.workload = "mixed";    // half finds, a quarter inserts, a quarter removes
+    timeWorkload(ops, [&](size_t j) {
+        int key = 2 * probes[j];
+        switch(j & 3) {
+        case 0:
+            Ops::insert(tree, key, (int)j);
+            break;
+        case 1:
+            Ops::erase(tree, key);
+            break;
+        default:
+            found += Ops::find(tree, key);
+        }
+    }, row);
+    rows.push_back(row);
+
+    row.workload = "remove";
+    timeWorkload(n, [&](size_t j) { Ops::erase(tree, 2 * order[j]); }, row);
+    rows.push_back(row);
+
+    sink = found;
+    return rows;
+}
+
+/**
+* Runs the workloads in a child process, so that its peak RSS belongs to
+* this run alone. The rows come back through a pipe as text.
+*/
+template<typename Tree>
+vector<SuiteRow> runIsolated(const char* structure, Distribution dist, size_t n)
+{
+    vector<SuiteRow> rows;
+    int fds[2];
+    if(pipe(fds) != 0) {
+        perror("pipe");
+        return rows;
+    }
+    pid_t pid = fork();
+    if(pid == 0) {
+        close(fds[0]);
+        vector<SuiteRow> result = runWorkloads<Tree>(dist, n);
+        FILE* out = fdopen(fds[1], "w");
+        for(size_t i = 0; i < result.size(); i++) {
+            fprintf(out, "%s %.1f %.1f %.1f %.1f %.1f\n", result[i].workload.c_str(), result[i].opsPerSec,
+                    result[i].p50, result[i].p90, result[i].p99, result[i].max);
+        }
+        fclose(out);
+        _exit(0);
+    }
+    close(fds[1]);
+    FILE* in = fdopen(fds[0], "r");
+    char workload[32];
+    SuiteRow row = SuiteRow();
+    while(fscanf(in, "%31s %lf %lf %lf %lf %lf", workload, &row.opsPerSec, &row.p50, &row.p90, &row.p99, &row.max) == 6) {
+        row.structure = structure;
+        row.distribution = DISTRIBUTION_NAMES[dist];
+        row.n = n;
+        row.workload = workload;
+        rows.push_back(row);
+    }
+    fclose(in);
+    int status;
+    struct rusage usage;
+    if(pid > 0 && wait4(pid, &status, 0, &usage) == pid) {
+        for(size_t i = 0; i < rows.size(); i++) {
+            rows[i].peakRssKb = usage.ru_maxrss;
+        }
+    }
+    return rows;
+}
+
+void writeCsv(const string& path, const vector<SuiteRow>& rows)
+{
+    ofstream out(path.c_str());
+    out << "structure,distribution,n,workload,ops_per_sec,p50_ns,p90_ns,p99_ns,max_ns,peak_rss_kb,vs_map" << endl;
+    for(size_t i = 0; i < rows.size(); i++) {
+        const SuiteRow& r = rows[i];
+        out << r.structure << "," << r.distribution << "," << r.n << "," << r.workload << ","
+            << fixed << setprecision(1) << r.opsPerSec << "," << r.p50 << "," << r.p90 << "," << r.p99 << ","
+            << r.max << "," << r.peakRssKb << "," << setprecision(3) << r.vsMap << endl;
+    }
+}
+
+void writeJson(const string& path, const vector<SuiteRow>& rows)
+{
+    ofstream out(path.c_str());
+    out << "[" << endl;
+    for(size_t i = 0; i < rows.size(); i++) {
+        const SuiteRow& r = rows[i];
+        out << "  {\"structure\": \"" << r.structure << "\", \"distribution\": \"" << r.distribution
+            << "\", \"n\": " << r.n << ", \"workload\": \"" << r.workload << "\", "
+            << fixed << setprecision(1) << "\"ops_per_sec\": " << r.opsPerSec << ", \"p50_ns\": " << r.p50
+            << ", \"p90_ns\": " << r.p90 << ", \"p99_ns\": " << r.p99 << ", \"max_ns\": " << r.max
+            << ", \"peak_rss_kb\": " << r.peakRssKb << ", \"vs_map\": " << setprecision(3) << r.vsMap << "}"
+            << (i + 1 < rows.size() ? "," : "") << endl;
+    }
+    out << "]" << endl;
+}
+
+/**
+* bst-bench --suite [--max-size N] [--csv FILE] [--json FILE]
+*
+* Every structure, distribution and size from 1000 up to N (default
+* 1000000, at most 10000000) in powers of ten. The unbalanced
+* BinarySearchTree is skipped for sorted inputs above 10000 keys, where
+* each operation walks a list.
+*/
+int runSuite(int argc, char *argv[])
+{
+    size_t maxSize = 1000000;
+    string csvPath;
+    string jsonPath;
+    for(int i = 2; i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        if(flag == "--max-size") {
+            maxSize = min<size_t>(strtoul(argv[i + 1], NULL, 10), 10000000);
+        }
+        else if(flag == "--csv") {
+            csvPath = argv[i + 1];
+        }
+        else if(flag == "--json") {
+            jsonPath = argv[i + 1];
+        }
+        else {
+            cerr << "unknown option " << flag << endl;
+            return 1;
+        }
+    }
+
+    vector<SuiteRow> all;
+    cout << left << setw(18) << "structure" << setw(12) << "keys" << setw(10) << "n" << setw(11) << "workload"
+         << right << setw(10) << "Mops/s" << setw(9) << "p50 ns" << setw(9) << "p90 ns" << setw(9) << "p99 ns"
+         << setw(10) << "max ns" << setw(9) << "RSS MB" << setw(8) << "x map" << endl;
+    for(size_t n = 1000; n <= maxSize; n *= 10) {
+        for(int d = UNIFORM; d <= ZIPFIAN; d++) {
+            Distribution dist = (Distribution)d;
+            vector<SuiteRow> rows = runIsolated<map<int,int> >("std::map", dist, n);
+            vector<SuiteRow> avl = runIsolated<AVLTree<int,int> >("AVLTree", dist, n);
+            rows.insert(rows.end(), avl.begin(), avl.end());
+            if(n <= 10000 || dist == UNIFORM || dist == ZIPFIAN) {
+                vector<SuiteRow> bst = runIsolated<BinarySearchTree<int,int> >("BinarySearchTree", dist, n);
+                rows.insert(rows.end(), bst.begin(), bst.end());
+            }
+            for(size_t i = 0; i < rows.size(); i++) {
+                SuiteRow& r = rows[i];
+                for(size_t j = 0; j < rows.size(); j++) {
+                    if(rows[j].structure == "std::map" && rows[j].workload == r.workload) {
+                        r.vsMap = r.opsPerSec / rows[j].opsPerSec;
+                    }
+                }
+                cout << left << setw(18) << r.structure << setw(12) << r.distribution << setw(10) << r.n
+                     << setw(11) << r.workload << right << fixed << setprecision(2) << setw(10) << r.opsPerSec / 1e6
+                     << setprecision(0) << setw(9) << r.p50 << setw(9) << r.p90 << setw(9) << r.p99 << setw(10) << r.max
+                     << setprecision(1) << setw(9) << r.peakRssKb / 1024.0 << setprecision(2) << setw(8) << r.vsMap << endl;
+            }
+            all.insert(all.end(), rows.begin(), rows.end());
+        }
+    }
+    if(!csvPath.empty()) {
+        writeCsv(csvPath, all);
+    }
+    if(!jsonPath.empty()) {
+        writeJson(jsonPath, all);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc > 1 && string(argv[1]) == "--suite") {
+        return runSuite(argc, argv);
+    }
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+    cout << "Node sizes (bytes):" << endl;
+    cout << "  Node<int,int>     " << sizeof(Node<int,int>) << endl;
+    cout << "  AVLNode<int,int>  " << sizeof(AVLNode<int,int>) << endl;
+    cout << endl;
+
+    vector<int> keys(n);
+    for(size_t i = 0; i < n; i++) {
+        keys[i] = (int)i;
+    }
+    shuffle(keys.begin(), keys.end(), mt19937(42));
+
+    cout << "Lookup latency (random insertion order):" << endl;
+    lookupBench<BinarySearchTree<int,int> >("BinarySearchTree<int,int>", keys);
+    lookupBench<BinarySearchTree<int,int,std::less<int>,PoolNodeAllocator> >("BinarySearchTree<int,int,Pool>", keys);
+    lookupBench<AVLTree<int,int> >("AVLTree<int,int>", keys);
+    lookupBench<BTree<int,int> >("BTree<int,int>", keys);
+    cout << endl;
+
+    cout << "Latency per operation, ns (random order):" << endl;
+    cout << left << setw(44) << "" << right << setw(8) << "p50" << setw(8) << "p99" << setw(9) << "p99.9"
+         << setw(11) << "max" << left << endl;
+    latencyBench<BinarySearchTree<int,int> >("BinarySearchTree<int,int>", keys);
+    latencyBench<AVLTree<int,int> >("AVLTree<int,int>", keys);
+    cout << endl;
+
+#ifdef BST_STATS
+    cout << "Counts per operation (random order):" << endl;
+    cout << left << setw(44) << "" << setw(8) << "cmp" << setw(8) << "visits" << setw(10) << "rotations"
+         << setw(11) << "insertFix" << "nodeSwap" << endl;
+    statsBench<BinarySearchTree<int,int> >("BinarySearchTree<int,int>", keys);
+    statsBench<AVLTree<int,int> >("AVLTree<int,int>", keys);
+    cout << endl;
+#endif
+
+    cout << "String key lookup (shared 16 byte prefix):" << endl;
+    vector<string> names(n);
+    for(size_t i = 0; i < n; i++) {
+        names[i] = "customer/record/" + to_string(keys[i]);
+    }
+    stringLookupBench<AVLTree<string,int>, string>("AVLTree, find(string)", names);
+    stringLookupBench<AVLTree<string,int>, const char*>("AVLTree, find(const char*)", names);
+    stringLookupBench<AVLTree<string,int,less<> >, string_view>("AVLTree less<>, find(string_view)", names);
+    cout << endl;
+
+    cout << "Intra-node search (" << (SimdSearchable<int>::value ? "vector" : "no vector support") << "):" << endl;
+    nodeSearchBench(BTree<int,int>::INNER_CAPACITY);
+    nodeSearchBench(BTree<int,int>::LEAF_CAPACITY);
+    cout << endl;
+
+    cout << "Startup build from a sorted snapshot:" << endl;
+    vector<pair<int,int> > sorted(n);
+    for(size_t i = 0; i < n; i++) {
+        sorted[i] = make_pair((int)i, (int)i);
+    }
+    buildBench<AVLTree<int,int> >("AVLTree<int,int>", sorted);
+    buildBench<AVLTree<int,int,std::less<int>,PoolNodeAllocator> >("AVLTree<int,int,Pool>", sorted);
+    cout << endl;
+
+    cout << "Batched inserts into a tree of " << n << " keys:" << endl;
+    batchBench(n, 1000, 100, false);
+    batchBench(n, 1000, 100, true);
+    batchBench(n, n / 2, 2, false);
+    cout << endl;
+
+    cout << "Order statistics:" << endl;
+    orderStatBench(keys);
+    cout << endl;
+
+    cout << "Moving a key range out and back in a tree of " << n << " keys:" << endl;
+    sliceBench(n);
+    cout << endl;
+
+    cout << "Set operations on two trees of about " << 4 * n / 3 << " keys each ("
+         << thread::hardware_concurrency() << " hardware threads):" << endl;
+    setOpBench(n);
+    cout << endl;
+
+    cout << "Shared map, one writer (" << thread::hardware_concurrency() << " hardware threads):" << endl;
+    size_t maxReaders = max<size_t>(thread::hardware_concurrency(), 4);
+    for(size_t readers = 1; readers <= maxReaders; readers *= 2) {
+        sharedReadBench<LockedAVLTree>("AVLTree + mutex", n, readers, 300);
+        sharedReadBench<ConcurrentAVLTree<int,int> >("ConcurrentAVLTree", n, readers, 300);
+    }
+    cout << endl;
+
+    cout << "Write-heavy mix on a shared map (" << thread::hardware_concurrency() << " hardware threads):" << endl;
+    for(size_t threads = 1; threads <= maxReaders; threads *= 2) {
+        contendedBench<LockedAVLTree>("AVLTree + mutex", 100000, threads, 300);
+        contendedBench<ConcurrentAVLTree<int,int> >("ConcurrentAVLTree", 100000, threads, 300);
+        contendedBench<LockFreeBST<int,int> >("LockFreeBST", 100000, threads, 300);
+    }
+    cout << endl;
+
+    cout << "Lock contention, write-heavy mix over 100000 keys:" << endl;
+    size_t threadCounts[] = { 1, 8, 32 };
+    for(size_t i = 0; i < 3; i++) {
+        contendedBench<LockedAVLTree>("AVLTree + mutex", 100000, threadCounts[i], 300);
+        contendedBench<FlatCombiningAVLTree<int,int> >("Flat combining", 100000, threadCounts[i], 300);
+        contendedBench<ShardedAVLMap<int,int,16> >("Sharded<16> hash", 100000, threadCounts[i], 300);
+        contendedBench<RangeShardedMap>("Sharded<16> range", 100000, threadCounts[i], 300);
+    }
+    cout << endl;
+
+    cout << "Persistent tree (path copying):" << endl;
+    persistentBench(keys);
+    cout << endl;
+
+    cout << "Teardown:" << endl;
+    teardownBench(n);
+    cout << endl;
+
+    cout << "Epoch-based reclamation:" << endl;
+    epochBench(1000000);
+    cout << endl;
+
+    cout << "Window scans over " << n << " keys:" << endl;
+    windowBench(keys, 100, 1000);
+    windowBench(keys, 10000, 100);
+    cout << endl;
+
+    cout << "In-order scan:" << endl;
+    scanBench<BinarySearchTree<int,int> >("BinarySearchTree<int,int>", keys);
+    scanBench<BTree<int,int> >("BTree<int,int>", keys);
+    return 0;
+}
@@ -1,10 +1,371 @@
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 #include "bst.h"
 #include "avlbst.h"
+#include "btree.h"
+#include "concurrent-avl.h"
+#include "epoch.h"
+#include "flat-combining-avl.h"
+#include "lock-free-bst.h"
+#include "sharded-avl-map.h"
+#include "persistent-avl.h"
+#include "latency-histogram.h"
+#include <pthread.h>
 
 using namespace std;
 
+// Counts every global allocation and free so the tests can check how
+// many a tree operation performs. Atomic because the concurrent tests
+// allocate from several threads. Every plain, array and nothrow form is
+// replaced, so that a block never goes back through a different allocator
+// than it came from (sanitizers replace the forms left out).
+static atomic<size_t> allocations(0);
+static atomic<size_t> deallocations(0);
+
+static void* countedAlloc(size_t bytes)
+{
+    allocations++;
+    return malloc(bytes == 0 ? 1 : bytes);
+}
+
+static void countedFree(void* p)
+{
+    if(p != NULL) {
+        deallocations++;
+    }
+    free(p);
+}
+
+void* operator new(size_t bytes)
+{
+    void* p = countedAlloc(bytes);
+    if(p == NULL) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t bytes)
+{
+    return operator new(bytes);
+}
+
+void* operator new(size_t bytes, const nothrow_t&) noexcept
+{
+    return countedAlloc(bytes);
+}
+
+void* operator new[](size_t bytes, const nothrow_t&) noexcept
+{
+    return countedAlloc(bytes);
+}
+
+void operator delete(void* p) noexcept
+{
+    countedFree(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    countedFree(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    countedFree(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    countedFree(p);
+}
+
+void operator delete(void* p, const nothrow_t&) noexcept
+{
+    countedFree(p);
+}
+
+void operator delete[](void* p, const nothrow_t&) noexcept
+{
+    countedFree(p);
+}
+
+// A value that counts how often it is copied or moved.
+struct Tracked
+{
+    static int copies;
+    static int moves;
+    int id;
+
+    Tracked(int i = 0) : id(i) { }
+    Tracked(const Tracked& other) : id(other.id) { copies++; }
+    Tracked(Tracked&& other) : id(other.id) { moves++; }
+    Tracked& operator=(const Tracked& other) { id = other.id; copies++; return *this; }
+    Tracked& operator=(Tracked&& other) { id = other.id; moves++; return *this; }
+};
+
+int Tracked::copies = 0;
+int Tracked::moves = 0;
+
+ostream& operator<<(ostream& os, const Tracked& t)
+{
+    return os << t.id;
+}
+
+// An int ordering that counts how often it is called.
+struct CountingLess
+{
+    static long calls;
+
+    bool operator()(int a, int b) const
+    {
+        calls++;
+        return a < b;
+    }
+};
+
+long CountingLess::calls = 0;
+
+// An int ordering that parks a thread the first time it compares against
+// point->key, if that thread has set armed, until point->resume is set.
+// Stops a reader at a chosen node of a ConcurrentAVLTree.
+struct PausingLess
+{
+    struct Point
+    {
+        atomic<int> key;
+        atomic<bool> reached;
+        atomic<bool> resume;
+    };
+
+    static thread_local bool armed;
+    Point* point;
+
+    PausingLess(Point* p = NULL) : point(p) { }
+
+    bool operator()(int a, int b) const
+    {
+        if(armed && (a == point->key || b == point->key)) {
+            armed = false;
+            point->reached = true;
+            while(!point->resume) {
+                this_thread::yield();
+            }
+        }
+        return a < b;
+    }
+};
+
+thread_local bool PausingLess::armed = false;
+
+// Builds the degenerate tree that sorted inserts into a plain BST leave
+// behind, a right spine, in linear time.
+class SpineBST : public BinarySearchTree<int,int>
+{
+public:
+    void buildSpine(int n)
+    {
+        clear();
+        Node<int,int>* last = NULL;
+        for(int i = 0; i < n; i++) {
+            Node<int,int>* node = createNode<Node<int,int> >(i, i, last);
+            if(last == NULL) {
+                root_ = node;
+            }
+            else {
+                last->setRight(node);
+            }
+            last = node;
+        }
+    }
+};
+
+// Exposes the AVL invariants of a tree for checking: parent links, local
+// key order, stored balances equal to the real height difference, every
+// balance within [-1, 1], and stored subtree sizes.
+template<typename Key, typename Value, typename Alloc = HeapNodeAllocator>
+class CheckedAVLTree : public AVLTree<Key, Value, std::less<Key>, Alloc>
+{
+public:
+    CheckedAVLTree() { }
+    explicit CheckedAVLTree(const Alloc& alloc) : AVLTree<Key, Value, std::less<Key>, Alloc>(alloc) { }
+    CheckedAVLTree(AVLTree<Key, Value, std::less<Key>, Alloc>&& other) : AVLTree<Key, Value, std::less<Key>, Alloc>(std::move(other)) { }
+
+    bool valid() const
+    {
+        int height;
+        uint32_t size;
+        return check(static_cast<AVLNode<Key, Value>*>(this->root_), NULL, height, size);
+    }
+
+    // Breaks the root's balance factor behind the tree's back.
+    void skewRoot()
+    {
+        AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+        root->setBalance((int8_t)(root->getBalance() + 2));
+    }
+
+    // Runs the incremental validator from the node holding key up.
+    bool pathValid(const Key& key) const
+    {
+        try {
+            this->validatePath(static_cast<AVLNode<Key, Value>*>(this->internalFind(key)));
+        }
+        catch (const logic_error&) {
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static bool check(AVLNode<Key, Value>* n, AVLNode<Key, Value>* parent, int& height, uint32_t& size)
+    {
+        height = 0;
+        size = 0;
+        if(n == NULL) {
+            return true;
+        }
+        int leftH, rightH;
+        uint32_t leftS, rightS;
+        if(n->getParent() != parent ||
+           !check(n->getLeft(), n, leftH, leftS) || !check(n->getRight(), n, rightH, rightS)) {
+            return false;
+        }
+        size = 1 + leftS + rightS;
+        if(n->getSize() != size) {
+            return false;
+        }
+        if((n->getLeft() != NULL && !(n->getLeft()->getKey() < n->getKey())) ||
+           (n->getRight() != NULL && !(n->getKey() < n->getRight()->getKey()))) {
+            return false;
+        }
+        height = 1 + max(leftH, rightH);
+        return n->getBalance() == rightH - leftH && n->getBalance() >= -1 && n->getBalance() <= 1;
+    }
+};
+
+// Checks order, parent links and heights of a ConcurrentAVLTree, and that
+// every node is unlocked.
+template<typename Key, typename Value, typename Compare = std::less<Key> >
+class CheckedConcurrentAVLTree : public ConcurrentAVLTree<Key, Value, Compare>
+{
+public:
+    CheckedConcurrentAVLTree(const Compare& comp = Compare()) : ConcurrentAVLTree<Key, Value, Compare>(comp) { }
+
+    bool valid() const
+    {
+        int height;
+        size_t count;
+        return check(this->root_.load(), NULL, height, count) && count == this->size() && this->rootVersion_.load() % 4 == 0;
+    }
+
+    // The root's key, its right child's key and its successor's key.
+    // Returns false unless the successor lies below that right child.
+    bool successorPath(Key& top, Key& right, Key& successor) const
+    {
+        N* n = this->root_.load();
+        if(n == NULL || n->right_.load() == NULL) {
+            return false;
+        }
+        N* r = n->right_.load();
+        N* s = r;
+        while(s->left_.load() != NULL) {
+            s = s->left_.load();
+        }
+        top = n->item_.first;
+        right = r->item_.first;
+        successor = s->item_.first;
+        return s != r;
+    }
+
+private:
+    typedef ConcurrentAVLNode<Key, Value> N;
+
+    static bool check(N* n, N* parent, int& height, size_t& count)
+    {
+        height = 0;
+        count = 0;
+        if(n == NULL) {
+            return true;
+        }
+        int leftH, rightH;
+        size_t leftC, rightC;
+        N* l = n->left_.load();
+        N* r = n->right_.load();
+        if(n->parent_ != parent || n->version_.load() % 4 != 0 ||
+           !check(l, n, leftH, leftC) || !check(r, n, rightH, rightC)) {
+            return false;
+        }
+        if((l != NULL && !(l->item_.first < n->item_.first)) || (r != NULL && !(n->item_.first < r->item_.first))) {
+            return false;
+        }
+        count = 1 + leftC + rightC;
+        height = 1 + max(leftH, rightH);
+        return n->height_ == height && abs(leftH - rightH) <= 1;
+    }
+};
+
+// Checks that a quiescent LockFreeBST has no marked edges left and that
+// its leaves are in order and match size().
+template<typename Key, typename Value>
+class CheckedLockFreeBST : public LockFreeBST<Key, Value>
+{
+public:
+    bool valid() const
+    {
+        vector<Key> keys;
+        return walk(this->root_, keys) && keys.size() == this->size() &&
+               adjacent_find(keys.begin(), keys.end(), greater_equal<Key>()) == keys.end();
+    }
+
+private:
+    typedef LockFreeNode<Key, Value> N;
+
+    static bool walk(N* n, vector<Key>& keys)
+    {
+        if(n->leaf_) {
+            if(n->inf_ == N::REAL) keys.push_back(n->getKey());
+            return true;
+        }
+        uintptr_t l = n->left_.load();
+        uintptr_t r = n->right_.load();
+        return ((l | r) & (N::FLAG | N::TAG)) == 0 &&
+               walk(reinterpret_cast<N*>(l), keys) && walk(reinterpret_cast<N*>(r), keys);
+    }
+};
+
+// Compares the compile-time selected node search against the scalar one
+// on every prefix of a sorted array and for probes around each key.
+template<typename Key>
+bool nodeSearchAgrees(Key first, Key step)
+{
+    Key keys[nodeSearchSlots<Key>(40)];
+    for(size_t i = 0; i < 40; i++) {
+        keys[i] = (Key)(first + (Key)(i * step));
+    }
+    for(size_t count = 0; count <= 40; count++) {
+        for(size_t i = 0; i < 40; i++) {
+            for(int d = -1; d <= 1; d++) {
+                Key probe = (Key)(keys[i] + d);
+                if(NodeSearch<Key>::lowerBound(keys, count, probe) != ScalarNodeSearch<Key>::lowerBound(keys, count, probe) ||
+                   NodeSearch<Key>::upperBound(keys, count, probe) != ScalarNodeSearch<Key>::upperBound(keys, count, probe)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
 
 int main(int argc, char *argv[])
 {
@@ -26,6 +387,28 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     bt.remove('b');
 
+    // Removing nodes with one child, including a root with one child
+    {
+        BinarySearchTree<int,int> chain;
+        map<int,int> chainRef;
+        for(int i = 0; i < 200; i++) {
+            chain.insert(std::make_pair(i, i));
+            chainRef[i] = i;
+        }
+        srand(4);
+        for(int i = 0; i < 100; i++) {
+            int k = (i % 2 == 0) ? i : rand() % 200;
+            chain.remove(k);
+            chainRef.erase(k);
+        }
+        bool same = true;
+        map<int,int>::iterator refIt = chainRef.begin();
+        for(BinarySearchTree<int,int>::iterator it = chain.begin(); same && it != chain.end(); ++it, ++refIt) {
+            same = refIt != chainRef.end() && it->first == refIt->first;
+        }
+        cout << "BST remove of one-child nodes matches std::map: " << (same && refIt == chainRef.end()) << endl;
+    }
+
     // AVL Tree Tests
     AVLTree<char,int> at;
     at.insert(std::make_pair('a',1));
@@ -44,5 +427,1084 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    // Pooled node allocation tests
+    PoolNodeAllocator pool(4);
+    AVLTree<int,int,std::less<int>,PoolNodeAllocator> pt(pool);
+    BinarySearchTree<int,int,std::less<int>,PoolNodeAllocator> pb(pool);
+    for(int i = 0; i < 10; i++) {
+        pt.insert(std::make_pair(i, i*i));
+        pb.insert(std::make_pair(9-i, i));
+    }
+    cout << "\nPooled AVLTree contents:" << endl;
+    for(AVLTree<int,int,std::less<int>,PoolNodeAllocator>::iterator it = pt.begin(); it != pt.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    cout << "Shared arena slabs: " << pool.arena()->slabCount() << endl;
+    pt.clear();
+    pb.clear();
+    cout << "Cleared, pooled trees empty: " << (pt.empty() && pb.empty()) << endl;
+
+    {
+        AVLTree<int,int,std::less<int>,PoolNodeAllocator> solo((PoolNodeAllocator(4)));
+        for(int i = 0; i < 10; i++) {
+            solo.insert(std::make_pair(i, i));
+        }
+        NodeArena* arena = solo.getAllocator().arena().get();
+        cout << "Private arena slabs before clear: " << arena->slabCount() << endl;
+        solo.clear();
+        cout << "Private arena slabs after clear: " << arena->slabCount() << endl;
+    }
+
+    // AVL balancing and bulk construction
+    CheckedAVLTree<int,int> ascending;
+    for(int i = 0; i < 1000; i++) {
+        ascending.insert(std::make_pair(i, i));
+    }
+    cout << "\nAVLTree valid after 1000 ascending inserts: " << ascending.valid() << endl;
+    CheckedAVLTree<int,int> shuffled;
+    srand(2);
+    for(int i = 0; i < 1000; i++) {
+        shuffled.insert(std::make_pair(rand() % 5000, i));
+    }
+    cout << "AVLTree valid after 1000 random inserts: " << shuffled.valid() << endl;
+    cout << "AVLTree isBalanced: " << shuffled.isBalanced() << endl;
+    CheckedAVLTree<int,int> skewed;
+    for(int i = 0; i < 100; i++) {
+        skewed.insert(std::make_pair(i, i));
+    }
+    bool before = skewed.pathValid(0) && skewed.isBalanced();
+    skewed.skewRoot();
+    cout << "Incremental validator catches a corrupted balance: " << (before && !skewed.pathValid(0)) << endl;
+    cout << "isBalanced catches a corrupted root balance: " << !skewed.isBalanced() << endl;
+
+    // Hot-path counters: exact counts with -DBST_STATS, zeros without
+    {
+        AVLTree<int,int> counted;
+        AVLTree<int,int>::stats();
+        for(int i = 1; i <= 7; i++) {
+            counted.insert(std::make_pair(i, i));    // ends up perfect, rooted at 4
+        }
+        TreeStats built = AVLTree<int,int>::stats();
+        counted.find(1);
+        TreeStats found = AVLTree<int,int>::stats();
+#ifdef BST_STATS
+        bool counts = built.rotations == 4 && found.nodeVisits == 3 && found.comparisons == 4 && found.rotations == 0;
+#else
+        bool counts = built.rotations == 0 && found.nodeVisits == 0 && found.comparisons == 0;
+#endif
+        cout << "Tree stats count rotations and find steps: " << counts << endl;
+    }
+    {
+        BinarySearchTree<int,int> shallow;
+        int keys[] = { 8, 4, 12, 2, 14, 1, 15 }; //both sides of the root are chains of three
+        for(int i = 0; i < 7; i++) {
+            shallow.insert(std::make_pair(keys[i], i));
+        }
+        BinarySearchTree<int,int> even;
+        int evenKeys[] = { 4, 2, 6, 1, 3, 5, 7 };
+        for(int i = 0; i < 7; i++) {
+            even.insert(std::make_pair(evenKeys[i], i));
+        }
+        SpineBST spine;
+        spine.buildSpine(1000000);
+        cout << "BST isBalanced sees imbalance below the root: "
+             << (!shallow.isBalanced() && even.isBalanced() && !spine.isBalanced()) << endl;
+    }
+
+    vector<pair<int,int> > sorted;
+    for(int i = 0; i < 1000; i++) {
+        sorted.push_back(make_pair(2*i, i));
+    }
+    CheckedAVLTree<int,int> bulk;
+    bulk.assignSorted(sorted.begin(), sorted.end());
+    bool bulkContents = true;
+    vector<pair<int,int> >::iterator expected = sorted.begin();
+    for(AVLTree<int,int>::iterator it = bulk.begin(); it != bulk.end(); ++it, ++expected) {
+        bulkContents = bulkContents && expected != sorted.end() && it->first == expected->first && it->second == expected->second;
+    }
+    cout << "assignSorted contents correct: " << (bulkContents && expected == sorted.end())
+         << ", valid: " << bulk.valid() << endl;
+    for(int i = 0; i < 1000; i++) {
+        bulk.insert(std::make_pair(2*i + 1, -i));
+    }
+    cout << "Valid after inserting between bulk keys: " << bulk.valid() << endl;
+
+    vector<pair<int,int> > unsorted;
+    for(int i = 0; i < 500; i++) {
+        unsorted.push_back(make_pair((i * 37) % 100, i));
+    }
+    CheckedAVLTree<int,int> fromUnsorted;
+    fromUnsorted.assign(unsorted.begin(), unsorted.end());
+    bool lastWins = fromUnsorted.valid();
+    for(int k = 0; k < 100; k++) {
+        int last = -1;
+        for(int i = 0; i < 500; i++) {
+            if((i * 37) % 100 == k) last = i;
+        }
+        lastWins = lastWins && fromUnsorted[k] == last;
+    }
+    cout << "assign from unsorted range keeps the last duplicate: " << lastWins << endl;
+
+    // Batched inserts, small batches (finger descents) and large ones (merge)
+    CheckedAVLTree<int,int> batched;
+    BinarySearchTree<int,int> batchedBst;
+    map<int,int> batchRef;
+    srand(3);
+    for(int round = 0; round < 20; round++) {
+        vector<pair<int,int> > batch;
+        int batchSize = round % 4 == 0 ? 400 : 10;
+        for(int i = 0; i < batchSize; i++) {
+            batch.push_back(make_pair(rand() % 2000, round * 1000 + i));
+        }
+        batched.insertBatch(batch.begin(), batch.end());
+        batchedBst.insertBatch(batch.begin(), batch.end());
+        for(size_t i = 0; i < batch.size(); i++) {
+            batchRef[batch[i].first] = batch[i].second;
+        }
+    }
+    bool batchSame = batched.valid();
+    map<int,int>::iterator batchIt = batchRef.begin();
+    BinarySearchTree<int,int>::iterator bstIt = batchedBst.begin();
+    for(AVLTree<int,int>::iterator it = batched.begin(); batchSame && it != batched.end(); ++it, ++batchIt, ++bstIt) {
+        batchSame = batchIt != batchRef.end() && bstIt != batchedBst.end() &&
+                    it->first == batchIt->first && it->second == batchIt->second &&
+                    bstIt->first == batchIt->first && bstIt->second == batchIt->second;
+    }
+    cout << "insertBatch matches std::map and stays valid: " << (batchSame && batchIt == batchRef.end()) << endl;
+
+    // In-place and move-aware inserts
+    {
+        AVLTree<string, Tracked> moveTree;
+        for(int i = 0; i < 100; i++) {
+            moveTree.insert(make_pair(to_string(i) + " a key long enough to live on the heap", Tracked(i)));
+        }
+        string longKey = "yet another key long enough to live on the heap";
+        Tracked::copies = 0;
+        size_t before = allocations;
+        moveTree.insert(make_pair(std::move(longKey), Tracked(1)));
+        cout << "\nrvalue insert copies nothing: " << (Tracked::copies == 0)
+             << ", allocates only the node: " << (allocations - before == 1) << endl;
+
+        before = allocations;
+        bool added = moveTree.emplace(piecewise_construct, forward_as_tuple("emplaced key long enough to live on the heap"),
+                                      forward_as_tuple(2)).second;
+        cout << "emplace constructs in place: " << (added && Tracked::copies == 0 && allocations - before == 2) << endl;
+
+        Tracked::moves = 0;
+        before = allocations;
+        bool again = moveTree.try_emplace(string("emplaced key long enough to live on the heap"), 3).second;
+        cout << "try_emplace on an existing key builds nothing: "
+             << (!again && Tracked::copies == 0 && Tracked::moves == 0 && allocations - before == 1) << endl;
+
+        pair<const string, Tracked> item("copied key long enough to live on the heap", Tracked(4));
+        Tracked::copies = 0;
+        moveTree.insert(item);
+        cout << "insert(const&) copies the value once: " << (Tracked::copies == 1) << endl;
+
+        BinarySearchTree<string, Tracked> bstMove;
+        bstMove.insert(make_pair(string("k"), Tracked(5)));
+        Tracked::copies = 0;
+        bstMove.insert(make_pair(string("k"), Tracked(6)));
+        bool overwritten = bstMove.find("k")->second.id == 6 && Tracked::copies == 0;
+        cout << "BST rvalue insert overwrites without copying: " << overwritten << endl;
+    }
+
+    // Comparators
+    {
+        AVLTree<int, int, greater<int> > descending;
+        for(int i = 0; i < 100; i++) {
+            descending.insert(make_pair(i, i));
+        }
+        int expect = 99;
+        bool ordered = true;
+        for(AVLTree<int, int, greater<int> >::iterator it = descending.begin(); it != descending.end(); ++it) {
+            ordered = ordered && it->first == expect--;
+        }
+        cout << "\nstd::greater orders the tree downwards: " << (ordered && expect == -1) << endl;
+
+        // 1023 keys build a perfect tree of height 10, so a lookup may
+        // compare at most once per level plus the final equality check.
+        vector<pair<int, int> > perfect;
+        for(int i = 0; i < 1023; i++) {
+            perfect.push_back(make_pair(2 * i, i));
+        }
+        AVLTree<int, int, CountingLess> counted;
+        counted.assignSorted(perfect.begin(), perfect.end());
+        long worst = 0;
+        bool allFound = true;
+        for(int probe = -1; probe <= 2046; probe++) {
+            CountingLess::calls = 0;
+            bool hit = counted.find(probe) != counted.end();
+            allFound = allFound && hit == (probe >= 0 && probe < 2046 && probe % 2 == 0);
+            worst = max(worst, CountingLess::calls);
+        }
+        cout << "find compares once per level: " << (allFound && worst == 11) << endl;
+
+        // The validator build re-checks key order after the insert, with
+        // comparisons of its own.
+#ifndef AVL_VALIDATE
+        CountingLess::calls = 0;
+        counted.insert(make_pair(1023, 0));
+        cout << "insert compares once per level: " << (CountingLess::calls == 11) << endl;
+#endif
+
+        AVLTree<string, int, less<> > names;
+        for(int i = 0; i < 50; i++) {
+            names.insert(make_pair("name number " + to_string(i) + " is long enough for the heap", i));
+        }
+        size_t before = allocations;
+        bool viaPointer = names.find("name number 7 is long enough for the heap")->second == 7;
+        bool viaView = names.find(string_view("name number 42 is long enough for the heap"))->second == 42;
+        bool missing = names.find("no such name, but just as long as the others") == names.end();
+        cout << "transparent find builds no temporary keys: "
+             << (viaPointer && viaView && missing && allocations == before) << endl;
+    }
+
+    // Reverse iteration and ordered lookups, checked against std::map
+    {
+        bool reverseSame = true;
+        map<int,int>::reverse_iterator refBack = batchRef.rbegin();
+        for(AVLTree<int,int>::reverse_iterator it = batched.rbegin(); it != batched.rend(); ++it, ++refBack) {
+            reverseSame = reverseSame && refBack != batchRef.rend() && it->first == refBack->first;
+        }
+        AVLTree<int,int>::iterator last = batched.end();
+        --last;
+        reverseSame = reverseSame && refBack == batchRef.rend() && last->first == batchRef.rbegin()->first;
+        cout << "\nreverse iteration matches std::map: " << reverseSame << endl;
+
+        bool boundsSame = true;
+        for(int probe = -5; probe <= 2005; probe++) {
+            map<int,int>::iterator refLo = batchRef.lower_bound(probe);
+            map<int,int>::iterator refHi = batchRef.upper_bound(probe);
+            AVLTree<int,int>::iterator lo = batched.lower_bound(probe);
+            AVLTree<int,int>::iterator hi = batched.upper_bound(probe);
+            boundsSame = boundsSame &&
+                (refLo == batchRef.end() ? lo == batched.end() : lo != batched.end() && lo->first == refLo->first) &&
+                (refHi == batchRef.end() ? hi == batched.end() : hi != batched.end() && hi->first == refHi->first) &&
+                (batched.equal_range(probe).first == lo) && (batched.equal_range(probe).second == hi);
+        }
+        cout << "lower_bound/upper_bound/equal_range match std::map: " << boundsSame << endl;
+
+        int inRange = 0;
+        bool rangeSame = true;
+        map<int,int>::iterator refIt = batchRef.lower_bound(500);
+        for(pair<const int,int>& item : batched.range(500, 900)) {
+            rangeSame = rangeSame && item.first == refIt->first;
+            ++refIt;
+            inRange++;
+        }
+        rangeSame = rangeSame && refIt == batchRef.lower_bound(900) && batched.range(900, 500).empty();
+        cout << "range(500, 900) matches std::map (" << inRange << " items): " << rangeSame << endl;
+
+        // Finding both ends of a window costs two descents, no matter how
+        // large the tree is or where the window sits.
+        vector<pair<int,int> > perfect;
+        for(int i = 0; i < 1023; i++) {
+            perfect.push_back(make_pair(i, i));
+        }
+        AVLTree<int, int, CountingLess> counted;
+        counted.assignSorted(perfect.begin(), perfect.end());
+        CountingLess::calls = 0;
+        int windowSum = 0;
+        for(pair<const int,int>& item : counted.range(1000, 1010)) {
+            windowSum += item.first;
+        }
+        cout << "range() compares only to find its ends: " << (windowSum == 10045 && CountingLess::calls <= 21) << endl;
+    }
+
+    // Removal and order statistics, checked against std::map
+    {
+        CheckedAVLTree<int,int> ranked;
+        map<int,int> rankRef;
+        srand(9);
+        bool removeValid = true;
+        for(int round = 0; round < 40; round++) {
+            for(int i = 0; i < 100; i++) {
+                int k = rand() % 1000;
+                if(round % 3 == 2 || rand() % 2 == 0) {
+                    ranked.remove(k);
+                    rankRef.erase(k);
+                }
+                else {
+                    ranked.insert(make_pair(k, i));
+                    rankRef[k] = i;
+                }
+            }
+            removeValid = removeValid && ranked.valid() && ranked.size() == rankRef.size();
+        }
+        map<int,int>::iterator refIt = rankRef.begin();
+        for(AVLTree<int,int>::iterator it = ranked.begin(); removeValid && it != ranked.end(); ++it, ++refIt) {
+            removeValid = refIt != rankRef.end() && it->first == refIt->first && it->second == refIt->second;
+        }
+        cout << "\nAVL remove matches std::map and stays valid: " << (removeValid && refIt == rankRef.end()) << endl;
+
+        bool selectSame = ranked.select(rankRef.size()) == ranked.end();
+        size_t k = 0;
+        for(refIt = rankRef.begin(); refIt != rankRef.end(); ++refIt, ++k) {
+            selectSame = selectSame && ranked.select(k)->first == refIt->first && ranked.rank(refIt->first) == k;
+        }
+        bool countSame = true;
+        for(int lo = -10; lo < 1010; lo += 7) {
+            int hi = lo + rand() % 300;
+            size_t expect = distance(rankRef.lower_bound(lo), rankRef.upper_bound(hi));
+            countSame = countSame && ranked.countRange(lo, hi) == expect &&
+                        ranked.rank(lo) == (size_t)distance(rankRef.begin(), rankRef.lower_bound(lo));
+        }
+        cout << "select/rank/countRange match std::map: " << (selectSame && countSame && ranked.countRange(5, 4) == 0) << endl;
+
+        for(int i = 0; i < 1000; i++) {
+            ranked.remove(i);
+        }
+        cout << "empty after removing every key: " << (ranked.empty() && ranked.size() == 0) << endl;
+    }
+
+    // Teardown: iterative clear, parallel clear and arena release
+    {
+        // A plain BST fed sorted keys is one long spine, far deeper than a
+        // recursive clear could follow.
+        SpineBST deep;
+        deep.buildSpine(1000000);
+        size_t before = deallocations;
+        deep.clear();
+        cout << "\nDegenerate tree of a million nodes clears without recursion: "
+             << (deep.empty() && deallocations - before == 1000000) << endl;
+
+        vector<pair<int,int> > spine;
+        for(int i = 0; i < 200000; i++) {
+            spine.push_back(make_pair(i, i));
+        }
+
+        ThreadPool workers(4);
+        AVLTree<int,int> wide;
+        wide.assignSorted(spine.begin(), spine.begin() + 200000);
+        before = deallocations;
+        wide.clear(&workers);
+        bool freedAll = wide.empty() && deallocations - before == 200000;
+        wide.insert(make_pair(1, 1));
+        cout << "clear on a pool frees every node: " << (freedAll && wide.size() == 1) << endl;
+
+        AVLTree<int,int,std::less<int>,PoolNodeAllocator> pooled((PoolNodeAllocator(64)));
+        pooled.assignSorted(spine.begin(), spine.begin() + 10000);
+        pooled.clear(&workers);
+        cout << "clear on a pool releases a private arena wholesale: "
+             << (pooled.empty() && pooled.getAllocator().arena()->slabCount() == 0) << endl;
+    }
+
+    // Split, join and extract
+    {
+        srand(13);
+        bool splitValid = true;
+        bool noCopies = true;
+        for(int round = 0; round < 30; round++) {
+            int n = rand() % 600;
+            vector<pair<int,int> > items;
+            for(int i = 0; i < n; i++) {
+                items.push_back(make_pair(i * 3, i));
+            }
+            shuffle(items.begin(), items.end(), mt19937(round)); //random insert order gives uneven shapes
+            CheckedAVLTree<int,int> whole;
+            for(size_t i = 0; i < items.size(); i++) {
+                whole.insert(items[i]);
+            }
+            int cut = rand() % (3 * n + 3) - 1;
+            size_t before = allocations;
+            pair<AVLTree<int,int>, AVLTree<int,int> > halves = whole.split(cut);
+            CheckedAVLTree<int,int> less(std::move(halves.first));
+            CheckedAVLTree<int,int> greater(std::move(halves.second));
+            splitValid = splitValid && whole.empty() && less.valid() && greater.valid() &&
+                         less.size() == (size_t)max(0, min(n, (cut + 2) / 3)) && less.size() + greater.size() == (size_t)n &&
+                         (less.empty() || (--less.end())->first < cut) && (greater.empty() || greater.begin()->first >= cut);
+            less.join(greater);
+            splitValid = splitValid && less.valid() && greater.empty() && less.size() == (size_t)n;
+
+            int lo = rand() % (3 * n + 3);
+            int hi = lo + rand() % 200;
+            AVLTree<int,int> slice = less.extract(lo, hi);
+            noCopies = noCopies && allocations == before;
+            size_t inSlice = 0;
+            for(AVLTree<int,int>::iterator it = slice.begin(); it != slice.end(); ++it, ++inSlice) {
+                splitValid = splitValid && it->first >= lo && it->first < hi;
+            }
+            splitValid = splitValid && less.valid() && inSlice == slice.size() &&
+                         less.size() + inSlice == (size_t)n && less.countRange(lo, hi - 1) == 0;
+        }
+        cout << "\nsplit/join/extract keep order, sizes and balance: " << splitValid << endl;
+        cout << "split/join/extract relink without allocating: " << noCopies << endl;
+
+        CheckedAVLTree<int,int> low;
+        CheckedAVLTree<int,int> high;
+        for(int i = 0; i < 1000; i++) {
+            low.insert(make_pair(i, i));
+        }
+        for(int i = 1001; i < 1010; i++) {
+            high.insert(make_pair(i, i));
+        }
+        low.join(make_pair(1000, 1000), high);
+        bool joined = low.valid() && low.size() == 1010 && high.empty() && low.rank(1000) == 1000;
+        bool threw = false;
+        try {
+            high.insert(make_pair(5, 5));
+            low.join(high);
+        }
+        catch(invalid_argument&) {
+            threw = true;
+        }
+        cout << "join with a pivot: " << joined << ", overlapping join throws: " << (threw && high.size() == 1) << endl;
+
+        PoolNodeAllocator shared;
+        CheckedAVLTree<int,int,PoolNodeAllocator> pooled(shared);
+        CheckedAVLTree<int,int,PoolNodeAllocator> other((PoolNodeAllocator()));
+        for(int i = 0; i < 100; i++) {
+            pooled.insert(make_pair(i, i));
+            other.insert(make_pair(100 + i, i));
+        }
+        pooled.join(other);
+        cout << "join across different arenas copies: " << (pooled.valid() && pooled.size() == 200 && other.empty()) << endl;
+    }
+
+    // Union, intersection and difference, sequential and on a pool
+    {
+        ThreadPool workers(4);
+        bool opsSame = true;
+        for(int round = 0; round < 60; round++) {
+            ThreadPool* pool = round % 2 ? &workers : NULL;
+            int span = round < 40 ? 400 : 40000; //the large rounds go past the parallel cutoff
+            map<int,int> refA, refB;
+            CheckedAVLTree<int,int> a, b;
+            int countA = rand() % span;
+            int countB = rand() % span;
+            for(int i = 0; i < countA; i++) {
+                int k = rand() % (2 * span);
+                refA[k] = k;
+                a.insert(make_pair(k, k));
+            }
+            for(int i = 0; i < countB; i++) {
+                int k = rand() % (2 * span);
+                refB[k] = -k;
+                b.insert(make_pair(k, -k));
+            }
+            map<int,int> expect;
+            int op = round % 3;
+            if (op == 0) {
+                expect = refB;
+                expect.insert(refA.begin(), refA.end()); //keeps b's value on common keys
+                a.unionWith(b, pool);
+            }
+            else if (op == 1) {
+                for(map<int,int>::iterator it = refA.begin(); it != refA.end(); ++it) {
+                    if (refB.count(it->first)) expect.insert(*it);
+                }
+                a.intersectWith(b, pool);
+            }
+            else {
+                for(map<int,int>::iterator it = refA.begin(); it != refA.end(); ++it) {
+                    if (!refB.count(it->first)) expect.insert(*it);
+                }
+                a.differenceWith(b, pool);
+            }
+            opsSame = opsSame && a.valid() && b.empty() && a.size() == expect.size() &&
+                      equal(a.begin(), a.end(), expect.begin());
+        }
+        cout << "\nunion/intersection/difference match std::map: " << opsSame << endl;
+
+        PoolNodeAllocator arenaA;
+        PoolNodeAllocator arenaB;
+        CheckedAVLTree<int,int,PoolNodeAllocator> pa(arenaA);
+        CheckedAVLTree<int,int,PoolNodeAllocator> pb(arenaB);
+        for(int i = 0; i < 100; i++) {
+            pa.insert(make_pair(i, i));
+            pb.insert(make_pair(50 + i, i));
+        }
+        pa.unionWith(pb, &workers);
+        cout << "union across different arenas copies: " << (pa.valid() && pa.size() == 150 && pb.empty()) << endl;
+    }
+
+    // Epoch-based reclamation
+    {
+        EpochDomain domain;
+        atomic<int> freed(0);
+        EpochDomain::Deleter count = [](void* object, void* context) {
+            (*static_cast<atomic<int>*>(context))++;
+            delete static_cast<int*>(object);
+        };
+        atomic<int> phase(0);
+        thread reader([&] {
+            EpochDomain::Guard guard(domain);
+            phase = 1;
+            while(phase.load() != 2) {
+                this_thread::yield();
+            }
+        });
+        while(phase.load() != 1) {
+            this_thread::yield();
+        }
+        for(int i = 0; i < 500; i++) {
+            domain.retire(new int(i), count, &freed);
+        }
+        domain.collect();
+        domain.collect();
+        bool held = freed == 0 && domain.pendingCount() == 500;
+        phase = 2;
+        reader.join();
+        domain.collect();
+        domain.collect();
+        cout << "\nRetired objects wait for readers that entered before them: "
+             << (held && freed == 500 && domain.pendingCount() == 0) << endl;
+
+        for(int i = 0; i < 500; i++) {
+            EpochDomain::Guard guard(domain);
+            domain.retire(new int(i), count, &freed);
+        }
+        cout << "Retiring without readers frees in batches: " << (domain.pendingCount() < 3 * EpochDomain::BATCH) << endl;
+        domain.drain();
+        cout << "drain frees the rest: " << (freed == 1000 && domain.pendingCount() == 0) << endl;
+    }
+
+    // Concurrent AVL tree
+    {
+        CheckedConcurrentAVLTree<int,int> ctree;
+        map<int,int> cref;
+        bool seqSame = true;
+        for(int i = 0; i < 20000; i++) {
+            int k = rand() % 3000;
+            if (rand() % 3 == 0) {
+                ctree.remove(k);
+                cref.erase(k);
+            }
+            else {
+                ctree.insert(make_pair(k, i));
+                cref[k] = i;
+            }
+        }
+        for(int k = 0; k < 3000; k++) {
+            int v;
+            bool found = ctree.find(k, v);
+            seqSame = seqSame && found == (cref.count(k) == 1) && (!found || v == cref[k]);
+        }
+        cout << "\nConcurrentAVLTree matches std::map and stays valid: " << (seqSame && ctree.valid() && ctree.size() == cref.size()) << endl;
+
+        // A reader stops at the right child of the root, on its way down
+        // to the root's successor, while the root is removed. The
+        // successor moves up above the reader, which has to notice and
+        // start over rather than report the key missing.
+        {
+            PausingLess::Point point;
+            CheckedConcurrentAVLTree<int,int,PausingLess> paused((PausingLess(&point)));
+            for(int k = 0; k < 1023; k++) {
+                paused.insert(make_pair(k, k));
+            }
+            int top = 0, right = 0, successor = 0;
+            bool deep = paused.successorPath(top, right, successor);
+            point.key = right;
+            point.reached = false;
+            point.resume = false;
+            bool found = false;
+            thread reader([&] {
+                PausingLess::armed = true;
+                int v;
+                found = paused.find(successor, v);
+            });
+            while(!point.reached) {
+                this_thread::yield();
+            }
+            paused.remove(top);
+            point.resume = true;
+            reader.join();
+            cout << "A paused reader still finds the successor that moved above it: "
+                 << (deep && found && paused.valid()) << endl;
+        }
+
+        // Writers on disjoint keys run at the same time; each inserts its
+        // keys and then removes every third one.
+        {
+            CheckedConcurrentAVLTree<int,int> writers;
+            vector<thread> threads;
+            for(int t = 0; t < 4; t++) {
+                threads.push_back(thread([&writers, t] {
+                    for(int k = t; k < 8000; k += 4) {
+                        writers.insert(make_pair(k, k));
+                    }
+                    for(int k = t; k < 8000; k += 12) {
+                        writers.remove(k);
+                    }
+                }));
+            }
+            for(size_t t = 0; t < threads.size(); t++) {
+                threads[t].join();
+            }
+            bool right = true;
+            size_t kept = 0;
+            for(int k = 0; k < 8000; k++) {
+                kept += k % 12 >= 4;
+                right = right && writers.contains(k) == (k % 12 >= 4);
+            }
+            cout << "Concurrent writers leave exactly their keys and a valid tree: "
+                 << (right && writers.size() == kept && writers.valid()) << endl;
+        }
+
+        // Even keys stay in the tree for the whole run while writers churn
+        // the odd ones, rotating the tree under the readers. A value is
+        // always its key times ten.
+        CheckedConcurrentAVLTree<int,int> shared;
+        for(int k = 0; k < 4000; k += 2) {
+            shared.insert(make_pair(k, 10 * k));
+        }
+        atomic<bool> stop(false);
+        atomic<long> misses(0);
+        atomic<long> badValues(0);
+        vector<thread> threads;
+        for(int t = 0; t < 2; t++) {
+            threads.push_back(thread([&shared, t] {
+                mt19937 gen(t);
+                for(int i = 0; i < 100000; i++) {
+                    int k = (int)(gen() % 2000) * 2 + 1;
+                    if (gen() % 2) {
+                        shared.insert(make_pair(k, 10 * k));
+                    }
+                    else {
+                        shared.remove(k);
+                    }
+                    if (i % 1000 == 0) {
+                        shared.insert(make_pair(k - 1, 10 * (k - 1))); //replaces a stable node
+                    }
+                }
+            }));
+        }
+        for(int t = 0; t < 3; t++) {
+            threads.push_back(thread([&, t] {
+                mt19937 gen(100 + t);
+                while(!stop.load()) {
+                    int k = (int)(gen() % 4000);
+                    int v = -1;
+                    bool found = shared.find(k, v);
+                    if (k % 2 == 0 && !found) misses++;
+                    if (found && v != 10 * k) badValues++;
+                }
+            }));
+        }
+        threads[0].join();
+        threads[1].join();
+        stop = true;
+        for(size_t t = 2; t < threads.size(); t++) {
+            threads[t].join();
+        }
+        cout << "Concurrent readers never miss a key or see a wrong value: "
+             << (misses == 0 && badValues == 0 && shared.valid()) << endl;
+        // With every other thread gone, each collect (one per BATCH
+        // retirements) moves the epoch on, so no more than the last two
+        // epochs' retirements can be pending.
+        for(size_t i = 0; i < 8 * EpochDomain::BATCH; i++) {
+            shared.insert(make_pair(-1, 0));
+            shared.remove(-1);
+        }
+        bool bounded = shared.retiredCount() <= 2 * EpochDomain::BATCH;
+        shared.reclaim();
+        cout << "Unlinked nodes pending stay within two epochs: " << (bounded && shared.retiredCount() == 0) << endl;
+    }
+
+    // Lock-free BST
+    {
+        CheckedLockFreeBST<int,int> lf;
+        map<int,int> lref;
+        bool lfSame = true;
+        for(int i = 0; i < 20000; i++) {
+            int k = rand() % 3000;
+            if (rand() % 3 == 0) {
+                lf.remove(k);
+                lref.erase(k);
+            }
+            else {
+                lf.insert(make_pair(k, i));
+                lref[k] = i;
+            }
+        }
+        for(int k = 0; k < 3000; k++) {
+            int v;
+            bool found = lf.find(k, v);
+            lfSame = lfSame && found == (lref.count(k) == 1) && (!found || v == lref[k]);
+        }
+        cout << "\nLockFreeBST matches std::map: " << (lfSame && lf.valid()) << endl;
+
+        // Descending inserts build a left spine as deep as the tree. It is
+        // destroyed on a thread with a 256 KB stack, which a recursive
+        // teardown of 20000 levels would overflow.
+        LockFreeBST<int,int>* spine = new LockFreeBST<int,int>();
+        for(int k = 20000; k > 0; k--) {
+            spine->insert(make_pair(k, k));
+        }
+        size_t before = deallocations;
+        pthread_attr_t small;
+        pthread_attr_init(&small);
+        pthread_attr_setstacksize(&small, 256 * 1024);
+        pthread_t teardown;
+        pthread_create(&teardown, &small, [](void* tree) -> void* {
+            delete static_cast<LockFreeBST<int,int>*>(tree);
+            return NULL;
+        }, spine);
+        pthread_join(teardown, NULL);
+        pthread_attr_destroy(&small);
+        cout << "Deep LockFreeBST is destroyed without recursion: " << (deallocations - before >= 40000) << endl;
+
+        // Writers fight over a small range of odd keys; every even key stays
+        // in the tree, and every value is its key times ten.
+        CheckedLockFreeBST<int,int> contended;
+        for(int k = 0; k < 512; k += 2) {
+            contended.insert(make_pair(k, 10 * k));
+        }
+        atomic<int> writersLeft(4);
+        atomic<long> misses(0);
+        atomic<long> badValues(0);
+        vector<thread> threads;
+        for(int t = 0; t < 4; t++) {
+            threads.push_back(thread([&, t] {
+                mt19937 gen(t);
+                for(int i = 0; i < 100000; i++) {
+                    int k = (int)(gen() % 256) * 2 + 1;
+                    if (gen() % 2) {
+                        contended.insert(make_pair(k, 10 * k));
+                    }
+                    else {
+                        contended.remove(k);
+                    }
+                    if (i % 100 == 0) {
+                        contended.insert(make_pair(k - 1, 10 * (k - 1))); //replaces a stable leaf
+                    }
+                }
+                writersLeft--;
+            }));
+        }
+        for(int t = 0; t < 2; t++) {
+            threads.push_back(thread([&, t] {
+                mt19937 gen(100 + t);
+                while(writersLeft.load() > 0) {
+                    int k = (int)(gen() % 512);
+                    int v = -1;
+                    bool found = contended.find(k, v);
+                    if (k % 2 == 0 && !found) misses++;
+                    if (found && v != 10 * k) badValues++;
+                }
+            }));
+        }
+        for(size_t t = 0; t < threads.size(); t++) {
+            threads[t].join();
+        }
+        size_t stable = 0;
+        for(int k = 0; k < 512; k += 2) {
+            stable += contended.contains(k);
+        }
+        cout << "LockFreeBST under contention stays consistent: "
+             << (misses == 0 && badValues == 0 && stable == 256 && contended.valid()) << endl;
+        for(size_t i = 0; i < 8 * EpochDomain::BATCH; i++) {
+            contended.insert(make_pair(-1, 0));
+            contended.remove(-1);
+        }
+        bool bounded = contended.retiredCount() <= 2 * EpochDomain::BATCH;
+        contended.reclaim();
+        cout << "Unlinked nodes pending stay within two epochs: " << (bounded && contended.retiredCount() == 0) << endl;
+    }
+
+    // Flat combining
+    {
+        // Each thread owns the keys equal to its number mod 4, so its own
+        // std::map predicts every lookup it makes.
+        FlatCombiningAVLTree<int,int> combined;
+        vector<map<int,int> > owned(4);
+        atomic<long> wrong(0);
+        vector<thread> threads;
+        for(int t = 0; t < 4; t++) {
+            threads.push_back(thread([&, t] {
+                mt19937 gen(t);
+                map<int,int>& mine = owned[t];
+                for(int i = 0; i < 20000; i++) {
+                    int k = (int)(gen() % 1000) * 4 + t;
+                    unsigned op = gen() % 3;
+                    if (op == 0) {
+                        combined.insert(make_pair(k, i));
+                        mine[k] = i;
+                    }
+                    else if (op == 1) {
+                        combined.remove(k);
+                        mine.erase(k);
+                    }
+                    else {
+                        int v = -1;
+                        bool found = combined.find(k, v);
+                        if (found != (mine.count(k) == 1) || (found && v != mine[k])) wrong++;
+                    }
+                }
+            }));
+        }
+        for(size_t t = 0; t < threads.size(); t++) {
+            threads[t].join();
+        }
+        size_t expected = 0;
+        bool same = true;
+        for(int t = 0; t < 4; t++) {
+            expected += owned[t].size();
+            for(map<int,int>::iterator it = owned[t].begin(); it != owned[t].end(); ++it) {
+                int v = -1;
+                same = same && combined.find(it->first, v) && v == it->second;
+            }
+        }
+        cout << "\nFlatCombiningAVLTree matches per-thread std::maps: "
+             << (wrong == 0 && same && combined.size() == expected) << endl;
+        cout << "Every operation went through a batch: "
+             << (combined.combinedCount() == 80000 + expected && combined.batchCount() <= combined.combinedCount()) << endl;
+    }
+
+    // Latency histograms
+    {
+        LatencyHistogram hist;
+        for(uint64_t v = 1; v <= 100000; v++) {
+            hist.record(v);
+        }
+        bool accurate = hist.count() == 100000 && hist.max() == 100000 && hist.percentile(100) == 100000;
+        double percents[] = { 1, 50, 90, 99, 99.9 };
+        for(int i = 0; i < 5; i++) {
+            double exact = percents[i] * 1000;
+            uint64_t got = hist.percentile(percents[i]);
+            accurate = accurate && got >= exact && got <= exact * (1 + 1.0 / LatencyHistogram::SUB_BUCKETS);
+        }
+        bool exactSmall = true;
+        for(uint64_t v = 0; v < 2 * LatencyHistogram::SUB_BUCKETS; v++) {
+            exactSmall = exactSmall && LatencyHistogram::bucketTop(LatencyHistogram::bucketOf(v)) == v;
+        }
+        cout << "\nLatencyHistogram percentiles within one sub-bucket: " << (accurate && exactSmall) << endl;
+
+        // Four threads time their own keys of one ConcurrentAVLTree; the
+        // per-thread recorders must add up to every call.
+        TimedTree<ConcurrentAVLTree<int,int> > timed;
+        vector<thread> threads;
+        for(int t = 0; t < 4; t++) {
+            threads.push_back(thread([&, t] {
+                for(int i = 0; i < 5000; i++) {
+                    timed.insert(make_pair(i * 4 + t, i));
+                }
+                for(int i = 0; i < 5000; i++) {
+                    int v = -1;
+                    timed.find(i * 4 + t, v);
+                }
+                for(int i = 0; i < 5000; i += 2) {
+                    timed.remove(i * 4 + t);
+                }
+            }));
+        }
+        for(size_t t = 0; t < threads.size(); t++) {
+            threads[t].join();
+        }
+        LatencySummary inserts = timed.latency(TimedTree<ConcurrentAVLTree<int,int> >::INSERT);
+        LatencySummary finds = timed.latency(TimedTree<ConcurrentAVLTree<int,int> >::FIND);
+        LatencySummary removes = timed.latency(TimedTree<ConcurrentAVLTree<int,int> >::REMOVE);
+        bool counted = inserts.count == 20000 && finds.count == 20000 && removes.count == 10000 &&
+                       timed.tree().size() == 10000;
+        bool ordered = inserts.p50 <= inserts.p99 && inserts.p99 <= inserts.p999 && inserts.p999 <= inserts.max;
+        cout << "TimedTree counts every call from every thread: " << (counted && ordered) << endl;
+        timed.resetLatency();
+        cout << "TimedTree latency reset: " << (timed.latency(TimedTree<ConcurrentAVLTree<int,int> >::FIND).count == 0) << endl;
+    }
+
+    // Sharded map, hash and range partitioned
+    {
+        ShardedAVLMap<int,int,8> hashed;
+        vector<int> bounds;
+        for(int i = 1; i < 8; i++) {
+            bounds.push_back(i * 500);
+        }
+        ShardedAVLMap<int,int,8> ranged(bounds);
+        map<int,int> sref;
+        for(int i = 0; i < 10000; i++) {
+            int k = rand() % 4000;
+            if (rand() % 4 == 0) {
+                hashed.remove(k);
+                ranged.remove(k);
+                sref.erase(k);
+            }
+            else {
+                hashed.insert(make_pair(k, i));
+                ranged.insert(make_pair(k, i));
+                sref[k] = i;
+            }
+        }
+        bool shardedSame = hashed.size() == sref.size() && ranged.size() == sref.size();
+        for(int k = 0; k < 4000; k++) {
+            int v1 = -1, v2 = -1;
+            bool f1 = hashed.find(k, v1);
+            bool f2 = ranged.find(k, v2);
+            bool present = sref.count(k) == 1;
+            shardedSame = shardedSame && f1 == present && f2 == present && (!present || (v1 == sref[k] && v2 == sref[k]));
+        }
+        bool spread = true;
+        for(size_t i = 0; i < 8; i++) {
+            spread = spread && hashed.shardSize(i) > sref.size() / 16 && ranged.shardSize(i) > 0;
+        }
+        {
+            ShardedAVLMap<int,int,8>::OrderedView hashView = hashed.ordered();
+            ShardedAVLMap<int,int,8>::OrderedView rangeView = ranged.ordered();
+            shardedSame = shardedSame && equal(hashView.begin(), hashView.end(), sref.begin(), sref.end()) &&
+                          equal(rangeView.begin(), rangeView.end(), sref.begin(), sref.end());
+        }
+        bool threw = false;
+        try {
+            hashed[-1];
+        }
+        catch(out_of_range&) {
+            threw = true;
+        }
+        cout << "\nShardedAVLMap matches std::map in both modes: " << (shardedSame && spread) << endl;
+        cout << "ordered() merges shards in key order, operator[] throws on a missing key: "
+             << (threw && hashed[sref.begin()->first] == sref.begin()->second) << endl;
+
+        ShardedAVLMap<int,int,4> parallelMap;
+        vector<thread> threads;
+        for(int t = 0; t < 4; t++) {
+            threads.push_back(thread([&parallelMap, t] {
+                for(int k = t; k < 20000; k += 4) {
+                    parallelMap.insert(make_pair(k, k));
+                }
+                for(int k = t; k < 20000; k += 8) {
+                    parallelMap.remove(k);
+                }
+            }));
+        }
+        for(size_t t = 0; t < threads.size(); t++) {
+            threads[t].join();
+        }
+        cout << "ShardedAVLMap takes concurrent writers: " << (parallelMap.size() == 10000) << endl;
+    }
+
+    // Persistent AVL tree and snapshots
+    {
+        PersistentAVLTree<int,int> versions;
+        map<int,int> pref;
+        vector<PersistentAVLTree<int,int>::Snapshot> snaps;
+        vector<map<int,int> > expected;
+        for(int i = 0; i < 6000; i++) {
+            int k = rand() % 2000;
+            if (rand() % 3 == 0) {
+                versions.remove(k);
+                pref.erase(k);
+            }
+            else {
+                versions.insert(make_pair(k, i));
+                pref[k] = i;
+            }
+            if (i % 1000 == 999) {
+                snaps.push_back(versions.snapshot());
+                expected.push_back(pref);
+            }
+        }
+        bool snapsSame = versions.size() == pref.size();
+        for(size_t i = 0; i < snaps.size(); i++) {
+            snapsSame = snapsSame && snaps[i].size() == expected[i].size() &&
+                        equal(snaps[i].begin(), snaps[i].end(), expected[i].begin(), expected[i].end());
+        }
+        PersistentAVLTree<int,int>::Snapshot last = snaps.back();
+        int someKey = expected.back().begin()->first;
+        PersistentAVLTree<int,int>::Snapshot::iterator found = last.find(someKey);
+        size_t tail = 0;
+        for(; found != last.end(); ++found) {
+            tail++;
+        }
+        cout << "\nPersistentAVLTree snapshots keep their contents: "
+             << (snapsSame && tail == expected.back().size() && last[someKey] == expected.back()[someKey]) << endl;
+
+        PersistentAVLTree<int,int> big;
+        for(int i = 0; i < 1023; i++) {
+            big.insert(make_pair(i * 2, i));
+        }
+        PersistentAVLTree<int,int>::Snapshot before = big.snapshot();
+        size_t count = allocations;
+        big.insert(make_pair(1001, 0));
+        size_t copied = allocations - count;
+        count = allocations;
+        PersistentAVLTree<int,int>::Snapshot after = big.snapshot();
+        cout << "insert copies only the path, snapshot() allocates nothing: "
+             << (copied <= 14 && allocations == count && before.size() == 1023 && after.size() == 1024) << endl;
+
+        // A reader scans snapshots while a writer keeps changing the tree.
+        PersistentAVLTree<int,int> live;
+        atomic<bool> done(false);
+        atomic<long> badScans(0);
+        thread reader([&] {
+            while(!done.load()) {
+                PersistentAVLTree<int,int>::Snapshot view = live.snapshot();
+                size_t n = 0;
+                int previous = -1;
+                for(PersistentAVLTree<int,int>::Snapshot::iterator it = view.begin(); it != view.end(); ++it, ++n) {
+                    if (it->first <= previous || it->second != it->first) badScans++;
+                    previous = it->first;
+                }
+                if (n != view.size()) badScans++;
+            }
+        });
+        for(int i = 0; i < 20000; i++) {
+            int k = rand() % 500;
+            if (i % 2) {
+                live.insert(make_pair(k, k));
+            }
+            else {
+                live.remove(k);
+            }
+        }
+        done = true;
+        reader.join();
+        cout << "snapshot scans are consistent while the writer runs: " << (badScans == 0) << endl;
+    }
+
+    // B+ tree tests
+    BTree<char,int> bpt;
+    bpt.insert(std::make_pair('a',1));
+    bpt.insert(std::make_pair('b',2));
+
+    cout << "\nBTree contents:" << endl;
+    for(BTree<char,int>::iterator it = bpt.begin(); it != bpt.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+    if(bpt.find('b') != bpt.end()) {
+        cout << "Found b" << endl;
+    }
+    else {
+        cout << "Did not find b" << endl;
+    }
+    cout << "Erasing b" << endl;
+    bpt.remove('b');
+
+    // Small nodes force splits, borrows and merges on every level
+    BTree<int,int,64> small;
+    map<int,int> reference;
+    srand(1);
+    for(int i = 0; i < 4000; i++) {
+        int k = rand() % 1000;
+        if(rand() % 3 == 0) {
+            small.remove(k);
+            reference.erase(k);
+        }
+        else {
+            small.insert(std::make_pair(k, i));
+            reference[k] = i;
+        }
+    }
+    bool same = small.size() == reference.size();
+    map<int,int>::iterator ref = reference.begin();
+    for(BTree<int,int,64>::iterator it = small.begin(); same && it != small.end(); ++it, ++ref) {
+        same = (it->first == ref->first) && (it->second == ref->second);
+    }
+    for(int k = 0; same && k < 1000; k++) {
+        same = (small.find(k) != small.end()) == (reference.count(k) == 1);
+    }
+    cout << "BTree matches std::map after random inserts/removes: " << same << endl;
+    for(ref = reference.begin(); ref != reference.end(); ++ref) {
+        small.remove(ref->first);
+    }
+    cout << "BTree empty after removing everything: " << small.empty() << endl;
+
+    // Vectorized node search
+    cout << "\nNode search agrees with scalar search:"
+         << " char " << nodeSearchAgrees<char>(-60, 3)
+         << " short " << nodeSearchAgrees<short>(-30000, 1500)
+         << " int " << nodeSearchAgrees<int>(-2000000000, 50000000)
+         << " unsigned " << nodeSearchAgrees<unsigned>(2000000000u, 50000000u)
+         << " int64_t " << nodeSearchAgrees<int64_t>(-5000000000LL, 250000000LL) << endl;
+
     return 0;
 }
@@ -5,20 +5,35 @@
 #include <exception>
 #include <cstdlib>
 #include <utility>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <string>
+#include "node-pool.h"
+#include "thread-pool.h"
+#include "tree-stats.h"
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
-h as Red Black trees, Splay trees,
- * and AVL trees.
+ * Nothing in a node is virtual, so a node carries no vtable pointer and
+ * the getters inline into the tree traversals. Derived node types (e.g.
+ * AVLNode) hide the parent/left/right getters with versions returning
+ * their own pointer type, and the tree that owns them frees them through
+ * BinarySearchTree::destroyNode, so no virtual destructor is needed.
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    template<typename K, typename... Args>
+    Node(std::piecewise_construct_t, Node<Key, Value>* parent, K&& key, Args&&... valueArgs);
+    template<typename... Args>
+    Node(std::in_place_t, Node<Key, Value>* parent, Args&&... itemArgs);
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,9 +41,9 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
@@ -61,6 +76,37 @@ Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* par
 
 }
 
+/**
+* Constructs the key from key and the value from valueArgs in place,
+* without any intermediate copies.
+*/
+template<typename Key, typename Value>
+template<typename K, typename... Args>
+Node<Key, Value>::Node(std::piecewise_construct_t, Node<Key, Value>* parent, K&& key, Args&&... valueArgs) :
+    item_(std::piecewise_construct,
+          std::forward_as_tuple(std::forward<K>(key)),
+          std::forward_as_tuple(std::forward<Args>(valueArgs)...)),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
+/**
+* Constructs the item from any arguments std::pair accepts.
+*/
+template<typename Key, typename Value>
+template<typename... Args>
+Node<Key, Value>::Node(std::in_place_t, Node<Key, Value>* parent, Args&&... itemArgs) :
+    item_(std::forward<Args>(itemArgs)...),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
 /**
 * Destructor, which does not need to do anything since the pointers inside of a node
 * are only used as references to existing nodes. The nodes pointed to by parent/left/right
@@ -118,7 +164,7 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const
@@ -127,7 +173,7 @@ Node<Key, Value>* Node<Key, Value>::getParent() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
@@ -136,7 +182,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
@@ -186,19 +232,63 @@ void Node<Key, Value>::setValue(const Value& value)
   ---------------------------------------
 */
 
+/**
+* Tells the tree whether its comparator has a three-way form. With one,
+* a descent step costs a single call and can stop as soon as it hits the
+* key; otherwise every step makes one Compare call and equality is
+* checked once at the bottom (see internalFind). std::string keys under
+* std::less use basic_string::compare, which reads the shared prefix of
+* two keys once instead of twice.
+*/
+template<typename Compare, typename Key>
+struct KeyOrder
+{
+    static const bool threeWay = false;
+};
+
+template<typename Char, typename Traits, typename A>
+struct KeyOrder<std::less<std::basic_string<Char, Traits, A> >, std::basic_string<Char, Traits, A> >
+{
+    static const bool threeWay = true;
+
+    template<typename K>
+    static int compare(const std::basic_string<Char, Traits, A>& a, const K& b)
+    {
+        return a.compare(b);
+    }
+};
+
+template<typename Char, typename Traits, typename A>
+struct KeyOrder<std::less<>, std::basic_string<Char, Traits, A> > :
+    KeyOrder<std::less<std::basic_string<Char, Traits, A> >, std::basic_string<Char, Traits, A> >
+{
+};
+
 /**
 * A templated unbalanced binary search tree.
+* Compare orders the keys like the comparator of std::map; when it defines
+* is_transparent (e.g. std::less<>), find() also takes any key type it can
+* compare, such as a const char* or string_view for std::string keys.
+* Alloc is the node allocation policy (see node-pool.h).
 */
-template <typename Key, typename Value>
+template <typename Key, typename Value, typename Compare = std::less<Key>, typename Alloc = HeapNodeAllocator>
 class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    explicit BinarySearchTree(const Alloc& alloc);
+    explicit BinarySearchTree(const Compare& comp, const Alloc& alloc = Alloc());
+    BinarySearchTree(BinarySearchTree&& other);
+    BinarySearchTree& operator=(BinarySearchTree&& other);
     virtual ~BinarySearchTree(); //TODO
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    void insert(std::pair<Key, Value>&& keyValuePair);
     virtual void remove(const Key& key); //TODO
+    template<typename InputIt>
+    void insertBatch(InputIt first, InputIt last);
     void clear(); //TODO
-    bool isBalanced() const; //TODO
+    void clear(ThreadPool* pool);
+    virtual bool isBalanced() const; //TODO
     void print() const;
     bool empty() const;
 
@@ -207,10 +297,18 @@ public:
 public:
     /**
     * An internal iterator class for traversing the contents of the BST.
+    * It is bidirectional: it also remembers its tree, so that the end
+    * iterator can step back to the largest item.
     */
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -220,24 +318,82 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
+        friend class BinarySearchTree<Key, Value, Compare, Alloc>;
+        iterator(Node<Key,Value>* ptr, const BinarySearchTree<Key, Value, Compare, Alloc>* tree);
         Node<Key, Value> *current_;
+        const BinarySearchTree<Key, Value, Compare, Alloc>* tree_;
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+
+    /**
+    * A half-open run of items [first, last) that can be used in a
+    * range-based for loop. Returned by range().
+    */
+    class range_view
+    {
+    public:
+        range_view(iterator first, iterator last) : first_(first), last_(last) { }
+        iterator begin() const { return first_; }
+        iterator end() const { return last_; }
+        bool empty() const { return first_ == last_; }
+
+    private:
+        iterator first_;
+        iterator last_;
     };
 
 public:
     iterator begin() const;
     iterator end() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
     iterator find(const Key& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+
+    // Ordered lookups, O(log n) each. The K versions need a transparent Compare.
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    range_view range(const Key& lo, const Key& hi) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    range_view range(const K& lo, const K& hi) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
+    const Alloc& getAllocator() const;
+    const Compare& key_comp() const;
+
+    // Hot-path counters of the calling thread (see tree-stats.h).
+    static TreeStats stats();
+
+    // In-place insertion. Like std::map, an existing key is left untouched.
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
 
 protected:
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // TODO
+    template<typename K>
+    Node<Key, Value>* internalFind(const K& k) const; // TODO
     Node<Key, Value> *getSmallestNode() const;  // TODO
+    Node<Key, Value>* getLargestNode() const;
+    template<typename K>
+    Node<Key, Value>* lowerBoundNode(const K& key) const;
+    template<typename K>
+    Node<Key, Value>* upperBoundNode(const K& key) const;
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
@@ -247,14 +403,38 @@ protected:
     virtual void printRoot (Node<Key, Value> *r) const;
     virtual void nodeSwap(Node<Key,Value>* n1, Node<Key,Value>* n2) ;
 
+    // Node storage, routed through the allocation policy
+    template<typename NodeType, typename... Args>
+    NodeType* createNode(Args&&... args);
+    template<typename NodeType>
+    void freeNode(NodeType* node);
+    virtual void destroyNode(Node<Key, Value>* node);
+
+    // Batched insertion
+    void sortBatch(std::vector<std::pair<Key, Value> >& items) const;
+    void insertSorted(const std::vector<std::pair<Key, Value> >& items);
+    Node<Key, Value>* findSlot(Node<Key, Value>* start, const Key& key, Node<Key, Value>*& parent, bool& left) const;
+    Node<Key, Value>* climbFor(Node<Key, Value>* finger, const Key& key) const;
+    virtual Node<Key, Value>* insertFrom(Node<Key, Value>* start, const Key& key, const Value& value);
+
+    // Shared insertion paths. NodeType is the node type of the calling tree.
+    template<typename NodeType, typename K, typename... Args>
+    std::pair<Node<Key, Value>*, bool> tryEmplaceNode(Node<Key, Value>* start, K&& key, Args&&... valueArgs);
+    template<typename NodeType, typename... Args>
+    std::pair<Node<Key, Value>*, bool> emplaceNode(Args&&... itemArgs);
+    virtual void linkNode(Node<Key, Value>* parent, Node<Key, Value>* node, bool left);
+    iterator makeIterator(Node<Key, Value>* node) const;
+
     // Add helper functions here
-    static void clearHelper(Node<Key, Value> *input);
-    static int balancedChecker(Node<Key,Value>* root);
+    void clearHelper(Node<Key, Value> *input);
+    void clearParallel(Node<Key, Value>* input, int depth, ThreadPool& pool);
 		static void moveUp(Node<Key,Value>* op, Node<Key,Value>* child);
 
 
 protected:
     Node<Key, Value>* root_;
+    Compare comp_;
+    Alloc alloc_;
     // You should not need other data members
 };
 
@@ -265,29 +445,33 @@ Begin implementations for the BinarySearchTree::iterator class.
 */
 
 /**
-* Explicit constructor that initializes an iterator with a given node pointer.
+* Explicit constructor that initializes an iterator with a given node pointer
+* and the tree the node belongs to.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::iterator(Node<Key,Value> *ptr,
+    const BinarySearchTree<Key, Value, Compare, Alloc>* tree)
 {
     current_ = ptr;
+    tree_ = tree;
 }
 
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::iterator() 
 {
     current_ = nullptr;
+    tree_ = nullptr;
 }
 
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Alloc>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -295,9 +479,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Alloc>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator->() const
 {
     return &(current_->getItem());
 } 
@@ -306,10 +490,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Alloc>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Compare, Alloc>::iterator& rhs) const
 {
     return this->current_ == rhs.current_;
 }
@@ -318,10 +502,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare, class Alloc>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Compare, Alloc>::iterator& rhs) const
 {
     return this->current_ != rhs.current_;
 
@@ -331,14 +515,49 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator&
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator++()
 {
 	this->current_ = successor(this->current_);
 	return *this;
 }
 
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator++(int)
+{
+    iterator old = *this;
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves the iterator back to the in-order predecessor. Stepping back from
+* end() lands on the largest item.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator&
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator--()
+{
+    if (this->current_ == NULL) {
+        this->current_ = tree_->getLargestNode();
+    }
+    else {
+        this->current_ = predecessor(this->current_);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::iterator::operator--(int)
+{
+    iterator old = *this;
+    --(*this);
+    return old;
+}
+
 
 /*
 -------------------------------------------------------------
@@ -355,15 +574,70 @@ Begin implementations for the BinarySearchTree class.
 /**
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::BinarySearchTree() 
 {
     root_ = NULL;
 
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Constructor taking an allocation policy. Trees built from copies of the
+* same PoolNodeAllocator share one arena.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::BinarySearchTree(const Alloc& alloc) :
+    root_(NULL),
+    alloc_(alloc)
+{
+
+}
+
+/**
+* Constructor taking a key comparator (and optionally an allocation policy).
+*/
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::BinarySearchTree(const Compare& comp, const Alloc& alloc) :
+    root_(NULL),
+    comp_(comp),
+    alloc_(alloc)
+{
+
+}
+
+/**
+* Move constructor: takes over other's nodes, leaving other empty. The
+* allocation policy is copied, so a pooled other keeps sharing the arena
+* its old nodes live in.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::BinarySearchTree(BinarySearchTree&& other) :
+    root_(other.root_),
+    comp_(other.comp_),
+    alloc_(other.alloc_)
+{
+    other.root_ = NULL;
+}
+
+/**
+* Move assignment: frees this tree's nodes and takes over other's.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>&
+BinarySearchTree<Key, Value, Compare, Alloc>::operator=(BinarySearchTree&& other)
+{
+    if (this != &other) {
+        clear();
+        root_ = other.root_;
+        comp_ = other.comp_;
+        alloc_ = other.alloc_;
+        other.root_ = NULL;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc>
+BinarySearchTree<Key, Value, Compare, Alloc>::~BinarySearchTree()
 {
     this->clear();
 }
@@ -371,14 +645,14 @@ BinarySearchTree<Key, Value>::~BinarySearchTree()
 /**
  * Returns true if tree is empty
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Compare, class Alloc>
+bool BinarySearchTree<Key, Value, Compare, Alloc>::empty() const
 {
     return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::print() const
 {
     printRoot(root_);
     std::cout << "\n";
@@ -387,114 +661,506 @@ void BinarySearchTree<Key, Value>::print() const
 /**
 * Returns an iterator to the "smallest" item in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::begin() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
+    BinarySearchTree<Key, Value, Compare, Alloc>::iterator begin(getSmallestNode(), this);
     return begin;
 }
 
 /**
 * Returns an iterator whose value means INVALID
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::end() const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
+    BinarySearchTree<Key, Value, Compare, Alloc>::iterator end(NULL, this);
     return end;
 }
 
+/**
+* Returns a reverse iterator to the largest item in the tree
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+/**
+* Returns the reverse iterator past the smallest item
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::reverse_iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
 /**
 * Returns an iterator to the item with the given key, k
 * or the end iterator if k does not exist in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::find(const Key & k) const
 {
     Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
+    BinarySearchTree<Key, Value, Compare, Alloc>::iterator it(curr, this);
     return it;
 }
 
+/**
+* Heterogeneous find, only available when Compare is transparent. The
+* key is compared as given, without building a temporary Key.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::find(const K& k) const
+{
+    return iterator(internalFind(k), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::lower_bound(const Key& key) const
+{
+    return iterator(lowerBoundNode(key), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or end() if there is none.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::upper_bound(const Key& key) const
+{
+    return iterator(upperBoundNode(key), this);
+}
+
+/**
+* Returns the (empty or one item) run of items equal to key.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator,
+          typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator>
+BinarySearchTree<Key, Value, Compare, Alloc>::equal_range(const Key& key) const
+{
+    iterator first = lower_bound(key);
+    iterator last = first;
+    if (first != end() && !comp_(key, first->first)) {
+        ++last;
+    }
+    return std::make_pair(first, last);
+}
+
+/**
+* Returns the items with lo <= key < hi. Finding the ends costs two
+* descents; walking the view then touches only the items inside it.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::range_view
+BinarySearchTree<Key, Value, Compare, Alloc>::range(const Key& lo, const Key& hi) const
+{
+    if (!comp_(lo, hi)) {
+        return range_view(end(), end());
+    }
+    return range_view(lower_bound(lo), lower_bound(hi));
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::lower_bound(const K& key) const
+{
+    return iterator(lowerBoundNode(key), this);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::upper_bound(const K& key) const
+{
+    return iterator(upperBoundNode(key), this);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::range_view
+BinarySearchTree<Key, Value, Compare, Alloc>::range(const K& lo, const K& hi) const
+{
+    if (!comp_(lo, hi)) {
+        return range_view(end(), end());
+    }
+    return range_view(iterator(lowerBoundNode(lo), this), iterator(lowerBoundNode(hi), this));
+}
+
 /**
  * @precondition The key exists in the map
  * Returns the value associated with the key
  */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+template<class Key, class Value, class Compare, class Alloc>
+Value& BinarySearchTree<Key, Value, Compare, Alloc>::operator[](const Key& key)
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+template<class Key, class Value, class Compare, class Alloc>
+Value const & BinarySearchTree<Key, Value, Compare, Alloc>::operator[](const Key& key) const
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
 
+/**
+* Returns the node allocation policy used by this tree.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+const Alloc& BinarySearchTree<Key, Value, Compare, Alloc>::getAllocator() const
+{
+    return alloc_;
+}
+
+/**
+* Returns the key comparator used by this tree.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+const Compare& BinarySearchTree<Key, Value, Compare, Alloc>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Returns the calling thread's counters since the last call and resets
+* them. They cover every tree the thread used, and are all zero unless
+* built with -DBST_STATS.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+TreeStats BinarySearchTree<Key, Value, Compare, Alloc>::stats()
+{
+    return takeTreeStats();
+}
+
+/**
+* Allocates a node from the policy and constructs it in place from args.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename NodeType, typename... Args>
+NodeType* BinarySearchTree<Key, Value, Compare, Alloc>::createNode(Args&&... args)
+{
+    NodeType* node = alloc_.template allocate<NodeType>();
+    try {
+        ::new (static_cast<void*>(node)) NodeType(std::forward<Args>(args)...);
+    }
+    catch (...) {
+        alloc_.template deallocate<NodeType>(node);
+        throw;
+    }
+    return node;
+}
+
+/**
+* Destroys a node and hands its storage back to the policy.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Compare, Alloc>::freeNode(NodeType* node)
+{
+    node->~NodeType();
+    alloc_.template deallocate<NodeType>(node);
+}
+
+/**
+* Frees a node of this tree's node type. Trees with a derived node type
+* override this so the storage is returned with the right size.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::destroyNode(Node<Key, Value>* node)
+{
+    freeNode(node);
+}
+
 /**
 * An insert method to insert into a Binary Search Tree.
 * The tree will not remain balanced when inserting.
 * Recall: If key is already in the tree, you should 
 * overwrite the current value with the updated value.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Compare, class Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::insert(const std::pair<const Key, Value> &keyValuePair)
 {
-    Value operativeValue = keyValuePair.second;
-    Key operativeKey = keyValuePair.first;
-    
+    std::pair<Node<Key, Value>*, bool> result =
+        tryEmplaceNode<Node<Key, Value> >(root_, keyValuePair.first, keyValuePair.second);
+    if (!result.second) { //if key already exists in tree, just switch in the value
+        result.first->setValue(keyValuePair.second);
+    }
+}
 
-    if (root_ == NULL){
-        if (empty()) {
-            Node<Key,Value>* temp = new Node<Key,Value>(operativeKey,operativeValue,NULL);
-            root_ = temp;
-            return;
-        }
+/**
+* An insert that moves the key and value into the tree instead of
+* copying them. An existing key gets the moved value.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::insert(std::pair<Key, Value>&& keyValuePair)
+{
+    std::pair<Node<Key, Value>*, bool> result =
+        tryEmplaceNode<Node<Key, Value> >(root_, std::move(keyValuePair.first), std::move(keyValuePair.second));
+    if (!result.second) { //nothing was moved from yet
+        result.first->getValue() = std::move(keyValuePair.second);
+    }
+}
+
+/**
+* Constructs an item from args directly inside a new node. If the key is
+* already present the new node is discarded and the tree is unchanged.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc>::emplace(Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result = emplaceNode<Node<Key, Value> >(std::forward<Args>(args)...);
+    return std::make_pair(makeIterator(result.first), result.second);
+}
+
+/**
+* Inserts key with a value constructed from args, unless key is already
+* present, in which case nothing is constructed and nothing changes.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc>::try_emplace(const Key& key, Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result = tryEmplaceNode<Node<Key, Value> >(root_, key, std::forward<Args>(args)...);
+    return std::make_pair(makeIterator(result.first), result.second);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator, bool>
+BinarySearchTree<Key, Value, Compare, Alloc>::try_emplace(Key&& key, Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result = tryEmplaceNode<Node<Key, Value> >(root_, std::move(key), std::forward<Args>(args)...);
+    return std::make_pair(makeIterator(result.first), result.second);
+}
+
+/**
+* Looks for key below start, comparing against the stored keys by
+* reference. If it is missing, a NodeType is built in place from key and
+* valueArgs and linked in. Returns the node and whether it is new.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename NodeType, typename K, typename... Args>
+std::pair<Node<Key, Value>*, bool>
+BinarySearchTree<Key, Value, Compare, Alloc>::tryEmplaceNode(Node<Key, Value>* start, K&& key, Args&&... valueArgs)
+{
+    Node<Key, Value>* parent;
+    bool left;
+    Node<Key, Value>* found = findSlot(start, key, parent, left);
+    if (found != NULL) {
+        return std::make_pair(found, false);
+    }
+    NodeType* temp = createNode<NodeType>(std::piecewise_construct, static_cast<NodeType*>(parent),
+                                          std::forward<K>(key), std::forward<Args>(valueArgs)...);
+    linkNode(parent, temp, left);
+    return std::make_pair(static_cast<Node<Key, Value>*>(temp), true);
+}
+
+/**
+* Builds the node first (its key is only known once the item exists),
+* then searches with the node's own key and frees the node on a duplicate.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+template<typename NodeType, typename... Args>
+std::pair<Node<Key, Value>*, bool>
+BinarySearchTree<Key, Value, Compare, Alloc>::emplaceNode(Args&&... itemArgs)
+{
+    NodeType* temp = createNode<NodeType>(std::in_place, static_cast<NodeType*>(NULL), std::forward<Args>(itemArgs)...);
+    Node<Key, Value>* parent;
+    bool left;
+    Node<Key, Value>* found = findSlot(root_, temp->getKey(), parent, left);
+    if (found != NULL) {
+        freeNode(temp);
+        return std::make_pair(found, false);
+    }
+    temp->setParent(parent);
+    linkNode(parent, temp, left);
+    return std::make_pair(static_cast<Node<Key, Value>*>(temp), true);
+}
+
+/**
+* Hangs a new leaf off parent on the side findSlot reported (or makes it
+* the root). Balanced trees override this to rebalance after the link.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::linkNode(Node<Key, Value>* parent, Node<Key, Value>* node, bool left)
+{
+    if (parent == NULL) {
+        root_ = node;
+    }
+    else if (left) {
+        parent->setLeft(node);
     }
     else {
-        Node<Key,Value>* parent;
-        Node<Key,Value>* operativeRoot = root_;
-        while (operativeRoot != NULL) {
-            Key focusKey = operativeRoot->getKey();
-            if (focusKey == operativeKey) { //if key already exists in tree, just switch in the value
-                for (int i = 0; i < 1; i++) {
-                    operativeRoot->setValue(operativeValue);
-										return;
-                }
+        parent->setRight(node);
+    }
+}
+
+/**
+* Wraps a node in an iterator; lets derived trees build iterators too.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename BinarySearchTree<Key, Value, Compare, Alloc>::iterator
+BinarySearchTree<Key, Value, Compare, Alloc>::makeIterator(Node<Key, Value>* node) const
+{
+    return iterator(node, this);
+}
+
+/**
+* Inserts a batch of items in one call. The batch is sorted first (when a
+* key repeats, the last value wins, as with repeated insert() calls). Each
+* key then starts its descent from the node the previous key landed on and
+* climbs only as far as it has to, so nearby keys share their search path
+* instead of starting over from the root.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+template<typename InputIt>
+void BinarySearchTree<Key, Value, Compare, Alloc>::insertBatch(InputIt first, InputIt last)
+{
+    std::vector<std::pair<Key, Value> > items(first, last);
+    sortBatch(items);
+    insertSorted(items);
+}
+
+/**
+* Sorts a batch by key and drops repeated keys, keeping the last value.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::sortBatch(std::vector<std::pair<Key, Value> >& items) const
+{
+    const Compare& comp = comp_;
+    std::stable_sort(items.begin(), items.end(),
+        [&comp](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) { return comp(a.first, b.first); });
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < items.size(); i++) {
+        if (kept > 0 && !comp_(items[kept - 1].first, items[i].first)) { //same key as the last kept item: later one wins
+            items[kept - 1].second = items[i].second;
+        }
+        else {
+            if (kept != i) {
+                items[kept] = items[i];
             }
-            else if (operativeKey > focusKey) { //if key greater than current key, move right. If it was equal, then key would've been found.
-							for (int i = 0; i < 1; i++) {
-								parent = operativeRoot;
-								operativeRoot = operativeRoot->getRight();
-							}
-						}
-						else if (operativeKey < focusKey) { //if key is less than current key, move left
-							for (int i = 0; i < 1; i++) {
-								parent = operativeRoot;
-								operativeRoot = operativeRoot->getLeft();
-							}
-						}
+            kept++;
         }
-				Node<Key,Value>* temp = new Node<Key,Value>(operativeKey,operativeValue,NULL); //insert value
-				if (temp->getKey() > parent->getKey()) {
-					parent->setRight(temp);
-				}
-				else {
-					parent->setLeft(temp);
-				}
-				temp->setParent(parent);
     }
+    items.resize(kept);
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::moveUp(Node<Key,Value>* op, Node<Key,Value>* child) {
+/**
+* Inserts a sorted, duplicate free batch, each key starting from the last.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::insertSorted(const std::vector<std::pair<Key, Value> >& items)
+{
+    Node<Key, Value>* finger = NULL;
+    for (std::size_t i = 0; i < items.size(); i++) {
+        Node<Key, Value>* start = finger == NULL ? root_ : climbFor(finger, items[i].first);
+        finger = insertFrom(start, items[i].first, items[i].second);
+    }
+}
+
+/**
+* Climbs from finger to the lowest ancestor whose subtree can hold key,
+* given that key is larger than finger's key.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Alloc>::climbFor(Node<Key, Value>* finger, const Key& key) const
+{
+    Node<Key, Value>* current = finger;
+    while (current->getParent() != NULL) {
+        Node<Key, Value>* parent = current->getParent();
+        BST_STAT(nodeVisits);
+        if (current == parent->getLeft() && (BST_STAT(comparisons), comp_(key, parent->getKey()))) { //parent bounds this subtree from above
+            break;
+        }
+        current = parent;
+    }
+    return current;
+}
+
+/**
+* Searches the subtree at start for key. Returns the node holding it, or
+* NULL with parent set to the node a new key would hang off (NULL when
+* the tree is empty) and left telling on which side.
+* Like internalFind, the descent makes one comparison per level.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Alloc>::findSlot(Node<Key, Value>* start, const Key& key, Node<Key, Value>*& parent, bool& left) const
+{
+    parent = NULL;
+    left = false;
+    Node<Key, Value>* current = start;
+    if constexpr (KeyOrder<Compare, Key>::threeWay) {
+        while (current != NULL) {
+            BST_STAT(nodeVisits);
+            BST_STAT(comparisons);
+            int order = KeyOrder<Compare, Key>::compare(current->getKey(), key);
+            if (order == 0) {
+                return current;
+            }
+            parent = current;
+            left = order > 0;
+            current = left ? current->getLeft() : current->getRight();
+        }
+        return NULL;
+    }
+    Node<Key, Value>* candidate = NULL; //last node whose key is not less than key
+    while (current != NULL) {
+        BST_STAT(nodeVisits);
+        BST_STAT(comparisons);
+        parent = current;
+        left = !comp_(current->getKey(), key);
+        if (left) {
+            candidate = current;
+            current = current->getLeft();
+        }
+        else {
+            current = current->getRight();
+        }
+    }
+    if (candidate != NULL && (BST_STAT(comparisons), !comp_(key, candidate->getKey()))) {
+        return candidate;
+    }
+    return NULL;
+}
+
+/**
+* Inserts (or overwrites) key below start and returns its node.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Alloc>::insertFrom(Node<Key, Value>* start, const Key& key, const Value& value)
+{
+    std::pair<Node<Key, Value>*, bool> result = tryEmplaceNode<Node<Key, Value> >(start, key, value);
+    if (!result.second) {
+        result.first->setValue(value);
+    }
+    return result.first;
+}
+
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::moveUp(Node<Key,Value>* op, Node<Key,Value>* child) {
 	if (child == NULL || op == NULL) {
 		return;
 	}
@@ -522,8 +1188,8 @@ void BinarySearchTree<Key, Value>::moveUp(Node<Key,Value>* op, Node<Key,Value>*
 * Recall: The writeup specifies that if a node has 2 children you
 * should swap with the predecessor and then remove.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::remove(const Key& key)
 {
 		Node<Key,Value>* removeThis = internalFind(key);
 		//base case: node does not exist.
@@ -534,7 +1200,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
 			//cases: if it is the only node in the tree or if it has no children
 			if (removeThis == root_ && removeThis->getRight() == NULL && removeThis->getLeft() == NULL) { // only node
 				for (int i = 0; i < 1; i++) {
-					delete removeThis;
+					destroyNode(removeThis);
 					root_ = NULL;
 					return;
 				}
@@ -567,23 +1233,31 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
 						}
 					}
 				}
-				if (removeThis->getParent() == NULL) {/*do nothing*/}
-				else if (removeThis == removeThis->getParent()->getRight()) { //if removeThis is the right child, delete it
-					removeThis->getParent()->setRight(NULL);
+				//removeThis now has at most one child: splice it into removeThis's place
+				Node<Key,Value>* child = removeThis->getLeft() != NULL ? removeThis->getLeft() : removeThis->getRight();
+				Node<Key,Value>* parent = removeThis->getParent();
+				if (child != NULL) {
+					child->setParent(parent);
+				}
+				if (parent == NULL) {
+					root_ = child;
+				}
+				else if (removeThis == parent->getRight()) {
+					parent->setRight(child);
 				}
-				else if (removeThis == removeThis->getParent()->getLeft()) { //if removeThis is the left child, delete it
-					removeThis->getParent()->setLeft(NULL);
+				else {
+					parent->setLeft(child);
 				}
-				delete removeThis;
+				destroyNode(removeThis);
 			}
 		}
 }
 
 
 
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Compare, typename Alloc>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+BinarySearchTree<Key, Value, Compare, Alloc>::predecessor(Node<Key, Value>* current)
 {
     Node<Key, Value>* p = current;
     if (p == NULL) { //if current is null, just return null.
@@ -611,9 +1285,9 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
     return p;
 }
 
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Compare, typename Alloc>
 Node<Key,Value>*
-BinarySearchTree<Key,Value>::successor(Node<Key,Value>* current) {
+BinarySearchTree<Key, Value, Compare, Alloc>::successor(Node<Key,Value>* current) {
 	Node<Key,Value>* next = current;
 	if (next->getRight() == NULL) { //if right child doesn't exist, go back up the chain until you reach a node 
 		Node<Key, Value>* up = next->getParent();
@@ -632,36 +1306,118 @@ BinarySearchTree<Key,Value>::successor(Node<Key,Value>* current) {
 	return next;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearHelper(Node<Key, Value>* input) {
-	if (input == NULL) {
-		return;
-	}
-	for (int i = 0; i < 1; i++) {
-		clearHelper(input->getLeft()); //initially go left until you hit a leftmost null child. 
-		clearHelper(input->getRight()); //then go right until you hit a rightmost null child.
-	}
-	delete input; //delete on the way up.
+/**
+* Frees the subtree at input in post order without recursion or a stack:
+* walk down to a leaf, cut it off its parent, free it and continue from
+* the parent, which may now be a leaf itself. Each node is reached at
+* most three times, so a degenerate tree of any depth takes O(n) time
+* and O(1) extra space. input's own parent link is left alone.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::clearHelper(Node<Key, Value>* input)
+{
+    if (input == NULL) {
+        return;
+    }
+    Node<Key, Value>* stop = input->getParent();
+    Node<Key, Value>* current = input;
+    while (current != stop) {
+        if (current->getLeft() != NULL) {
+            current = current->getLeft();
+        }
+        else if (current->getRight() != NULL) {
+            current = current->getRight();
+        }
+        else {
+            Node<Key, Value>* parent = current->getParent();
+            if (current != input) { //cut the leaf off so its parent can become one
+                if (parent->getLeft() == current) {
+                    parent->setLeft(NULL);
+                }
+                else {
+                    parent->setRight(NULL);
+                }
+            }
+            destroyNode(current); //delete on the way up.
+            current = parent;
+        }
+    }
+}
+
+/**
+* Frees the top depth levels of the subtree at input, handing the two
+* subtrees below each of them to the pool, and frees the rest with
+* clearHelper.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::clearParallel(Node<Key, Value>* input, int depth, ThreadPool& pool)
+{
+    if (input == NULL) {
+        return;
+    }
+    if (depth == 0) {
+        clearHelper(input);
+        return;
+    }
+    Node<Key, Value>* left = input->getLeft();
+    Node<Key, Value>* right = input->getRight();
+    destroyNode(input);
+    if (left != NULL) {
+        left->setParent(NULL);
+    }
+    if (right != NULL) {
+        right->setParent(NULL);
+    }
+    pool.invoke([&] { clearParallel(left, depth - 1, pool); },
+                [&] { clearParallel(right, depth - 1, pool); });
 }
 
 /**
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
+* When the items need no destructor and the allocation policy can drop
+* all of its nodes at once, the tree is not walked at all.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::clear()
 {
-    this->clearHelper(root_);
+    if (root_ == NULL) {
+        return;
+    }
+    if (!(std::is_trivially_destructible<std::pair<const Key, Value> >::value && alloc_.release())) {
+        this->clearHelper(root_);
+    }
+    root_ = NULL;
+}
+
+/**
+* Like clear(), but disjoint subtrees are freed on the pool's threads.
+* Falls back to clear() when the arena can be released wholesale or the
+* allocation policy cannot free from several threads.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::clear(ThreadPool* pool)
+{
+    if (pool == NULL || pool->size() < 2 || !alloc_.concurrent() || root_ == NULL) {
+        clear();
+        return;
+    }
+    int depth = 2; //four tasks per thread even out uneven subtrees
+    for (std::size_t n = 1; n < pool->size(); n *= 2) {
+        depth++;
+    }
+    Node<Key, Value>* root = root_;
     root_ = NULL;
+    clearParallel(root, depth, *pool);
 }
 
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Compare, typename Alloc>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+BinarySearchTree<Key, Value, Compare, Alloc>::getSmallestNode() const
 {
     if (root_ == NULL) {//base case
         return NULL;
@@ -680,88 +1436,169 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
     }
 }
 
+/**
+* A helper function to find the largest node in the tree.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare, Alloc>::getLargestNode() const
+{
+    Node<Key, Value>* largestNode = root_;
+    while (largestNode != NULL && largestNode->getRight() != NULL) {
+        largestNode = largestNode->getRight();
+    }
+    return largestNode;
+}
+
+/**
+* Returns the first node whose key is not less than key, or NULL.
+* One comparison per level, as in internalFind.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Alloc>::lowerBoundNode(const K& key) const
+{
+    Node<Key, Value>* p = root_;
+    Node<Key, Value>* candidate = NULL;
+    while (p != NULL) {
+        BST_STAT(nodeVisits);
+        BST_STAT(comparisons);
+        if (comp_(p->getKey(), key)) {
+            p = p->getRight();
+        }
+        else {
+            candidate = p;
+            p = p->getLeft();
+        }
+    }
+    return candidate;
+}
+
+/**
+* Returns the first node whose key is greater than key, or NULL.
+*/
+template<typename Key, typename Value, typename Compare, typename Alloc>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Alloc>::upperBoundNode(const K& key) const
+{
+    Node<Key, Value>* p = root_;
+    Node<Key, Value>* candidate = NULL;
+    while (p != NULL) {
+        BST_STAT(nodeVisits);
+        BST_STAT(comparisons);
+        if (comp_(key, p->getKey())) {
+            candidate = p;
+            p = p->getLeft();
+        }
+        else {
+            p = p->getRight();
+        }
+    }
+    return candidate;
+}
+
 /**
 * Helper function to find a node with given key, k and
 * return a pointer to it or NULL if no item with that key
-* exists
+* exists.
+* Each level costs one comparison. With a three-way comparator (see
+* KeyOrder) the search stops at the key; otherwise it is a lower bound
+* search that remembers the last node not less than key and checks that
+* node for equality once at the end.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Compare, typename Alloc>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare, Alloc>::internalFind(const K& key) const
 {
 	Node<Key, Value>* p = this->root_;
-	if (p == NULL) {
-		return NULL;
-	}
-	else {
+	if constexpr (KeyOrder<Compare, Key>::threeWay) { //one call per level tells all three cases apart
 		while (p != NULL) {
-			if ( key < p->getKey() ) {
-				p = p->getLeft();
-			}
-			else if (key >= p->getKey()) {
-				p = p->getRight();
+			BST_STAT(nodeVisits);
+			BST_STAT(comparisons);
+			int order = KeyOrder<Compare, Key>::compare(p->getKey(), key);
+			if (order == 0) {
+				return p;
 			}
+			p = order > 0 ? p->getLeft() : p->getRight();
 		}
-		if ((p!= NULL) && (p->getKey() == key)) {
-			return p;
+		return NULL;
+	}
+	Node<Key, Value>* candidate = NULL;
+	while (p != NULL) {
+		BST_STAT(nodeVisits);
+		BST_STAT(comparisons);
+		if (comp_(p->getKey(), key)) {
+			p = p->getRight();
 		}
-		else {
-			return NULL;
+		else { //p might be the key, keep looking left for a smaller match
+			candidate = p;
+			p = p->getLeft();
 		}
 	}
-}
-
-template<typename Key,typename Value>
-int BinarySearchTree<Key,Value>::balancedChecker(Node<Key,Value>* root) { //using my equalpaths code.
-  if (root == NULL) return 0; //if root is empty
-	if (root->getLeft() == NULL && root->getRight() == NULL) { //base case: leaf node
-		return 1;
-	}
-	int leftH = -1;
-	int rightH = -1;
-	if (root->getLeft() != nullptr) { //if left exists
-		leftH = balancedChecker(root->getLeft())+1; //find left height
-	}
-	if (root->getRight() != nullptr) { //if right exists
-		rightH = balancedChecker(root->getRight())+1; //find right height
-	}
-	if (leftH <= rightH) { //if left is less than or equal to right
-		return rightH; //send up right
-	}
-	else if (leftH > rightH) {
-		return leftH;
+	if (candidate != NULL && (BST_STAT(comparisons), !comp_(key, candidate->getKey()))) {
+		return candidate;
 	}
-	return 0;
+	return NULL;
 }
 
 /**
- * Return true iff the BST is balanced.
+ * Return true iff the BST is balanced: at every node, the heights of the
+ * two subtrees differ by at most one. A post-order walk on an explicit
+ * stack, so degenerate trees of any depth are fine; it stops at the first
+ * node out of balance. O(n) time and O(height) space.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Compare, typename Alloc>
+bool BinarySearchTree<Key, Value, Compare, Alloc>::isBalanced() const
 {
-  if (this->root_ == nullptr) { //base: if input node is empty
-		return true;
-	}
-	if (this->root_->getLeft() == nullptr && this->root_->getRight() == nullptr) { //base case: whole tree has just one node
-		return true;
-	}
-	Node<Key, Value>* temp = this->root_;
-	int rightH = balancedChecker(temp->getLeft());
-	int leftH = balancedChecker(temp->getRight());
-	if ( (leftH == 0 && rightH == 1) || (leftH == 1 && rightH == 0) ) { //base case: tree is just one node with one leaf node (1 left OR 1 right)
-		return true;
-	}
-	else {
-		return (rightH == leftH); //Check if the heights of left and right are balanced.
-	}
+    struct Frame
+    {
+        Node<Key, Value>* node;
+        int leftH;
+        int stage;    // 0: left subtree next, 1: right subtree next, 2: both done
+    };
+    if (root_ == NULL) {
+        return true;
+    }
+    std::vector<Frame> stack;
+    stack.push_back(Frame{ root_, 0, 0 });
+    int h = 0; //height of the subtree finished last
+    while (!stack.empty()) {
+        Frame& top = stack.back();
+        Node<Key, Value>* child;
+        if (top.stage == 0) {
+            top.stage = 1;
+            child = top.node->getLeft();
+        }
+        else if (top.stage == 1) {
+            top.leftH = h;
+            top.stage = 2;
+            child = top.node->getRight();
+        }
+        else {
+            if (top.leftH - h > 1 || h - top.leftH > 1) {
+                return false;
+            }
+            h = 1 + std::max(top.leftH, h);
+            stack.pop_back();
+            continue;
+        }
+        if (child != NULL) {
+            stack.push_back(Frame{ child, 0, 0 });
+        }
+        else {
+            h = 0;
+        }
+    }
+    return true;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Compare, typename Alloc>
+void BinarySearchTree<Key, Value, Compare, Alloc>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
     }
+    BST_STAT(nodeSwaps);
     Node<Key, Value>* n1p = n1->getParent();
     Node<Key, Value>* n1r = n1->getRight();
     Node<Key, Value>* n1lt = n1->getLeft();
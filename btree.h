@@ -0,0 +1,765 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <iostream>
+#include <exception>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "node-search.h"
+
+/**
+ * A templated B+ tree map with the same surface as BinarySearchTree
+ * (insert/remove/find/operator[]/begin/end/clear), so a call site can switch
+ * between the two with a typedef.
+ *
+ * Every node is sized to roughly NodeBytes (pick a multiple of the 64 byte
+ * cache line) and packs as many keys as fit. Keys and values live in
+ * separate arrays inside a leaf so a lookup only touches the key lines. All
+ * items live in the leaves, and the leaves form a doubly linked list, so an
+ * in-order scan is a sequential walk over the leaf arrays. Within a node,
+ * integral keys are searched with vector compares (see node-search.h).
+ *
+ * Key and Value must be default constructible. Since keys and values are
+ * stored apart, dereferencing an iterator yields a pair of references
+ * rather than a reference to a stored pair; it->first and it->second work
+ * as they do for BinarySearchTree.
+ */
+template <typename Key, typename Value, std::size_t NodeBytes = 256>
+class BTree
+{
+private:
+    struct NodeBase
+    {
+        uint16_t count_;    // number of keys in use
+        bool leaf_;
+    };
+
+    static const std::size_t HEADER_BYTES = sizeof(NodeBase) + 2 * sizeof(void*);
+    static const std::size_t LEAF_FIT = NodeBytes > HEADER_BYTES ?
+        (NodeBytes - HEADER_BYTES) / (sizeof(Key) + sizeof(Value)) : 0;
+    static const std::size_t INNER_FIT = NodeBytes > HEADER_BYTES ?
+        (NodeBytes - HEADER_BYTES) / (sizeof(Key) + sizeof(void*)) : 0;
+
+public:
+    // Keys per node. Always at least 4 so splits and merges stay meaningful.
+    static const std::size_t LEAF_CAPACITY = LEAF_FIT < 4 ? 4 : LEAF_FIT;
+    static const std::size_t INNER_CAPACITY = INNER_FIT < 4 ? 4 : INNER_FIT;
+
+private:
+    struct Leaf : public NodeBase
+    {
+        Leaf* prev_;
+        Leaf* next_;
+        Key keys_[nodeSearchSlots<Key>(LEAF_CAPACITY)];
+        Value values_[LEAF_CAPACITY];
+    };
+
+    struct Inner : public NodeBase
+    {
+        // keys_[i] is the smallest key reachable through children_[i+1]
+        Key keys_[nodeSearchSlots<Key>(INNER_CAPACITY)];
+        NodeBase* children_[INNER_CAPACITY + 1];
+    };
+
+    // One step of a root-to-leaf descent: the inner node and the child taken.
+    struct PathStep
+    {
+        Inner* node;
+        std::size_t child;
+    };
+
+public:
+    BTree();
+    ~BTree();
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool isBalanced() const;
+    void print() const;
+    bool empty() const;
+    std::size_t size() const;
+
+public:
+    /**
+    * An iterator over the leaf chain. It stays valid until the next insert
+    * or remove on the tree.
+    */
+    class iterator
+    {
+    public:
+        typedef std::pair<const Key&, Value&> reference;
+
+        // Lets operator-> hand out a pair of references by value.
+        class pointer
+        {
+        public:
+            reference* operator->() { return &ref_; }
+        private:
+            friend class iterator;
+            pointer(const reference& ref) : ref_(ref) { }
+            reference ref_;
+        };
+
+        iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class BTree<Key, Value, NodeBytes>;
+        iterator(Leaf* leaf, std::size_t slot);
+        Leaf* leaf_;
+        std::size_t slot_;
+    };
+
+public:
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+protected:
+    static std::size_t lowerBound(const Key* keys, std::size_t count, const Key& key);
+    static std::size_t upperBound(const Key* keys, std::size_t count, const Key& key);
+
+    Leaf* findLeaf(const Key& key, std::vector<PathStep>* path) const;
+    void insertIntoParent(std::vector<PathStep>& path, NodeBase* left, const Key& separator, NodeBase* right);
+    void rebalanceLeaf(std::vector<PathStep>& path, Leaf* leaf);
+    void rebalanceInner(std::vector<PathStep>& path, Inner* node);
+    void removeFromInner(Inner* node, std::size_t keyIndex);
+    static void clearHelper(NodeBase* node);
+
+private:
+    BTree(const BTree&);
+    BTree& operator=(const BTree&);
+
+    NodeBase* root_;
+    Leaf* head_;    // leftmost leaf
+    std::size_t size_;
+};
+
+/*
+--------------------------------------------------
+Begin implementations for the BTree::iterator class.
+--------------------------------------------------
+*/
+
+/**
+* Explicit constructor for an iterator at the given slot of a leaf.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+BTree<Key, Value, NodeBytes>::iterator::iterator(Leaf* leaf, std::size_t slot) :
+    leaf_(leaf),
+    slot_(slot)
+{
+
+}
+
+/**
+* A default constructor that initializes the iterator to the end.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+BTree<Key, Value, NodeBytes>::iterator::iterator() :
+    leaf_(NULL),
+    slot_(0)
+{
+
+}
+
+/**
+* Provides access to the item as a pair of references.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+typename BTree<Key, Value, NodeBytes>::iterator::reference
+BTree<Key, Value, NodeBytes>::iterator::operator*() const
+{
+    return reference(leaf_->keys_[slot_], leaf_->values_[slot_]);
+}
+
+/**
+* Provides member access to the item (it->first, it->second).
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+typename BTree<Key, Value, NodeBytes>::iterator::pointer
+BTree<Key, Value, NodeBytes>::iterator::operator->() const
+{
+    return pointer(**this);
+}
+
+/**
+* Checks if 'this' iterator refers to the same slot as 'rhs'
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+bool BTree<Key, Value, NodeBytes>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && slot_ == rhs.slot_;
+}
+
+/**
+* Checks if 'this' iterator refers to a different slot than 'rhs'
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+bool BTree<Key, Value, NodeBytes>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances to the next slot, following the leaf chain at the end of a leaf.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+typename BTree<Key, Value, NodeBytes>::iterator&
+BTree<Key, Value, NodeBytes>::iterator::operator++()
+{
+    slot_++;
+    if (slot_ == leaf_->count_) {
+        leaf_ = leaf_->next_;
+        slot_ = 0;
+    }
+    return *this;
+}
+
+/*
+------------------------------------------------
+End implementations for the BTree::iterator class.
+------------------------------------------------
+*/
+
+/*
+-----------------------------------------
+Begin implementations for the BTree class.
+-----------------------------------------
+*/
+
+/**
+* Default constructor for an empty tree.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+BTree<Key, Value, NodeBytes>::BTree() :
+    root_(NULL),
+    head_(NULL),
+    size_(0)
+{
+
+}
+
+template<class Key, class Value, std::size_t NodeBytes>
+BTree<Key, Value, NodeBytes>::~BTree()
+{
+    clear();
+}
+
+/**
+ * Returns true if tree is empty
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+bool BTree<Key, Value, NodeBytes>::empty() const
+{
+    return root_ == NULL;
+}
+
+/**
+ * Returns the number of items in the tree
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+std::size_t BTree<Key, Value, NodeBytes>::size() const
+{
+    return size_;
+}
+
+/**
+* Every leaf of a B+ tree sits at the same depth, so it is always balanced.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+bool BTree<Key, Value, NodeBytes>::isBalanced() const
+{
+    return true;
+}
+
+/**
+* Prints the leaves in order, one bracketed group per leaf.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::print() const
+{
+    if (head_ == NULL) {
+        std::cout << "<empty tree>" << std::endl;
+        return;
+    }
+    for (Leaf* leaf = head_; leaf != NULL; leaf = leaf->next_) {
+        std::cout << "[";
+        for (std::size_t i = 0; i < leaf->count_; i++) {
+            std::cout << (i == 0 ? "" : " ") << leaf->keys_[i];
+        }
+        std::cout << "]";
+    }
+    std::cout << "\n";
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+typename BTree<Key, Value, NodeBytes>::iterator
+BTree<Key, Value, NodeBytes>::begin() const
+{
+    return iterator(head_, 0);
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+typename BTree<Key, Value, NodeBytes>::iterator
+BTree<Key, Value, NodeBytes>::end() const
+{
+    return iterator(NULL, 0);
+}
+
+/**
+* Returns an iterator to the item with the given key
+* or the end iterator if it does not exist in the tree
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+typename BTree<Key, Value, NodeBytes>::iterator
+BTree<Key, Value, NodeBytes>::find(const Key& key) const
+{
+    Leaf* leaf = findLeaf(key, NULL);
+    if (leaf == NULL) {
+        return end();
+    }
+    std::size_t slot = lowerBound(leaf->keys_, leaf->count_, key);
+    if (slot == leaf->count_ || key < leaf->keys_[slot]) {
+        return end();
+    }
+    return iterator(leaf, slot);
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, std::size_t NodeBytes>
+Value& BTree<Key, Value, NodeBytes>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if (it == end()) throw std::out_of_range("Invalid key");
+    return it.leaf_->values_[it.slot_];
+}
+
+template<class Key, class Value, std::size_t NodeBytes>
+Value const & BTree<Key, Value, NodeBytes>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if (it == end()) throw std::out_of_range("Invalid key");
+    return it.leaf_->values_[it.slot_];
+}
+
+/**
+* Returns the index of the first key that is not less than key.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+std::size_t BTree<Key, Value, NodeBytes>::lowerBound(const Key* keys, std::size_t count, const Key& key)
+{
+    return NodeSearch<Key>::lowerBound(keys, count, key);
+}
+
+/**
+* Returns the index of the first key that is greater than key.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+std::size_t BTree<Key, Value, NodeBytes>::upperBound(const Key* keys, std::size_t count, const Key& key)
+{
+    return NodeSearch<Key>::upperBound(keys, count, key);
+}
+
+/**
+* Descends to the leaf that holds (or would hold) key. When path is given,
+* every inner node passed on the way is recorded along with the child taken.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+typename BTree<Key, Value, NodeBytes>::Leaf*
+BTree<Key, Value, NodeBytes>::findLeaf(const Key& key, std::vector<PathStep>* path) const
+{
+    NodeBase* node = root_;
+    if (node == NULL) {
+        return NULL;
+    }
+    while (!node->leaf_) {
+        Inner* inner = static_cast<Inner*>(node);
+        std::size_t child = upperBound(inner->keys_, inner->count_, key);
+        if (path != NULL) {
+            PathStep step = { inner, child };
+            path->push_back(step);
+        }
+        node = inner->children_[child];
+    }
+    return static_cast<Leaf*>(node);
+}
+
+/**
+* An insert method. If the key is already in the tree,
+* the current value is overwritten with the new value.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    const Key& key = keyValuePair.first;
+    if (root_ == NULL) { //first item: the root is a single leaf
+        Leaf* leaf = new Leaf();
+        leaf->leaf_ = true;
+        leaf->count_ = 1;
+        leaf->prev_ = NULL;
+        leaf->next_ = NULL;
+        leaf->keys_[0] = key;
+        leaf->values_[0] = keyValuePair.second;
+        root_ = leaf;
+        head_ = leaf;
+        size_ = 1;
+        return;
+    }
+
+    std::vector<PathStep> path;
+    Leaf* leaf = findLeaf(key, &path);
+    std::size_t slot = lowerBound(leaf->keys_, leaf->count_, key);
+    if (slot < leaf->count_ && !(key < leaf->keys_[slot])) { //already present, just switch in the value
+        leaf->values_[slot] = keyValuePair.second;
+        return;
+    }
+    size_++;
+
+    if (leaf->count_ < LEAF_CAPACITY) { //room in this leaf: shift the tail up by one
+        for (std::size_t i = leaf->count_; i > slot; i--) {
+            leaf->keys_[i] = leaf->keys_[i - 1];
+            leaf->values_[i] = leaf->values_[i - 1];
+        }
+        leaf->keys_[slot] = key;
+        leaf->values_[slot] = keyValuePair.second;
+        leaf->count_++;
+        return;
+    }
+
+    //full leaf: move the upper half into a new right sibling
+    Leaf* right = new Leaf();
+    right->leaf_ = true;
+    std::size_t half = (LEAF_CAPACITY + 1) / 2;
+    std::size_t moved = LEAF_CAPACITY - half;
+    for (std::size_t i = 0; i < moved; i++) {
+        right->keys_[i] = leaf->keys_[half + i];
+        right->values_[i] = leaf->values_[half + i];
+    }
+    right->count_ = moved;
+    leaf->count_ = half;
+    right->prev_ = leaf;
+    right->next_ = leaf->next_;
+    if (leaf->next_ != NULL) {
+        leaf->next_->prev_ = right;
+    }
+    leaf->next_ = right;
+
+    Leaf* target = leaf;
+    if (slot > half) {
+        target = right;
+        slot -= half;
+    }
+    for (std::size_t i = target->count_; i > slot; i--) {
+        target->keys_[i] = target->keys_[i - 1];
+        target->values_[i] = target->values_[i - 1];
+    }
+    target->keys_[slot] = key;
+    target->values_[slot] = keyValuePair.second;
+    target->count_++;
+
+    insertIntoParent(path, leaf, right->keys_[0], right);
+}
+
+/**
+* Hooks a freshly split right node in next to left, splitting ancestors
+* as needed and growing a new root when the old root splits.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::insertIntoParent(std::vector<PathStep>& path, NodeBase* left, const Key& separator, NodeBase* right)
+{
+    if (path.empty()) { //left was the root
+        Inner* root = new Inner();
+        root->leaf_ = false;
+        root->count_ = 1;
+        root->keys_[0] = separator;
+        root->children_[0] = left;
+        root->children_[1] = right;
+        root_ = root;
+        return;
+    }
+    PathStep step = path.back();
+    path.pop_back();
+    Inner* parent = step.node;
+    std::size_t pos = step.child;
+
+    if (parent->count_ < INNER_CAPACITY) {
+        for (std::size_t i = parent->count_; i > pos; i--) {
+            parent->keys_[i] = parent->keys_[i - 1];
+            parent->children_[i + 1] = parent->children_[i];
+        }
+        parent->keys_[pos] = separator;
+        parent->children_[pos + 1] = right;
+        parent->count_++;
+        return;
+    }
+
+    //full parent: lay out all keys/children in order, then split around the middle key
+    std::vector<Key> keys(parent->keys_, parent->keys_ + parent->count_);
+    std::vector<NodeBase*> children(parent->children_, parent->children_ + parent->count_ + 1);
+    keys.insert(keys.begin() + pos, separator);
+    children.insert(children.begin() + pos + 1, right);
+
+    std::size_t mid = keys.size() / 2;
+    Inner* sibling = new Inner();
+    sibling->leaf_ = false;
+    parent->count_ = mid;
+    for (std::size_t i = 0; i < mid; i++) {
+        parent->keys_[i] = keys[i];
+        parent->children_[i] = children[i];
+    }
+    parent->children_[mid] = children[mid];
+    sibling->count_ = keys.size() - mid - 1;
+    for (std::size_t i = 0; i < sibling->count_; i++) {
+        sibling->keys_[i] = keys[mid + 1 + i];
+        sibling->children_[i] = children[mid + 1 + i];
+    }
+    sibling->children_[sibling->count_] = children.back();
+
+    insertIntoParent(path, parent, keys[mid], sibling);
+}
+
+/**
+* A remove method to remove a specific key from the tree.
+* Underfull nodes borrow from or merge with a sibling.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::remove(const Key& key)
+{
+    std::vector<PathStep> path;
+    Leaf* leaf = findLeaf(key, &path);
+    if (leaf == NULL) {
+        return;
+    }
+    std::size_t slot = lowerBound(leaf->keys_, leaf->count_, key);
+    if (slot == leaf->count_ || key < leaf->keys_[slot]) { //not in the tree
+        return;
+    }
+    for (std::size_t i = slot + 1; i < leaf->count_; i++) {
+        leaf->keys_[i - 1] = leaf->keys_[i];
+        leaf->values_[i - 1] = leaf->values_[i];
+    }
+    leaf->count_--;
+    size_--;
+    rebalanceLeaf(path, leaf);
+}
+
+/**
+* Restores the minimum fill of a leaf after a removal.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::rebalanceLeaf(std::vector<PathStep>& path, Leaf* leaf)
+{
+    const std::size_t minFill = LEAF_CAPACITY / 2;
+    if (path.empty()) { //the root leaf may hold any number of keys
+        if (leaf->count_ == 0) {
+            delete leaf;
+            root_ = NULL;
+            head_ = NULL;
+        }
+        return;
+    }
+    if (leaf->count_ >= minFill) {
+        return;
+    }
+    PathStep step = path.back();
+    Inner* parent = step.node;
+    std::size_t pos = step.child;
+    Leaf* left = pos > 0 ? static_cast<Leaf*>(parent->children_[pos - 1]) : NULL;
+    Leaf* right = pos < parent->count_ ? static_cast<Leaf*>(parent->children_[pos + 1]) : NULL;
+
+    if (left != NULL && left->count_ > minFill) { //borrow the largest item of the left sibling
+        for (std::size_t i = leaf->count_; i > 0; i--) {
+            leaf->keys_[i] = leaf->keys_[i - 1];
+            leaf->values_[i] = leaf->values_[i - 1];
+        }
+        leaf->keys_[0] = left->keys_[left->count_ - 1];
+        leaf->values_[0] = left->values_[left->count_ - 1];
+        leaf->count_++;
+        left->count_--;
+        parent->keys_[pos - 1] = leaf->keys_[0];
+        return;
+    }
+    if (right != NULL && right->count_ > minFill) { //borrow the smallest item of the right sibling
+        leaf->keys_[leaf->count_] = right->keys_[0];
+        leaf->values_[leaf->count_] = right->values_[0];
+        leaf->count_++;
+        for (std::size_t i = 1; i < right->count_; i++) {
+            right->keys_[i - 1] = right->keys_[i];
+            right->values_[i - 1] = right->values_[i];
+        }
+        right->count_--;
+        parent->keys_[pos] = right->keys_[0];
+        return;
+    }
+
+    //no sibling can spare an item: merge with one of them
+    std::size_t sepIndex = pos;
+    if (left != NULL) {
+        right = leaf;
+        sepIndex = pos - 1;
+    }
+    else {
+        left = leaf;
+    }
+    for (std::size_t i = 0; i < right->count_; i++) {
+        left->keys_[left->count_ + i] = right->keys_[i];
+        left->values_[left->count_ + i] = right->values_[i];
+    }
+    left->count_ += right->count_;
+    left->next_ = right->next_;
+    if (right->next_ != NULL) {
+        right->next_->prev_ = left;
+    }
+    delete right;
+
+    path.pop_back();
+    removeFromInner(parent, sepIndex);
+    rebalanceInner(path, parent);
+}
+
+/**
+* Drops keys_[keyIndex] and the child to its right from an inner node.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::removeFromInner(Inner* node, std::size_t keyIndex)
+{
+    for (std::size_t i = keyIndex + 1; i < node->count_; i++) {
+        node->keys_[i - 1] = node->keys_[i];
+        node->children_[i] = node->children_[i + 1];
+    }
+    node->count_--;
+}
+
+/**
+* Restores the minimum fill of an inner node after it lost a child.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::rebalanceInner(std::vector<PathStep>& path, Inner* node)
+{
+    const std::size_t minFill = INNER_CAPACITY / 2;
+    if (path.empty()) { //the root only has to keep one child
+        if (node->count_ == 0) {
+            root_ = node->children_[0];
+            delete node;
+        }
+        return;
+    }
+    if (node->count_ >= minFill) {
+        return;
+    }
+    PathStep step = path.back();
+    Inner* parent = step.node;
+    std::size_t pos = step.child;
+    Inner* left = pos > 0 ? static_cast<Inner*>(parent->children_[pos - 1]) : NULL;
+    Inner* right = pos < parent->count_ ? static_cast<Inner*>(parent->children_[pos + 1]) : NULL;
+
+    if (left != NULL && left->count_ > minFill) { //rotate one child over from the left through the parent
+        node->children_[node->count_ + 1] = node->children_[node->count_];
+        for (std::size_t i = node->count_; i > 0; i--) {
+            node->keys_[i] = node->keys_[i - 1];
+            node->children_[i] = node->children_[i - 1];
+        }
+        node->keys_[0] = parent->keys_[pos - 1];
+        node->children_[0] = left->children_[left->count_];
+        node->count_++;
+        parent->keys_[pos - 1] = left->keys_[left->count_ - 1];
+        left->count_--;
+        return;
+    }
+    if (right != NULL && right->count_ > minFill) { //rotate one child over from the right
+        node->keys_[node->count_] = parent->keys_[pos];
+        node->children_[node->count_ + 1] = right->children_[0];
+        node->count_++;
+        parent->keys_[pos] = right->keys_[0];
+        for (std::size_t i = 1; i < right->count_; i++) {
+            right->keys_[i - 1] = right->keys_[i];
+            right->children_[i - 1] = right->children_[i];
+        }
+        right->children_[right->count_ - 1] = right->children_[right->count_];
+        right->count_--;
+        return;
+    }
+
+    //merge with a sibling, pulling the separator down between them
+    std::size_t sepIndex = pos;
+    if (left != NULL) {
+        right = node;
+        sepIndex = pos - 1;
+    }
+    else {
+        left = node;
+    }
+    left->keys_[left->count_] = parent->keys_[sepIndex];
+    for (std::size_t i = 0; i < right->count_; i++) {
+        left->keys_[left->count_ + 1 + i] = right->keys_[i];
+        left->children_[left->count_ + 1 + i] = right->children_[i];
+    }
+    left->children_[left->count_ + 1 + right->count_] = right->children_[right->count_];
+    left->count_ += right->count_ + 1;
+    delete right;
+
+    path.pop_back();
+    removeFromInner(parent, sepIndex);
+    rebalanceInner(path, parent);
+}
+
+template<class Key, class Value, std::size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::clearHelper(NodeBase* node)
+{
+    if (node == NULL) {
+        return;
+    }
+    if (node->leaf_) {
+        delete static_cast<Leaf*>(node);
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for (std::size_t i = 0; i <= inner->count_; i++) {
+        clearHelper(inner->children_[i]);
+    }
+    delete inner;
+}
+
+/**
+* A method to remove all contents of the tree and
+* reset the values in the tree for use again.
+*/
+template<class Key, class Value, std::size_t NodeBytes>
+void BTree<Key, Value, NodeBytes>::clear()
+{
+    clearHelper(root_);
+    root_ = NULL;
+    head_ = NULL;
+    size_ = 0;
+}
+
+/*
+---------------------------------------
+End implementations for the BTree class.
+---------------------------------------
+*/
+
+#endif
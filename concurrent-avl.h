@@ -0,0 +1,885 @@
+#ifndef CONCURRENT_AVL_H
+#define CONCURRENT_AVL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "epoch.h"
+#include "node-pool.h"
+
+/**
+ * A node of ConcurrentAVLTree.
+ *
+ * The key and value never change once the node is linked in: an insert
+ * over an existing key links a fresh node in place of the old one. Readers
+ * follow the atomic child pointers and check the version word; parent and
+ * height are only used by writers, who may read them without holding the
+ * node and check what they read once they have locked it.
+ *
+ * Version layout: bit 0 is set while a writer holds the node, bit 1 once
+ * the node has been unlinked, and every unlock that changed a link adds 4.
+ */
+template <typename Key, typename Value>
+class ConcurrentAVLNode
+{
+public:
+    ConcurrentAVLNode(const Key& key, const Value& value, ConcurrentAVLNode<Key, Value>* parent);
+
+    static const uint64_t LOCKED = 1;
+    static const uint64_t OBSOLETE = 2;
+
+    std::pair<const Key, Value> item_;
+    std::atomic<ConcurrentAVLNode<Key, Value>*> left_;
+    std::atomic<ConcurrentAVLNode<Key, Value>*> right_;
+    std::atomic<uint64_t> version_;
+    std::atomic<ConcurrentAVLNode<Key, Value>*> parent_;
+    std::atomic<int> height_;
+};
+
+template<class Key, class Value>
+ConcurrentAVLNode<Key, Value>::ConcurrentAVLNode(const Key& key, const Value& value, ConcurrentAVLNode<Key, Value>* parent) :
+    item_(key, value),
+    left_(NULL),
+    right_(NULL),
+    version_(0),
+    parent_(parent),
+    height_(1)
+{
+
+}
+
+/**
+ * An AVL map for many reader threads and several writers.
+ *
+ * Readers take no locks. They descend with optimistic lock coupling: read
+ * a node's version, read its key and child pointer, then check that the
+ * version of the node they came from has not moved. A locked or changed
+ * version sends the reader back to the root.
+ *
+ * Writers lock only the nodes whose links they change. A writer finds its
+ * place with the same optimistic descent, then locks the parent it is
+ * about to change by swapping the version it read for a locked one, which
+ * fails if the parent changed in between. A writer that cannot get a lock
+ * drops the ones it holds and starts over, so no writer ever waits while
+ * holding a lock. Rebalancing then walks up from the change; each height
+ * fix or rotation is a step of its own that locks two or three nodes. So
+ * writers in different parts of the tree run side by side, and the tree
+ * is an AVL tree again once they are done.
+ *
+ * Removing a node with two children moves its successor node up into its
+ * place. The writer also locks every node on the way down to the
+ * successor, so a reader headed for the successor's key starts over
+ * instead of finding it gone from below.
+ *
+ * Unlinked nodes cannot be freed while a reader may still be standing on
+ * them. Every operation runs inside an EpochDomain guard and writers
+ * retire unlinked nodes to the domain once the write is published, so they
+ * are freed in batches as soon as every thread has moved past them. Nodes
+ * are freed by whichever writer collects, so an allocation policy that is
+ * not concurrent() is called under a mutex.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key>, typename Alloc = HeapNodeAllocator>
+class ConcurrentAVLTree
+{
+public:
+    typedef ConcurrentAVLNode<Key, Value> NodeType;
+
+    ConcurrentAVLTree();
+    explicit ConcurrentAVLTree(const Compare& comp, const Alloc& alloc = Alloc());
+    ~ConcurrentAVLTree();
+
+    // Lock-free lookups, safe to run alongside writers.
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+
+    // Writers, safe to run alongside each other.
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+
+    std::size_t size() const;
+    bool empty() const;
+
+    // Frees every retired node at once. No other thread may be inside the
+    // tree.
+    void reclaim();
+    std::size_t retiredCount() const;
+
+private:
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+
+protected:
+    // The nodes one write step has locked (NULL for the root pointer) and
+    // the ones it has unlinked.
+    struct WriteSet
+    {
+        std::vector<NodeType*> locked;
+        std::vector<NodeType*> unlinked;
+    };
+
+    // Readers
+    static bool readVersion(const std::atomic<uint64_t>& version, uint64_t& seen);
+    static bool checkVersion(const std::atomic<uint64_t>& version, uint64_t seen);
+    int tryFind(const Key& key, Value* value) const;
+
+    // Writers
+    std::atomic<uint64_t>& versionOf(NodeType* node);
+    bool locate(const Key& key, NodeType*& parent, uint64_t& parentSeen, NodeType*& node, uint64_t& nodeSeen, bool& left);
+    bool tryLock(WriteSet& writes, NodeType* node, uint64_t seen);
+    bool tryLock(WriteSet& writes, NodeType* node);
+    bool lockNode(WriteSet& writes, NodeType* node);
+    void retire(WriteSet& writes, NodeType* node);
+    void release(WriteSet& writes);
+    void publish(WriteSet& writes);
+    static void freeRetired(void* node, void* tree);
+    void setChild(NodeType* parent, NodeType* old, NodeType* child);
+    bool isChild(NodeType* parent, NodeType* child) const;
+    static int height(NodeType* node);
+    static void updateHeight(NodeType* node);
+    NodeType* rotateLeft(NodeType* node);
+    NodeType* rotateRight(NodeType* node);
+    void rebalance(NodeType* node);
+    NodeType* createNode(const Key& key, const Value& value, NodeType* parent);
+    void destroyNode(NodeType* node);
+    NodeType* allocateNode();
+    void deallocateNode(NodeType* node);
+    void clearHelper(NodeType* node);
+
+    std::atomic<NodeType*> root_;
+    std::atomic<uint64_t> rootVersion_;    // guards root_ like a node version
+    std::atomic<std::size_t> size_;
+    Compare comp_;
+    Alloc alloc_;
+
+    std::mutex allocLock_;    // only taken if alloc_ is not concurrent()
+    mutable EpochDomain epochs_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  ---------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare, class Alloc>
+ConcurrentAVLTree<Key, Value, Compare, Alloc>::ConcurrentAVLTree() :
+    root_(NULL),
+    rootVersion_(0),
+    size_(0)
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+ConcurrentAVLTree<Key, Value, Compare, Alloc>::ConcurrentAVLTree(const Compare& comp, const Alloc& alloc) :
+    root_(NULL),
+    rootVersion_(0),
+    size_(0),
+    comp_(comp),
+    alloc_(alloc)
+{
+
+}
+
+/**
+* Frees the tree and every retired node. No other thread may use the tree.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+ConcurrentAVLTree<Key, Value, Compare, Alloc>::~ConcurrentAVLTree()
+{
+    clearHelper(root_.load(std::memory_order_relaxed));
+    epochs_.drain();
+}
+
+/**
+* Reads a version for a later checkVersion. Returns false if a writer holds
+* the node or it has been unlinked.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool ConcurrentAVLTree<Key, Value, Compare, Alloc>::readVersion(const std::atomic<uint64_t>& version, uint64_t& seen)
+{
+    seen = version.load(std::memory_order_acquire);
+    return (seen & (NodeType::LOCKED | NodeType::OBSOLETE)) == 0;
+}
+
+/**
+* Returns true if nothing the reader saw since readVersion was changed.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool ConcurrentAVLTree<Key, Value, Compare, Alloc>::checkVersion(const std::atomic<uint64_t>& version, uint64_t seen)
+{
+    std::atomic_thread_fence(std::memory_order_acquire); //keep the reads above before the check
+    return version.load(std::memory_order_relaxed) == seen;
+}
+
+/**
+* One optimistic descent. Returns 1 if key was found (copying its value
+* into value unless that is NULL), 0 if it is not in the tree and -1 if a
+* writer got in the way and the search has to start over.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+int ConcurrentAVLTree<Key, Value, Compare, Alloc>::tryFind(const Key& key, Value* value) const
+{
+    const std::atomic<uint64_t>* parentVersion = &rootVersion_;
+    uint64_t parentSeen;
+    if (!readVersion(*parentVersion, parentSeen)) {
+        return -1;
+    }
+    NodeType* node = root_.load(std::memory_order_acquire);
+    while (node != NULL) {
+        uint64_t seen;
+        if (!readVersion(node->version_, seen) || !checkVersion(*parentVersion, parentSeen)) {
+            return -1;
+        }
+        const Key& nodeKey = node->item_.first;
+        NodeType* next;
+        if (comp_(key, nodeKey)) {
+            next = node->left_.load(std::memory_order_acquire);
+        }
+        else if (comp_(nodeKey, key)) {
+            next = node->right_.load(std::memory_order_acquire);
+        }
+        else {
+            if (value != NULL) {
+                *value = node->item_.second;
+            }
+            return checkVersion(node->version_, seen) ? 1 : -1;
+        }
+        parentVersion = &node->version_;
+        parentSeen = seen;
+        node = next;
+    }
+    return checkVersion(*parentVersion, parentSeen) ? 0 : -1;
+}
+
+/**
+* Copies the value for key into value and returns true if key is in the
+* tree. Never blocks; retries from the root when a writer interferes.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool ConcurrentAVLTree<Key, Value, Compare, Alloc>::find(const Key& key, Value& value) const
+{
+    EpochDomain::Guard guard(epochs_);
+    int result;
+    while ((result = tryFind(key, &value)) < 0) {
+        std::this_thread::yield();
+    }
+    return result == 1;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+bool ConcurrentAVLTree<Key, Value, Compare, Alloc>::contains(const Key& key) const
+{
+    EpochDomain::Guard guard(epochs_);
+    int result;
+    while ((result = tryFind(key, NULL)) < 0) {
+        std::this_thread::yield();
+    }
+    return result == 1;
+}
+
+/**
+* Inserts or overwrites a key. An overwrite links a new node in place of
+* the old one, so readers never see a value being changed.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Alloc>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    EpochDomain::Guard guard(epochs_);
+    NodeType* fresh = createNode(keyValuePair.first, keyValuePair.second, NULL);
+    while (true) {
+        NodeType* parent;
+        NodeType* node;
+        uint64_t parentSeen;
+        uint64_t nodeSeen;
+        bool left;
+        if (!locate(fresh->item_.first, parent, parentSeen, node, nodeSeen, left)) {
+            std::this_thread::yield();
+            continue;
+        }
+        WriteSet writes;
+        if (!tryLock(writes, parent, parentSeen) || (node != NULL && !tryLock(writes, node, nodeSeen))) {
+            release(writes);
+            std::this_thread::yield();
+            continue;
+        }
+        fresh->parent_.store(parent, std::memory_order_release);
+        if (node != NULL) { //replace the node
+            NodeType* l = node->left_.load(std::memory_order_relaxed);
+            NodeType* r = node->right_.load(std::memory_order_relaxed);
+            fresh->left_.store(l, std::memory_order_relaxed);
+            fresh->right_.store(r, std::memory_order_relaxed);
+            if (l != NULL) {
+                l->parent_.store(fresh, std::memory_order_release);
+            }
+            if (r != NULL) {
+                r->parent_.store(fresh, std::memory_order_release);
+            }
+            updateHeight(fresh);
+            retire(writes, node);
+            setChild(parent, node, fresh);
+        }
+        else if (parent == NULL) {
+            root_.store(fresh, std::memory_order_release);
+            size_.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            if (left) {
+                parent->left_.store(fresh, std::memory_order_release);
+            }
+            else {
+                parent->right_.store(fresh, std::memory_order_release);
+            }
+            size_.fetch_add(1, std::memory_order_relaxed);
+        }
+        publish(writes);
+        if (node != NULL) { //node may have been waiting for a rotation
+            rebalance(fresh);
+        }
+        rebalance(parent);
+        return;
+    }
+}
+
+/**
+* Removes a key if it is there. A node with two children is replaced by
+* its successor node (keys and values are never moved between nodes).
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Alloc>::remove(const Key& key)
+{
+    EpochDomain::Guard guard(epochs_);
+    while (true) {
+        NodeType* parent;
+        NodeType* node;
+        uint64_t parentSeen;
+        uint64_t nodeSeen;
+        bool left;
+        if (!locate(key, parent, parentSeen, node, nodeSeen, left)) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (node == NULL) {
+            return;
+        }
+        WriteSet writes;
+        if (!tryLock(writes, parent, parentSeen) || !tryLock(writes, node, nodeSeen)) {
+            release(writes);
+            std::this_thread::yield();
+            continue;
+        }
+        NodeType* l = node->left_.load(std::memory_order_relaxed);
+        NodeType* r = node->right_.load(std::memory_order_relaxed);
+        if (l == NULL || r == NULL) {
+            NodeType* child = l != NULL ? l : r;
+            if (child != NULL) {
+                child->parent_.store(parent, std::memory_order_release);
+            }
+            retire(writes, node);
+            setChild(parent, node, child);
+            size_.fetch_sub(1, std::memory_order_relaxed);
+            publish(writes);
+            rebalance(parent);
+            return;
+        }
+        // Lock the whole path down to the successor: a reader on it may be
+        // looking for the successor's key, which is about to move above it.
+        NodeType* successorParent = node;
+        NodeType* successor = r;
+        bool locked = tryLock(writes, successor);
+        NodeType* next;
+        while (locked && (next = successor->left_.load(std::memory_order_relaxed)) != NULL) {
+            successorParent = successor;
+            successor = next;
+            locked = tryLock(writes, successor);
+        }
+        if (!locked) {
+            release(writes);
+            std::this_thread::yield();
+            continue;
+        }
+        NodeType* fixFrom = successor;
+        if (successor != r) { //unhook the successor, then give it node's right subtree
+            NodeType* successorRight = successor->right_.load(std::memory_order_relaxed);
+            if (successorRight != NULL) {
+                successorRight->parent_.store(successorParent, std::memory_order_release);
+            }
+            successorParent->left_.store(successorRight, std::memory_order_release);
+            successor->right_.store(r, std::memory_order_release);
+            r->parent_.store(successor, std::memory_order_release);
+            fixFrom = successorParent;
+        }
+        successor->left_.store(l, std::memory_order_release);
+        l->parent_.store(successor, std::memory_order_release);
+        successor->parent_.store(parent, std::memory_order_release);
+        updateHeight(successor);
+        retire(writes, node);
+        setChild(parent, node, successor);
+        size_.fetch_sub(1, std::memory_order_relaxed);
+        publish(writes);
+        rebalance(fixFrom);
+        if (fixFrom != successor) { //the walk from below may stop short of these
+            rebalance(successor);
+        }
+        rebalance(parent);
+        return;
+    }
+}
+
+/**
+* Unlinks every node at once. The nodes are retired, so readers that are
+* still inside the old tree stay safe.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Alloc>::clear()
+{
+    EpochDomain::Guard guard(epochs_);
+    WriteSet writes;
+    lockNode(writes, NULL);
+    NodeType* root = root_.load(std::memory_order_relaxed);
+    if (root == NULL) {
+        release(writes);
+        return;
+    }
+    std::vector<NodeType*> pending(1, root);
+    while (!pending.empty()) {
+        NodeType* node = pending.back();
+        pending.pop_back();
+        lockNode(writes, node); //its parent is ours, so it stays linked
+        NodeType* l = node->left_.load(std::memory_order_relaxed);
+        NodeType* r = node->right_.load(std::memory_order_relaxed);
+        if (l != NULL) {
+            pending.push_back(l);
+        }
+        if (r != NULL) {
+            pending.push_back(r);
+        }
+        retire(writes, node);
+    }
+    root_.store(NULL, std::memory_order_release);
+    size_.fetch_sub(writes.unlinked.size(), std::memory_order_relaxed);
+    publish(writes);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+std::size_t ConcurrentAVLTree<Key, Value, Compare, Alloc>::size() const
+{
+    return size_.load(std::memory_order_relaxed);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+bool ConcurrentAVLTree<Key, Value, Compare, Alloc>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Frees every node still waiting in the epoch domain, without waiting for
+* the epochs to move on. The caller must make sure that no other thread
+* is inside the tree, e.g. between phases of a workload.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Alloc>::reclaim()
+{
+    epochs_.drain();
+}
+
+/**
+* Returns the number of unlinked nodes not freed yet.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+std::size_t ConcurrentAVLTree<Key, Value, Compare, Alloc>::retiredCount() const
+{
+    return epochs_.pendingCount();
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+std::atomic<uint64_t>& ConcurrentAVLTree<Key, Value, Compare, Alloc>::versionOf(NodeType* node)
+{
+    return node == NULL ? rootVersion_ : node->version_;
+}
+
+/**
+* One optimistic descent for a writer. On success node is the node holding
+* key, or NULL if there is none, and parent is the node above that spot
+* (NULL for the root pointer); left tells which of parent's links leads
+* there. parentSeen and nodeSeen are the versions all this was read under.
+* Returns false if another writer got in the way.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool ConcurrentAVLTree<Key, Value, Compare, Alloc>::locate(const Key& key, NodeType*& parent, uint64_t& parentSeen,
+                                                           NodeType*& node, uint64_t& nodeSeen, bool& left)
+{
+    parent = NULL;
+    left = false;
+    if (!readVersion(rootVersion_, parentSeen)) {
+        return false;
+    }
+    node = root_.load(std::memory_order_acquire);
+    while (node != NULL) {
+        if (!readVersion(node->version_, nodeSeen) || !checkVersion(versionOf(parent), parentSeen)) {
+            return false;
+        }
+        const Key& nodeKey = node->item_.first;
+        bool goLeft;
+        if (comp_(key, nodeKey)) {
+            goLeft = true;
+        }
+        else if (comp_(nodeKey, key)) {
+            goLeft = false;
+        }
+        else {
+            return checkVersion(node->version_, nodeSeen);
+        }
+        NodeType* next = goLeft ? node->left_.load(std::memory_order_acquire) : node->right_.load(std::memory_order_acquire);
+        parent = node;
+        parentSeen = nodeSeen;
+        left = goLeft;
+        node = next;
+    }
+    return checkVersion(versionOf(parent), parentSeen);
+}
+
+/**
+* Locks a node (NULL for the root pointer) if its version is still seen,
+* i.e. nothing changed it since the caller read it. Readers that reach it,
+* or that validate against it, start over until the write step is done.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool ConcurrentAVLTree<Key, Value, Compare, Alloc>::tryLock(WriteSet& writes, NodeType* node, uint64_t seen)
+{
+    if (!versionOf(node).compare_exchange_strong(seen, seen | NodeType::LOCKED, std::memory_order_acquire,
+                                                 std::memory_order_relaxed)) {
+        return false;
+    }
+    writes.locked.push_back(node);
+    return true;
+}
+
+/**
+* Locks a node unless another writer holds it or it has been unlinked.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool ConcurrentAVLTree<Key, Value, Compare, Alloc>::tryLock(WriteSet& writes, NodeType* node)
+{
+    uint64_t seen;
+    return readVersion(versionOf(node), seen) && tryLock(writes, node, seen);
+}
+
+/**
+* Waits until a node is free and locks it. Returns false if it has been
+* unlinked. The caller may only hold locks above node (as clear does),
+* and the holders it waits for never wait themselves, so there is no
+* deadlock.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool ConcurrentAVLTree<Key, Value, Compare, Alloc>::lockNode(WriteSet& writes, NodeType* node)
+{
+    std::atomic<uint64_t>& version = versionOf(node);
+    while (true) {
+        uint64_t seen = version.load(std::memory_order_relaxed);
+        if (seen & NodeType::OBSOLETE) {
+            return false;
+        }
+        if ((seen & NodeType::LOCKED) == 0 && tryLock(writes, node, seen)) {
+            return true;
+        }
+        std::this_thread::yield();
+    }
+}
+
+/**
+* Marks a locked node as unlinked. It stays locked for good and is retired
+* once the write is published.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Alloc>::retire(WriteSet& writes, NodeType* node)
+{
+    node->version_.fetch_or(NodeType::OBSOLETE, std::memory_order_relaxed);
+    writes.unlinked.push_back(node);
+}
+
+/**
+* Unlocks the nodes of a write step that changed no link, so their
+* versions go back to what readers saw before.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Alloc>::release(WriteSet& writes)
+{
+    for (std::size_t i = 0; i < writes.locked.size(); i++) {
+        std::atomic<uint64_t>& version = versionOf(writes.locked[i]);
+        version.store(version.load(std::memory_order_relaxed) & ~NodeType::LOCKED, std::memory_order_release);
+    }
+    writes.locked.clear();
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Alloc>::freeRetired(void* node, void* tree)
+{
+    static_cast<ConcurrentAVLTree*>(tree)->destroyNode(static_cast<NodeType*>(node));
+}
+
+/**
+* Publishes the changes of a write step: every locked node gets a new even
+* version, except for retired nodes, which stay locked.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Alloc>::publish(WriteSet& writes)
+{
+    for (std::size_t i = 0; i < writes.locked.size(); i++) {
+        std::atomic<uint64_t>& version = versionOf(writes.locked[i]);
+        uint64_t seen = version.load(std::memory_order_relaxed);
+        if ((seen & NodeType::OBSOLETE) == 0) {
+            version.store((seen & ~NodeType::LOCKED) + 4, std::memory_order_release);
+        }
+    }
+    writes.locked.clear();
+    for (std::size_t i = 0; i < writes.unlinked.size(); i++) { //unreachable for every reader that starts now
+        epochs_.retire(writes.unlinked[i], &freeRetired, this);
+    }
+    writes.unlinked.clear();
+}
+
+/**
+* Points the link that held old (in parent, or the root pointer) at child.
+* The caller has locked parent.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Alloc>::setChild(NodeType* parent, NodeType* old, NodeType* child)
+{
+    if (parent == NULL) {
+        root_.store(child, std::memory_order_release);
+    }
+    else if (parent->left_.load(std::memory_order_relaxed) == old) {
+        parent->left_.store(child, std::memory_order_release);
+    }
+    else {
+        parent->right_.store(child, std::memory_order_release);
+    }
+}
+
+/**
+* Returns true if child hangs from parent (or from the root pointer).
+* Only stable while the caller holds parent.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool ConcurrentAVLTree<Key, Value, Compare, Alloc>::isChild(NodeType* parent, NodeType* child) const
+{
+    if (parent == NULL) {
+        return root_.load(std::memory_order_relaxed) == child;
+    }
+    return parent->left_.load(std::memory_order_relaxed) == child || parent->right_.load(std::memory_order_relaxed) == child;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+int ConcurrentAVLTree<Key, Value, Compare, Alloc>::height(NodeType* node)
+{
+    return node == NULL ? 0 : node->height_.load(std::memory_order_relaxed);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Alloc>::updateHeight(NodeType* node)
+{
+    int l = height(node->left_.load(std::memory_order_relaxed));
+    int r = height(node->right_.load(std::memory_order_relaxed));
+    node->height_.store((l > r ? l : r) + 1, std::memory_order_relaxed);
+}
+
+/**
+* Rotates node's right child above it and returns that child. The caller
+* has locked node's parent, node and the child.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename ConcurrentAVLTree<Key, Value, Compare, Alloc>::NodeType*
+ConcurrentAVLTree<Key, Value, Compare, Alloc>::rotateLeft(NodeType* node)
+{
+    NodeType* parent = node->parent_.load(std::memory_order_relaxed);
+    NodeType* pivot = node->right_.load(std::memory_order_relaxed);
+    NodeType* middle = pivot->left_.load(std::memory_order_relaxed);
+    node->right_.store(middle, std::memory_order_release);
+    if (middle != NULL) {
+        middle->parent_.store(node, std::memory_order_release);
+    }
+    pivot->left_.store(node, std::memory_order_release);
+    node->parent_.store(pivot, std::memory_order_release);
+    pivot->parent_.store(parent, std::memory_order_release);
+    setChild(parent, node, pivot);
+    updateHeight(node);
+    updateHeight(pivot);
+    return pivot;
+}
+
+/**
+* Mirror image of rotateLeft.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename ConcurrentAVLTree<Key, Value, Compare, Alloc>::NodeType*
+ConcurrentAVLTree<Key, Value, Compare, Alloc>::rotateRight(NodeType* node)
+{
+    NodeType* parent = node->parent_.load(std::memory_order_relaxed);
+    NodeType* pivot = node->left_.load(std::memory_order_relaxed);
+    NodeType* middle = pivot->right_.load(std::memory_order_relaxed);
+    node->left_.store(middle, std::memory_order_release);
+    if (middle != NULL) {
+        middle->parent_.store(node, std::memory_order_release);
+    }
+    pivot->right_.store(node, std::memory_order_release);
+    node->parent_.store(pivot, std::memory_order_release);
+    pivot->parent_.store(parent, std::memory_order_release);
+    setChild(parent, node, pivot);
+    updateHeight(node);
+    updateHeight(pivot);
+    return pivot;
+}
+
+/**
+* Walks up from node fixing heights and rotating where the balance is off.
+* Stops once a subtree ends up as tall as it was before.
+*
+* Each step locks the node it looks at, plus the child and parent of a
+* rotation, and then moves on to the current parent of the node it came
+* from. A walk that meets an unlinked node stops there: the writer that
+* unlinked it locked it later, saw every height this walk had fixed, and
+* walks on from the node that took its place and from its parent.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Alloc>::rebalance(NodeType* node)
+{
+    NodeType* from = NULL;    // the node the walk came up from, NULL at the start
+    while (true) {
+        if (from != NULL) {
+            if (from->version_.load(std::memory_order_acquire) & NodeType::OBSOLETE) {
+                return;
+            }
+            node = from->parent_.load(std::memory_order_acquire);
+        }
+        if (node == NULL) {
+            return;
+        }
+        WriteSet writes;
+        if (!lockNode(writes, node)) {
+            if (from == NULL) {
+                return;
+            }
+            std::this_thread::yield(); //from is being moved to a new parent
+            continue;
+        }
+        if (from != NULL && !isChild(node, from)) {
+            release(writes);
+            continue;
+        }
+        NodeType* l = node->left_.load(std::memory_order_relaxed);
+        NodeType* r = node->right_.load(std::memory_order_relaxed);
+        int diff = height(l) - height(r);
+        if (diff >= -1 && diff <= 1) { //only the height, which readers never look at
+            int before = node->height_.load(std::memory_order_relaxed);
+            updateHeight(node);
+            int after = node->height_.load(std::memory_order_relaxed);
+            release(writes);
+            if (after == before) {
+                return;
+            }
+            from = node;
+            continue;
+        }
+        NodeType* pivot = diff > 1 ? l : r;
+        if (!tryLock(writes, pivot)) {
+            release(writes);
+            std::this_thread::yield();
+            continue;
+        }
+        NodeType* outer = diff > 1 ? pivot->left_.load(std::memory_order_relaxed) : pivot->right_.load(std::memory_order_relaxed);
+        NodeType* inner = diff > 1 ? pivot->right_.load(std::memory_order_relaxed) : pivot->left_.load(std::memory_order_relaxed);
+        if (height(outer) < height(inner)) { //turn the pivot first, then look at node again
+            if (!tryLock(writes, inner)) {
+                release(writes);
+                std::this_thread::yield();
+                continue;
+            }
+            from = diff > 1 ? rotateLeft(pivot) : rotateRight(pivot);
+            publish(writes);
+            continue;
+        }
+        NodeType* parent = node->parent_.load(std::memory_order_acquire);
+        if (!tryLock(writes, parent)) {
+            release(writes);
+            std::this_thread::yield();
+            continue;
+        }
+        if (!isChild(parent, node)) {
+            release(writes);
+            continue;
+        }
+        from = diff > 1 ? rotateRight(node) : rotateLeft(node);
+        publish(writes);
+    }
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename ConcurrentAVLTree<Key, Value, Compare, Alloc>::NodeType*
+ConcurrentAVLTree<Key, Value, Compare, Alloc>::createNode(const Key& key, const Value& value, NodeType* parent)
+{
+    NodeType* node = allocateNode();
+    try {
+        ::new (static_cast<void*>(node)) NodeType(key, value, parent);
+    }
+    catch (...) {
+        deallocateNode(node);
+        throw;
+    }
+    return node;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Alloc>::destroyNode(NodeType* node)
+{
+    node->~NodeType();
+    deallocateNode(node);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+typename ConcurrentAVLTree<Key, Value, Compare, Alloc>::NodeType*
+ConcurrentAVLTree<Key, Value, Compare, Alloc>::allocateNode()
+{
+    std::unique_lock<std::mutex> guard(allocLock_, std::defer_lock);
+    if (!alloc_.concurrent()) {
+        guard.lock();
+    }
+    return alloc_.template allocate<NodeType>();
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Alloc>::deallocateNode(NodeType* node)
+{
+    std::unique_lock<std::mutex> guard(allocLock_, std::defer_lock);
+    if (!alloc_.concurrent()) {
+        guard.lock();
+    }
+    alloc_.template deallocate<NodeType>(node);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void ConcurrentAVLTree<Key, Value, Compare, Alloc>::clearHelper(NodeType* node)
+{
+    if (node == NULL) {
+        return;
+    }
+    clearHelper(node->left_.load(std::memory_order_relaxed));
+    clearHelper(node->right_.load(std::memory_order_relaxed));
+    destroyNode(node);
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,268 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "per-thread-slots.h"
+
+/**
+ * Epoch-based reclamation for nodes unlinked while other threads may
+ * still be reading them.
+ *
+ * Readers wrap each operation in an EpochDomain::Guard, which publishes
+ * the global epoch the thread entered at: one atomic exchange on entry
+ * and one store on exit, both on a cache line only that thread writes.
+ * A writer that unlinks a node hands it to retire(). The node goes on the
+ * calling thread's limbo list for the current epoch. The global epoch
+ * only moves on once every active reader has entered the current one, so
+ * when it has moved on twice since a node was retired, no reader can
+ * still hold that node and the whole list is freed at once.
+ *
+ * Each thread gets one record per domain (see PerThreadSlots). Records
+ * are reused once their thread exits. Until then, collect() frees the old
+ * limbo lists of those records too, so nodes retired by threads that are
+ * gone do not wait for a new thread.
+ */
+class EpochDomain
+{
+public:
+    typedef void (*Deleter)(void* object, void* context);
+
+    EpochDomain();
+    ~EpochDomain();
+
+    // Marks the calling thread as reading for as long as it lives. Guards
+    // nest.
+    class Guard
+    {
+    public:
+        explicit Guard(EpochDomain& domain);
+        ~Guard();
+
+    private:
+        Guard(const Guard&);
+        Guard& operator=(const Guard&);
+
+        void* record_;
+    };
+
+    void retire(void* object, Deleter deleter, void* context);
+    void collect();
+    void drain();
+    std::size_t pendingCount() const;
+    std::size_t freedCount() const;
+    uint64_t epoch() const;
+
+    // Nodes retired by one thread between attempts to advance the epoch.
+    static const std::size_t BATCH = 64;
+
+private:
+    EpochDomain(const EpochDomain&);
+    EpochDomain& operator=(const EpochDomain&);
+
+    struct Retired
+    {
+        void* object;
+        Deleter deleter;
+        void* context;
+    };
+
+    struct Record
+    {
+        std::atomic<uint64_t> active;    // (epoch << 1) | 1 inside a guard, 0 outside
+        unsigned depth;
+        std::size_t sinceCollect;
+        std::vector<Retired> limbo[3];
+        uint64_t limboEpoch[3];
+
+        Record();
+    };
+
+    Record* record();
+    bool tryAdvance();
+    void freeOld(Record& record, uint64_t now);
+    void freeList(std::vector<Retired>& list);
+
+    PerThreadSlots<Record> records_;
+    std::atomic<uint64_t> epoch_;
+    std::atomic<std::size_t> pending_;
+    std::atomic<std::size_t> freed_;
+};
+
+/*
+  ------------------------------------------
+  Begin implementations for EpochDomain.
+  ------------------------------------------
+*/
+
+inline EpochDomain::Record::Record() :
+    active(0),
+    depth(0),
+    sinceCollect(0)
+{
+    for (int i = 0; i < 3; i++) {
+        limboEpoch[i] = 0;
+    }
+}
+
+inline EpochDomain::EpochDomain() :
+    epoch_(0),
+    pending_(0),
+    freed_(0)
+{
+
+}
+
+/**
+* Frees everything still in limbo. No thread may be inside a guard.
+*/
+inline EpochDomain::~EpochDomain()
+{
+    drain();
+}
+
+/**
+* Returns the calling thread's record, taking one the first time.
+*/
+inline EpochDomain::Record* EpochDomain::record()
+{
+    return &records_.local();
+}
+
+/**
+* Enters the current epoch. The exchange is a full barrier, so the entry
+* is visible before the reader loads any node.
+*/
+inline EpochDomain::Guard::Guard(EpochDomain& domain)
+{
+    Record* record = domain.record();
+    record_ = record;
+    if (record->depth++ == 0) {
+        uint64_t now = domain.epoch_.load(std::memory_order_relaxed);
+        record->active.exchange((now << 1) | 1, std::memory_order_seq_cst);
+    }
+}
+
+inline EpochDomain::Guard::~Guard()
+{
+    Record* record = static_cast<Record*>(record_);
+    if (--record->depth == 0) {
+        record->active.store(0, std::memory_order_release);
+    }
+}
+
+/**
+* Hands over an unlinked object; deleter(object, context) runs once no
+* reader can reach it any more. The object must already be unreachable
+* for readers that start from now on.
+*/
+inline void EpochDomain::retire(void* object, Deleter deleter, void* context)
+{
+    Record* record = this->record();
+    uint64_t now = epoch_.load(std::memory_order_acquire);
+    int bucket = (int)(now % 3);
+    if (record->limboEpoch[bucket] != now) { //the list is three epochs old: safe
+        freeList(record->limbo[bucket]);
+        record->limboEpoch[bucket] = now;
+    }
+    Retired retired = { object, deleter, context };
+    record->limbo[bucket].push_back(retired);
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    if (++record->sinceCollect >= BATCH) {
+        collect();
+    }
+}
+
+/**
+* Tries to advance the epoch, then frees the lists that are at least two
+* epochs old: the calling thread's, and those of records whose threads
+* have exited. Such a record is claimed while its lists are freed, so a
+* new thread cannot take it over halfway.
+*/
+inline void EpochDomain::collect()
+{
+    Record* mine = this->record();
+    mine->sinceCollect = 0;
+    tryAdvance();
+    uint64_t now = epoch_.load(std::memory_order_acquire);
+    freeOld(*mine, now);
+    records_.forEachReleased([this, now](Record& record) { freeOld(record, now); });
+}
+
+inline void EpochDomain::freeOld(Record& record, uint64_t now)
+{
+    for (int i = 0; i < 3; i++) {
+        if (!record.limbo[i].empty() && record.limboEpoch[i] + 2 <= now) {
+            freeList(record.limbo[i]);
+        }
+    }
+}
+
+/**
+* Moves the epoch on by one if every thread inside a guard has entered
+* the current epoch.
+*/
+inline bool EpochDomain::tryAdvance()
+{
+    uint64_t now = epoch_.load(std::memory_order_seq_cst);
+    bool behind = false;
+    records_.forEach([now, &behind](Record& record) {
+        uint64_t active = record.active.load(std::memory_order_seq_cst);
+        behind = behind || ((active & 1) && (active >> 1) != now);
+    });
+    return !behind && epoch_.compare_exchange_strong(now, now + 1, std::memory_order_seq_cst);
+}
+
+inline void EpochDomain::freeList(std::vector<Retired>& list)
+{
+    for (std::size_t i = 0; i < list.size(); i++) {
+        list[i].deleter(list[i].object, list[i].context);
+    }
+    pending_.fetch_sub(list.size(), std::memory_order_relaxed);
+    freed_.fetch_add(list.size(), std::memory_order_relaxed);
+    list.clear();
+}
+
+/**
+* Frees every retired object of every thread. Only for quiescent points:
+* no thread may be inside a guard or retiring.
+*/
+inline void EpochDomain::drain()
+{
+    records_.forEach([this](Record& record) {
+        for (int i = 0; i < 3; i++) {
+            freeList(record.limbo[i]);
+        }
+    });
+}
+
+/**
+* Returns the number of objects retired but not freed yet.
+*/
+inline std::size_t EpochDomain::pendingCount() const
+{
+    return pending_.load(std::memory_order_relaxed);
+}
+
+/**
+* Returns the number of objects freed so far, by collection or drain().
+*/
+inline std::size_t EpochDomain::freedCount() const
+{
+    return freed_.load(std::memory_order_relaxed);
+}
+
+inline uint64_t EpochDomain::epoch() const
+{
+    return epoch_.load(std::memory_order_relaxed);
+}
+
+/*
+  ----------------------------------------
+  End implementations for EpochDomain.
+  ----------------------------------------
+*/
+
+#endif
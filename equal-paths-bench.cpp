@@ -0,0 +1,174 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "equal-paths.h"
+#include "leaf-depth.h"
+#include "thread-pool.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+// Keeps results alive so the timed loops are not optimized away.
+static volatile long sink;
+
+/**
+* Links nodes[first, last) into a perfect tree in preorder and returns its
+* root. last - first must be 2^k - 1.
+*/
+Node* buildPerfect(vector<Node>& nodes, size_t first, size_t last)
+{
+    if (first == last) {
+        return nullptr;
+    }
+    size_t half = (last - first - 1) / 2;
+    Node* root = &nodes[first];
+    root->left = buildPerfect(nodes, first + 1, first + 1 + half);
+    root->right = buildPerfect(nodes, first + 1 + half, last);
+    return root;
+}
+
+/**
+* The shape a plain BST takes for keys inserted in random order.
+*/
+Node* buildRandom(vector<Node>& nodes)
+{
+    mt19937 gen(3);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        nodes[i].key = (int)gen();
+    }
+    Node* root = &nodes[0];
+    for (size_t i = 1; i < nodes.size(); i++) {
+        Node* current = root;
+        while (true) {
+            Node*& next = nodes[i].key < current->key ? current->left : current->right;
+            if (next == nullptr) {
+                next = &nodes[i];
+                break;
+            }
+            current = next;
+        }
+    }
+    return root;
+}
+
+/**
+* Runs check on root until 200 ms have passed and prints the time per
+* call and the answer.
+*/
+void timeCheck(const char* name, bool (*check)(Node*), Node* root, size_t n)
+{
+    size_t runs = 0;
+    long answers = 0;
+    Clock::time_point start = Clock::now();
+    Clock::time_point stop;
+    do {
+        answers += check(root);
+        runs++;
+        stop = Clock::now();
+    } while (stop - start < chrono::milliseconds(200));
+    sink = answers;
+    double us = chrono::duration<double, micro>(stop - start).count() / runs;
+    cout << left << setw(44) << name << setw(10) << n << fixed << setprecision(1)
+         << setw(12) << us << " us/call  answer " << (answers != 0) << endl;
+}
+
+void compare(const string& shape, Node* root, size_t n, bool recursiveFits)
+{
+    if (recursiveFits) {
+        timeCheck((shape + ", equalPaths").c_str(), equalPaths, root, n);
+    }
+    else {
+        cout << left << setw(44) << (shape + ", equalPaths") << setw(10) << n << "skipped, recursion would overflow the stack" << endl;
+    }
+    timeCheck((shape + ", equalLeafDepths").c_str(), equalLeafDepths, root, n);
+}
+
+/**
+* A forest of small perfect trees (7 to 31 nodes) checked one by one and
+* with equalPathsBatch, then one large tree checked sequentially and with
+* subtree tasks.
+*/
+void batchBench(size_t trees, Node* large, size_t n)
+{
+    vector<vector<Node> > storage;
+    vector<Node*> roots;
+    for (size_t t = 0; t < trees; t++) {
+        size_t size = ((size_t)8 << (t % 3)) - 1;
+        storage.push_back(vector<Node>(size, Node(0)));
+        roots.push_back(buildPerfect(storage.back(), 0, size));
+    }
+    vector<char> sequential(trees);
+    Clock::time_point start = Clock::now();
+    for (size_t t = 0; t < trees; t++) {
+        sequential[t] = equalLeafDepths(roots[t]);
+    }
+    Clock::time_point stop = Clock::now();
+    cout << left << setw(44) << "Forest, one by one" << setw(10) << trees << fixed << setprecision(1)
+         << setw(12) << chrono::duration<double, nano>(stop - start).count() / trees << " ns/tree" << endl;
+    size_t threadCounts[] = { 1, 4 };
+    for (size_t i = 0; i < 2; i++) {
+        ThreadPool pool(threadCounts[i]);
+        bool* results = new bool[trees];
+        start = Clock::now();
+        equalPathsBatch(roots.data(), trees, results, pool);
+        stop = Clock::now();
+        sink = results[trees - 1];
+        delete[] results;
+        string label = "Forest, equalPathsBatch, " + to_string(threadCounts[i]) + " thread" + (threadCounts[i] > 1 ? "s" : "");
+        cout << left << setw(44) << label << setw(10) << trees << fixed << setprecision(1)
+             << setw(12) << chrono::duration<double, nano>(stop - start).count() / trees << " ns/tree" << endl;
+
+        start = Clock::now();
+        sink = equalLeafDepths(large, pool);
+        stop = Clock::now();
+        label = "Large tree, subtree tasks, " + to_string(threadCounts[i]) + " thread" + (threadCounts[i] > 1 ? "s" : "");
+        cout << left << setw(44) << label << setw(10) << n << fixed << setprecision(1)
+             << setw(12) << chrono::duration<double, micro>(stop - start).count() << " us/call" << endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t levels = argc > 1 ? strtoul(argv[1], NULL, 10) : 20;
+    size_t n = ((size_t)1 << levels) - 1;
+
+    cout << "Equal leaf depths (" << n << " node trees):" << endl;
+    vector<Node> nodes(n, Node(0));
+    Node* perfect = buildPerfect(nodes, 0, n);
+    compare("Perfect", perfect, n, true);
+
+    // The two leftmost leaves go missing, so the very first leaf is one
+    // level up from all the others.
+    Node* parent = perfect;
+    while (parent->left->left != nullptr) {
+        parent = parent->left;
+    }
+    parent->left = nullptr;
+    parent->right = nullptr;
+    compare("Perfect, first leaf short", perfect, n, true);
+
+    vector<Node> full(n, Node(0));
+    Node* balanced = buildPerfect(full, 0, n);
+
+    vector<Node> shuffled(n, Node(0));
+    compare("Random BST shape", buildRandom(shuffled), n, true);
+
+    for (size_t depth = 100000; depth <= 10 * n; depth *= 10) {
+        vector<Node> chain(depth, Node(0));
+        for (size_t i = 0; i + 1 < depth; i++) {
+            chain[i].right = &chain[i + 1];
+        }
+        compare("Chain", &chain[0], depth, depth <= 100000);
+    }
+    cout << endl;
+
+    cout << "Forests (" << thread::hardware_concurrency() << " hardware threads):" << endl;
+    batchBench(1000000, balanced, n);
+    return 0;
+}
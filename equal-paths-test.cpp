@@ -1,6 +1,9 @@
 #include <iostream>
 #include <cstdlib>
+#include <vector>
 #include "equal-paths.h"
+#include "leaf-depth.h"
+#include "thread-pool.h"
 using namespace std;
 
 
@@ -55,6 +58,126 @@ void test5(const char* msg)
   cout << msg << ": " <<   equalPaths(a) << endl;
 }
 
+// Leaves d (depth 2) and f (depth 3) differ, but both subtrees of the
+// root have height 3.
+void test6(const char* msg)
+{
+  Node f(6), e(5, &f), d(4), g(7), c(3, &g, NULL), b(2, &d, &e);
+  Node h(8);
+  g.left = &h;
+  Node root(1, &b, &c);
+  cout << msg << ": " << equalLeafDepths(&root) << endl;
+}
+
+// A chain far deeper than any thread stack has one leaf; a second leaf
+// near the top must be caught without walking the chain.
+void test7(const char* msg)
+{
+  const int depth = 1000000;
+  vector<Node> chain(depth + 1, Node(0));
+  for(int i = 0; i < depth; i++) {
+    chain[i].right = &chain[i + 1];
+  }
+  bool single = equalLeafDepths(&chain[0]);
+  Node extra(-1);
+  chain[1].left = &extra;
+  bool early = !equalLeafDepths(&chain[0]);
+  cout << msg << ": " << (single && early) << endl;
+}
+
+// Links nodes[first, last) into a perfect tree; last - first is 2^k - 1.
+Node* perfect(vector<Node>& nodes, size_t first, size_t last)
+{
+  if(first == last) {
+    return NULL;
+  }
+  size_t half = (last - first - 1) / 2;
+  nodes[first].left = perfect(nodes, first + 1, first + 1 + half);
+  nodes[first].right = perfect(nodes, first + 1 + half, last);
+  return &nodes[first];
+}
+
+// Recursive reference for small trees: every leaf is at the depth of the
+// first one found (leafDepth < 0 until then).
+bool sameLeafDepth(Node* n, int depth, int& leafDepth)
+{
+  if(n == NULL) {
+    return true;
+  }
+  if(n->left == NULL && n->right == NULL) {
+    if(leafDepth < 0) {
+      leafDepth = depth;
+    }
+    return depth == leafDepth;
+  }
+  return sameLeafDepth(n->left, depth + 1, leafDepth) && sameLeafDepth(n->right, depth + 1, leafDepth);
+}
+
+// A forest of small random trees, small perfect ones and two perfect trees
+// too large for one batch task; the batch must agree with the sequential
+// check on every tree, and both with the reference on the small ones.
+void test8(const char* msg)
+{
+  ThreadPool pool(4);
+  vector<vector<Node> > storage;
+  vector<Node*> roots;
+  srand(8);
+  for(int t = 0; t < 3000; t++) {
+    size_t n = (t % 3 == 0) ? ((size_t)1 << (t % 6)) - 1 : 1 + rand() % 40;
+    storage.push_back(vector<Node>(n, Node(0)));
+    vector<Node>& nodes = storage.back();
+    if(t % 3 == 0) {
+      roots.push_back(perfect(nodes, 0, n));
+      continue;
+    }
+    for(size_t i = 1; i < n; i++) { //random BST shape
+      nodes[i].key = rand();
+      Node* current = &nodes[0];
+      while(true) {
+        Node*& next = nodes[i].key < current->key ? current->left : current->right;
+        if(next == NULL) {
+          next = &nodes[i];
+          break;
+        }
+        current = next;
+      }
+    }
+    roots.push_back(&nodes[0]);
+  }
+  for(int big = 0; big < 2; big++) {
+    size_t n = ((size_t)1 << 18) - 1;
+    storage.push_back(vector<Node>(n, Node(0)));
+    Node* root = perfect(storage.back(), 0, n);
+    if(big == 1) { //one leaf turns into a parent
+      Node* last = root;
+      while(last->right != NULL) {
+        last = last->right;
+      }
+      last->right = new Node(0);
+    }
+    roots.push_back(root);
+  }
+  bool* results = new bool[roots.size()];
+  equalPathsBatch(roots.data(), roots.size(), results, pool);
+  bool same = true;
+  size_t equal = 0;
+  for(size_t i = 0; i < roots.size(); i++) {
+    same = same && results[i] == equalLeafDepths(roots[i]);
+    equal += results[i];
+    int leafDepth = -1;
+    same = same && (i >= 3000 || results[i] == sameLeafDepth(roots[i], 0, leafDepth));
+  }
+  same = same && results[roots.size() - 2] && !results[roots.size() - 1] && equal > 1000 && equal < roots.size();
+  same = same && equalLeafDepths(roots[roots.size() - 2], pool) && !equalLeafDepths(roots[roots.size() - 1], pool);
+  delete[] results;
+  Node* last = roots.back();
+  while(last->right != NULL) {
+    last = last->right;
+  }
+  delete last;
+  cout << msg << ": " << same << endl;
+}
+
 int main()
 {
   a = new Node(1);
@@ -67,6 +190,20 @@ int main()
   test3("Test3");
   test4("Test4");
   test5("Test5");
+
+  // The iterative checker agrees on the shapes above
+  setNode(a,1,b,c);
+  setNode(b,2,NULL,d);
+  setNode(c,3,NULL,NULL);
+  setNode(d,4,NULL,NULL);
+  cout << "Iterative Test5: " << equalLeafDepths(a) << endl;
+  setNode(a,1,b,c);
+  setNode(b,2,NULL,NULL);
+  setNode(c,3,NULL,NULL);
+  cout << "Iterative Test3: " << equalLeafDepths(a) << endl;
+  test6("Test6 (leaves at depth 2 and 3, equal subtree heights)");
+  test7("Test7 (a million deep)");
+  test8("Test8 (equalPathsBatch agrees on 3002 trees)");
  
   delete a;
   delete b;
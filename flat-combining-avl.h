@@ -0,0 +1,342 @@
+#ifndef FLAT_COMBINING_AVL_H
+#define FLAT_COMBINING_AVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "avlbst.h"
+
+/**
+ * An AVLTree shared through flat combining. A thread does not queue for
+ * the tree lock. It publishes its operation in a slot and then either
+ * finds it done, or takes the lock and becomes the combiner. The combiner
+ * collects every pending operation and applies all of them in one pass:
+ * the inserts as a single sorted insertBatch, then the removes and the
+ * lookups in key order. Each result goes back through its slot. N
+ * contended operations then cost one lock handover, and the tree stays
+ * hot in one core's cache.
+ *
+ * The operations in one batch all overlapped in time, so any order among
+ * them is a valid linearization. This class uses inserts, then removes,
+ * then lookups.
+ *
+ * A thread starts probing for a free slot at a slot picked from its thread
+ * id. With no more than SLOTS threads it nearly always gets the same slot,
+ * so the slots act per thread without any registration.
+ * Only the combiner touches the tree, so the allocation policy needs no
+ * thread safety.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key>, typename Alloc = HeapNodeAllocator>
+class FlatCombiningAVLTree
+{
+public:
+    typedef AVLTree<Key, Value, Compare, Alloc> TreeType;
+
+    explicit FlatCombiningAVLTree(const Compare& comp = Compare(), const Alloc& alloc = Alloc());
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    void clear();
+
+    std::size_t size() const;
+    bool empty() const;
+
+    // Batches applied and operations in them, for judging how much
+    // combining happens.
+    std::size_t batchCount() const;
+    std::size_t combinedCount() const;
+
+    static const std::size_t SLOTS = 64;
+
+private:
+    FlatCombiningAVLTree(const FlatCombiningAVLTree&);
+    FlatCombiningAVLTree& operator=(const FlatCombiningAVLTree&);
+
+protected:
+    enum Operation { INSERT, REMOVE, FIND };
+    enum State { EMPTY, PENDING, DONE, FAILED };
+
+    // Padded to a cache line: the owner spins on state while the combiner
+    // writes other slots.
+    struct alignas(64) Slot
+    {
+        std::atomic<bool> owned;
+        std::atomic<int> state;
+        Operation op;
+        const Key* key;
+        const Value* value;    // INSERT: the value to store
+        Value* out;            // FIND: where to copy the value, may be NULL
+        bool result;
+
+        Slot() : owned(false), state(EMPTY), op(FIND), key(NULL), value(NULL), out(NULL), result(false) { }
+    };
+
+    Slot* claimSlot() const;
+    bool execute(Slot* slot) const;
+    void combine() const;
+    void applyRemoves() const;
+    void applyFinds() const;
+
+    mutable Slot slots_[SLOTS];
+    mutable std::mutex combineLock_;
+    mutable TreeType tree_;
+    Compare comp_;
+
+    // Only touched by the combiner.
+    mutable std::vector<Slot*> batch_;
+    mutable std::vector<std::pair<Key, Value> > inserts_;
+    mutable std::vector<Slot*> removes_;
+    mutable std::vector<Slot*> finds_;
+    mutable std::size_t batches_;
+    mutable std::size_t combined_;
+};
+
+/*
+  --------------------------------------------------------
+  Begin implementations for the FlatCombiningAVLTree class.
+  --------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare, class Alloc>
+FlatCombiningAVLTree<Key, Value, Compare, Alloc>::FlatCombiningAVLTree(const Compare& comp, const Alloc& alloc) :
+    tree_(comp, alloc),
+    comp_(comp),
+    batches_(0),
+    combined_(0)
+{
+
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void FlatCombiningAVLTree<Key, Value, Compare, Alloc>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Slot* slot = claimSlot();
+    slot->op = INSERT;
+    slot->key = &keyValuePair.first;
+    slot->value = &keyValuePair.second;
+    execute(slot);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void FlatCombiningAVLTree<Key, Value, Compare, Alloc>::remove(const Key& key)
+{
+    Slot* slot = claimSlot();
+    slot->op = REMOVE;
+    slot->key = &key;
+    execute(slot);
+}
+
+/**
+* Copies the value for key into value and returns true if key is present.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool FlatCombiningAVLTree<Key, Value, Compare, Alloc>::find(const Key& key, Value& value) const
+{
+    Slot* slot = claimSlot();
+    slot->op = FIND;
+    slot->key = &key;
+    slot->out = &value;
+    return execute(slot);
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+bool FlatCombiningAVLTree<Key, Value, Compare, Alloc>::contains(const Key& key) const
+{
+    Slot* slot = claimSlot();
+    slot->op = FIND;
+    slot->key = &key;
+    slot->out = NULL;
+    return execute(slot);
+}
+
+/**
+* Empties the tree. Waits for the combiner like any batch would.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void FlatCombiningAVLTree<Key, Value, Compare, Alloc>::clear()
+{
+    std::lock_guard<std::mutex> guard(combineLock_);
+    tree_.clear();
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+std::size_t FlatCombiningAVLTree<Key, Value, Compare, Alloc>::size() const
+{
+    std::lock_guard<std::mutex> guard(combineLock_);
+    return tree_.size();
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+bool FlatCombiningAVLTree<Key, Value, Compare, Alloc>::empty() const
+{
+    return size() == 0;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+std::size_t FlatCombiningAVLTree<Key, Value, Compare, Alloc>::batchCount() const
+{
+    std::lock_guard<std::mutex> guard(combineLock_);
+    return batches_;
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+std::size_t FlatCombiningAVLTree<Key, Value, Compare, Alloc>::combinedCount() const
+{
+    std::lock_guard<std::mutex> guard(combineLock_);
+    return combined_;
+}
+
+/**
+* Claims a free slot, starting at the calling thread's home slot.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+typename FlatCombiningAVLTree<Key, Value, Compare, Alloc>::Slot* FlatCombiningAVLTree<Key, Value, Compare, Alloc>::claimSlot() const
+{
+    static thread_local std::size_t home = std::hash<std::thread::id>()(std::this_thread::get_id()) % SLOTS;
+    for (std::size_t i = home; ; i = (i + 1) % SLOTS) {
+        Slot& slot = slots_[i];
+        bool expected = false;
+        if (!slot.owned.load(std::memory_order_relaxed) &&
+            slot.owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            home = i;
+            return &slot;
+        }
+        if (i == (home + SLOTS - 1) % SLOTS) { //every slot taken
+            std::this_thread::yield();
+        }
+    }
+}
+
+/**
+* Publishes the operation in slot and waits for a combiner, becoming one
+* whenever the lock is free. Returns the operation's result and gives the
+* slot back.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+bool FlatCombiningAVLTree<Key, Value, Compare, Alloc>::execute(Slot* slot) const
+{
+    slot->state.store(PENDING, std::memory_order_release);
+    int state;
+    while ((state = slot->state.load(std::memory_order_acquire)) == PENDING) {
+        if (combineLock_.try_lock()) {
+            try {
+                combine();
+            }
+            catch (...) {
+                combineLock_.unlock();
+                slot->state.store(EMPTY, std::memory_order_relaxed);
+                slot->owned.store(false, std::memory_order_release);
+                throw;
+            }
+            combineLock_.unlock();
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+    bool result = slot->result;
+    slot->state.store(EMPTY, std::memory_order_relaxed);
+    slot->owned.store(false, std::memory_order_release);
+    if (state == FAILED) {
+        throw std::runtime_error("FlatCombiningAVLTree: the batch holding this operation failed");
+    }
+    return result;
+}
+
+/**
+* Applies every pending operation. Runs under combineLock_. If the tree
+* throws, every operation of the batch is failed, since the batch is not
+* applied atomically.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void FlatCombiningAVLTree<Key, Value, Compare, Alloc>::combine() const
+{
+    batch_.clear();
+    inserts_.clear();
+    removes_.clear();
+    finds_.clear();
+    for (std::size_t i = 0; i < SLOTS; i++) {
+        Slot& slot = slots_[i];
+        if (slot.state.load(std::memory_order_acquire) != PENDING) {
+            continue;
+        }
+        batch_.push_back(&slot);
+        if (slot.op == INSERT) {
+            inserts_.push_back(std::pair<Key, Value>(*slot.key, *slot.value));
+        }
+        else if (slot.op == REMOVE) {
+            removes_.push_back(&slot);
+        }
+        else {
+            finds_.push_back(&slot);
+        }
+    }
+    try {
+        if (inserts_.size() == 1) { //uncontended: skip the batch copy and sort
+            tree_.insert(inserts_[0]);
+        }
+        else if (!inserts_.empty()) {
+            tree_.insertBatch(inserts_.begin(), inserts_.end());
+        }
+        applyRemoves();
+        applyFinds();
+    }
+    catch (...) {
+        for (std::size_t i = 0; i < batch_.size(); i++) {
+            batch_[i]->state.store(FAILED, std::memory_order_release);
+        }
+        throw;
+    }
+    batches_++;
+    combined_ += batch_.size();
+    for (std::size_t i = 0; i < batch_.size(); i++) {
+        batch_[i]->state.store(DONE, std::memory_order_release);
+    }
+}
+
+/**
+* Removes the batch's keys in key order, so that consecutive removes walk
+* paths that are still cached.
+*/
+template<class Key, class Value, class Compare, class Alloc>
+void FlatCombiningAVLTree<Key, Value, Compare, Alloc>::applyRemoves() const
+{
+    const Compare& comp = comp_;
+    std::sort(removes_.begin(), removes_.end(),
+        [&comp](const Slot* a, const Slot* b) { return comp(*a->key, *b->key); });
+    for (std::size_t i = 0; i < removes_.size(); i++) {
+        tree_.remove(*removes_[i]->key);
+    }
+}
+
+template<class Key, class Value, class Compare, class Alloc>
+void FlatCombiningAVLTree<Key, Value, Compare, Alloc>::applyFinds() const
+{
+    const Compare& comp = comp_;
+    std::sort(finds_.begin(), finds_.end(),
+        [&comp](const Slot* a, const Slot* b) { return comp(*a->key, *b->key); });
+    for (std::size_t i = 0; i < finds_.size(); i++) {
+        Slot* slot = finds_[i];
+        typename TreeType::iterator it = tree_.find(*slot->key);
+        slot->result = it != tree_.end();
+        if (slot->result && slot->out != NULL) {
+            *slot->out = it->second;
+        }
+    }
+}
+
+/*
+  ------------------------------------------------------
+  End implementations for the FlatCombiningAVLTree class.
+  ------------------------------------------------------
+*/
+
+#endif
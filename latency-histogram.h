@@ -0,0 +1,454 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "per-thread-slots.h"
+
+/**
+ * A latency histogram in the style of HdrHistogram. Values are bucketed by
+ * their leading bit and the SUB_BITS bits after it, so every bucket is at
+ * most 1/32 of its values wide. Any percentile is then accurate to about
+ * 3%, whatever the range. Values below 32 get a bucket each. Values of
+ * 2^MAX_MAGNITUDE and up (about 18 minutes in ns) share the top bucket,
+ * but max() stays exact.
+ *
+ * Recording is a few bit operations and one increment. A histogram is
+ * plain data for one thread; LatencyRecorder below spreads recording over
+ * threads and merges into one of these on demand.
+ */
+class LatencyHistogram
+{
+public:
+    static const int SUB_BITS = 5;
+    static const std::size_t SUB_BUCKETS = std::size_t(1) << SUB_BITS;
+    static const int MAX_MAGNITUDE = 40;
+    static const std::size_t BUCKETS = (MAX_MAGNITUDE - SUB_BITS + 1) * SUB_BUCKETS;
+
+    LatencyHistogram();
+
+    void record(uint64_t value);
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    uint64_t count() const;
+    uint64_t max() const;
+    double mean() const;
+    uint64_t percentile(double percent) const;
+
+    static std::size_t bucketOf(uint64_t value);
+    static uint64_t bucketTop(std::size_t bucket);
+
+private:
+    friend class LatencyRecorder;
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_;
+    uint64_t total_;
+    uint64_t max_;
+};
+
+/**
+ * Records latencies for a fixed number of operation kinds from any number
+ * of threads.
+ *
+ * Each thread records into its own shard, so recording never writes a
+ * line another thread writes. The shard counters are atomics, but only
+ * their owner writes them, with a relaxed load and store and no
+ * read-modify-write. snapshot() adds up all shards while recording goes
+ * on; the result is a consistent-enough picture, not an atomic one.
+ *
+ * Shards are PerThreadSlots. A thread takes one on its first record(); it
+ * goes back to the recorder when the thread exits, keeping its counts for
+ * the next thread that takes it.
+ */
+class LatencyRecorder
+{
+public:
+    explicit LatencyRecorder(std::size_t kinds);
+
+    void record(std::size_t kind, uint64_t nanoseconds);
+    LatencyHistogram snapshot(std::size_t kind) const;
+    void reset();
+    std::size_t kinds() const;
+
+private:
+    LatencyRecorder(const LatencyRecorder&);
+    LatencyRecorder& operator=(const LatencyRecorder&);
+
+    // Per kind: BUCKETS counts, then count, total and max.
+    static const std::size_t STRIDE = LatencyHistogram::BUCKETS + 3;
+
+    struct Shard
+    {
+        std::unique_ptr<std::atomic<uint64_t>[]> cells;
+
+        explicit Shard(std::size_t kinds);
+    };
+
+    std::size_t kinds_;
+    PerThreadSlots<Shard> shards_;
+};
+
+// Latency percentiles of one operation kind, in ns.
+struct LatencySummary
+{
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+/**
+ * Wraps a tree and times its insert, remove and find calls into a
+ * LatencyRecorder, one histogram per operation. Each call costs two clock
+ * reads and one record() on top of the tree's own work. The wrapped tree
+ * is shared as safely as the tree itself: a ConcurrentAVLTree can be
+ * timed from many threads, a plain AVLTree only from one.
+ */
+template<typename Tree>
+class TimedTree
+{
+public:
+    enum Operation { INSERT, REMOVE, FIND, OPERATIONS };
+
+    template<typename... Args>
+    explicit TimedTree(Args&&... args);
+
+    template<typename... Args>
+    decltype(auto) insert(Args&&... args);
+    template<typename... Args>
+    decltype(auto) remove(Args&&... args);
+    template<typename... Args>
+    decltype(auto) find(Args&&... args);
+    template<typename... Args>
+    decltype(auto) find(Args&&... args) const;
+
+    LatencySummary latency(Operation op) const;
+    LatencyHistogram histogram(Operation op) const;
+    void resetLatency();
+
+    Tree& tree();
+    const Tree& tree() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // Times call and records it under op, also when call throws.
+    template<typename F>
+    decltype(auto) timed(Operation op, F&& call) const;
+
+    Tree tree_;
+    mutable LatencyRecorder recorder_;
+};
+
+/*
+  ------------------------------------------
+  Begin implementations for LatencyHistogram.
+  ------------------------------------------
+*/
+
+inline LatencyHistogram::LatencyHistogram() :
+    counts_(BUCKETS, 0),
+    count_(0),
+    total_(0),
+    max_(0)
+{
+
+}
+
+/**
+* Values below SUB_BUCKETS map to themselves. Above that, a value whose
+* leading bit is m lands in group m - SUB_BITS, at the offset given by its
+* top SUB_BITS + 1 bits.
+*/
+inline std::size_t LatencyHistogram::bucketOf(uint64_t value)
+{
+    if (value < SUB_BUCKETS) {
+        return (std::size_t)value;
+    }
+    int magnitude = 63 - __builtin_clzll(value);
+    if (magnitude >= MAX_MAGNITUDE) {
+        return BUCKETS - 1;
+    }
+    int shift = magnitude - SUB_BITS;
+    return (std::size_t)shift * SUB_BUCKETS + (std::size_t)(value >> shift);
+}
+
+/**
+* Returns the largest value that lands in bucket.
+*/
+inline uint64_t LatencyHistogram::bucketTop(std::size_t bucket)
+{
+    if (bucket < 2 * SUB_BUCKETS) {
+        return bucket;
+    }
+    std::size_t shift = bucket / SUB_BUCKETS - 1;
+    uint64_t sub = bucket - shift * SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+inline void LatencyHistogram::record(uint64_t value)
+{
+    counts_[bucketOf(value)]++;
+    count_++;
+    total_ += value;
+    max_ = std::max(max_, value);
+}
+
+inline void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (std::size_t i = 0; i < BUCKETS; i++) {
+        counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+    total_ += other.total_;
+    max_ = std::max(max_, other.max_);
+}
+
+inline void LatencyHistogram::reset()
+{
+    std::fill(counts_.begin(), counts_.end(), 0);
+    count_ = 0;
+    total_ = 0;
+    max_ = 0;
+}
+
+inline uint64_t LatencyHistogram::count() const
+{
+    return count_;
+}
+
+inline uint64_t LatencyHistogram::max() const
+{
+    return max_;
+}
+
+inline double LatencyHistogram::mean() const
+{
+    return count_ == 0 ? 0.0 : (double)total_ / count_;
+}
+
+/**
+* Returns a value that at least percent (0 to 100) of the recorded values
+* do not exceed: the top of the bucket holding that rank, capped at max().
+* Returns 0 when nothing was recorded.
+*/
+inline uint64_t LatencyHistogram::percentile(double percent) const
+{
+    if (count_ == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(percent / 100.0 * count_ + 0.5);
+    rank = std::min(std::max<uint64_t>(rank, 1), count_);
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < BUCKETS; i++) {
+        seen += counts_[i];
+        if (seen >= rank) {
+            return std::min(bucketTop(i), max_);
+        }
+    }
+    return max_;
+}
+
+/*
+  ----------------------------------------
+  End implementations for LatencyHistogram.
+  ----------------------------------------
+*/
+
+/*
+  ------------------------------------------
+  Begin implementations for LatencyRecorder.
+  ------------------------------------------
+*/
+
+inline LatencyRecorder::Shard::Shard(std::size_t kinds) :
+    cells(new std::atomic<uint64_t>[kinds * STRIDE])
+{
+    for (std::size_t i = 0; i < kinds * STRIDE; i++) {
+        cells[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+inline LatencyRecorder::LatencyRecorder(std::size_t kinds) :
+    kinds_(kinds),
+    shards_(kinds)
+{
+
+}
+
+/**
+* Adds one value for kind. Only the calling thread writes its shard, so
+* plain load and store pairs are enough.
+*/
+inline void LatencyRecorder::record(std::size_t kind, uint64_t nanoseconds)
+{
+    std::atomic<uint64_t>* cells = shards_.local().cells.get() + kind * STRIDE;
+    std::atomic<uint64_t>& bucket = cells[LatencyHistogram::bucketOf(nanoseconds)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic<uint64_t>* totals = cells + LatencyHistogram::BUCKETS;
+    totals[0].store(totals[0].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    totals[1].store(totals[1].load(std::memory_order_relaxed) + nanoseconds, std::memory_order_relaxed);
+    if (nanoseconds > totals[2].load(std::memory_order_relaxed)) {
+        totals[2].store(nanoseconds, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Merges every thread's counts for kind into one histogram.
+*/
+inline LatencyHistogram LatencyRecorder::snapshot(std::size_t kind) const
+{
+    LatencyHistogram merged;
+    shards_.forEach([kind, &merged](Shard& shard) {
+        const std::atomic<uint64_t>* cells = shard.cells.get() + kind * STRIDE;
+        for (std::size_t i = 0; i < LatencyHistogram::BUCKETS; i++) {
+            merged.counts_[i] += cells[i].load(std::memory_order_relaxed);
+        }
+        const std::atomic<uint64_t>* totals = cells + LatencyHistogram::BUCKETS;
+        merged.count_ += totals[0].load(std::memory_order_relaxed);
+        merged.total_ += totals[1].load(std::memory_order_relaxed);
+        merged.max_ = std::max(merged.max_, totals[2].load(std::memory_order_relaxed));
+    });
+    return merged;
+}
+
+/**
+* Zeroes every shard. Values recorded at the same time may be lost, or
+* survive half counted.
+*/
+inline void LatencyRecorder::reset()
+{
+    std::size_t cells = kinds_ * STRIDE;
+    shards_.forEach([cells](Shard& shard) {
+        for (std::size_t i = 0; i < cells; i++) {
+            shard.cells[i].store(0, std::memory_order_relaxed);
+        }
+    });
+}
+
+inline std::size_t LatencyRecorder::kinds() const
+{
+    return kinds_;
+}
+
+/*
+  ----------------------------------------
+  End implementations for LatencyRecorder.
+  ----------------------------------------
+*/
+
+/*
+  ------------------------------------------
+  Begin implementations for TimedTree.
+  ------------------------------------------
+*/
+
+/**
+* Builds the wrapped tree from args.
+*/
+template<typename Tree>
+template<typename... Args>
+TimedTree<Tree>::TimedTree(Args&&... args) :
+    tree_(std::forward<Args>(args)...),
+    recorder_(OPERATIONS)
+{
+
+}
+
+template<typename Tree>
+template<typename F>
+decltype(auto) TimedTree<Tree>::timed(Operation op, F&& call) const
+{
+    struct Timer
+    {
+        LatencyRecorder& recorder;
+        Operation op;
+        Clock::time_point start;
+
+        ~Timer()
+        {
+            recorder.record(op, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        }
+    } timer = { recorder_, op, Clock::now() };
+    return call();
+}
+
+template<typename Tree>
+template<typename... Args>
+decltype(auto) TimedTree<Tree>::insert(Args&&... args)
+{
+    return timed(INSERT, [&]() -> decltype(auto) { return tree_.insert(std::forward<Args>(args)...); });
+}
+
+template<typename Tree>
+template<typename... Args>
+decltype(auto) TimedTree<Tree>::remove(Args&&... args)
+{
+    return timed(REMOVE, [&]() -> decltype(auto) { return tree_.remove(std::forward<Args>(args)...); });
+}
+
+template<typename Tree>
+template<typename... Args>
+decltype(auto) TimedTree<Tree>::find(Args&&... args)
+{
+    return timed(FIND, [&]() -> decltype(auto) { return tree_.find(std::forward<Args>(args)...); });
+}
+
+template<typename Tree>
+template<typename... Args>
+decltype(auto) TimedTree<Tree>::find(Args&&... args) const
+{
+    return timed(FIND, [&]() -> decltype(auto) { return tree_.find(std::forward<Args>(args)...); });
+}
+
+/**
+* Returns the p50, p99, p99.9 and max latency of op across all threads.
+*/
+template<typename Tree>
+LatencySummary TimedTree<Tree>::latency(Operation op) const
+{
+    LatencyHistogram merged = recorder_.snapshot(op);
+    LatencySummary summary = { merged.count(), merged.percentile(50), merged.percentile(99),
+                               merged.percentile(99.9), merged.max() };
+    return summary;
+}
+
+template<typename Tree>
+LatencyHistogram TimedTree<Tree>::histogram(Operation op) const
+{
+    return recorder_.snapshot(op);
+}
+
+template<typename Tree>
+void TimedTree<Tree>::resetLatency()
+{
+    recorder_.reset();
+}
+
+template<typename Tree>
+Tree& TimedTree<Tree>::tree()
+{
+    return tree_;
+}
+
+template<typename Tree>
+const Tree& TimedTree<Tree>::tree() const
+{
+    return tree_;
+}
+
+/*
+  ----------------------------------------
+  End implementations for TimedTree.
+  ----------------------------------------
+*/
+
+#endif
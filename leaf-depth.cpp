@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "leaf-depth.h"
+using namespace std;
+
+// Right subtrees still to walk: each root followed by its depth, in one
+// flat vector. A vector of pairs, or two vectors, measured slower on the
+// push and pop that every inner node with two children does.
+class Pending {
+public:
+	Pending()
+	{
+		slots_.reserve(128);
+	}
+	bool empty() const
+	{
+		return slots_.empty();
+	}
+	void push(Node* node, size_t depth)
+	{
+		slots_.push_back(reinterpret_cast<uintptr_t>(node));
+		slots_.push_back(depth);
+	}
+	void pop(Node*& node, size_t& depth)
+	{
+		depth = slots_.back();
+		slots_.pop_back();
+		node = reinterpret_cast<Node*>(slots_.back());
+		slots_.pop_back();
+	}
+	void clear()
+	{
+		slots_.clear();
+	}
+
+private:
+	vector<uintptr_t> slots_;
+};
+
+static inline bool leafOrNull(Node * node)
+{
+	return node == nullptr || (node->left == nullptr && node->right == nullptr);
+}
+
+bool equalLeafDepths(Node * root)
+{
+	if (root == nullptr) {
+		return true;
+	}
+	Pending pending;
+	size_t leafDepth = SIZE_MAX; //until the first leaf sets it
+	Node* node = root;
+	size_t depth = 0;
+	while (true) {
+		if (node->left == nullptr && node->right == nullptr) {
+			if (leafDepth == SIZE_MAX) {
+				leafDepth = depth;
+			}
+			else if (depth != leafDepth) {
+				return false;
+			}
+		}
+		else if (depth + 1 == leafDepth) { //only leaves may hang below: check them here
+			if (!leafOrNull(node->left) || !leafOrNull(node->right)) {
+				return false;
+			}
+		}
+		else if (depth >= leafDepth) { //every leaf below is too deep
+			return false;
+		}
+		else { //go down, left first
+			if (node->left == nullptr) {
+				node = node->right;
+			}
+			else {
+				if (node->right != nullptr) {
+					pending.push(node->right, depth + 1);
+				}
+				node = node->left;
+			}
+			depth++;
+			continue;
+		}
+		if (pending.empty()) {
+			return true;
+		}
+		pending.pop(node, depth);
+	}
+}
+
+// Trees in one batch task, and nodes a batch task walks in one tree before
+// handing it to the parallel check.
+static const size_t BATCH_GRAIN = 256;
+static const size_t TREE_BUDGET = 1 << 16;
+
+// Nodes walked between looks at the stop flag.
+static const size_t STOP_CHECK = 4096;
+
+// Shallowest and deepest leaf of a subtree, in edges below its root.
+struct DepthRange {
+	size_t shallowest;
+	size_t deepest;
+};
+
+/**
+ * Fills range for the subtree at root (not null), using pending as the
+ * stack so that batches reuse one. Gives up and returns false after
+ * budget nodes. Stops early once the range holds two depths
+ * or stop is raised; then range is only a bound, but the answer for the
+ * whole tree is already known to be false.
+ */
+static bool walkRange(Node * root, size_t budget, const atomic<bool> * stop, DepthRange& range,
+                      Pending& pending)
+{
+	range.shallowest = SIZE_MAX;
+	range.deepest = 0;
+	pending.clear();
+	Node* node = root;
+	size_t depth = 0;
+	size_t visited = 0;
+	while (true) {
+		if (++visited > budget) {
+			return false;
+		}
+		if (stop != nullptr && visited % STOP_CHECK == 0 && stop->load(memory_order_relaxed)) {
+			return true;
+		}
+		if (node->left == nullptr && node->right == nullptr) {
+			range.shallowest = min(range.shallowest, depth);
+			range.deepest = max(range.deepest, depth);
+			if (range.shallowest != range.deepest) {
+				return true;
+			}
+		}
+		else if (depth + 1 == range.shallowest) { //only leaves may hang below: check them here
+			if (!leafOrNull(node->left) || !leafOrNull(node->right)) {
+				range.deepest = depth + 2;
+				return true;
+			}
+			visited += (node->left != nullptr) + (node->right != nullptr);
+		}
+		else if (depth >= range.shallowest) { //every leaf below is deeper
+			range.deepest = depth + 1;
+			return true;
+		}
+		else {
+			if (node->left == nullptr) {
+				node = node->right;
+			}
+			else {
+				if (node->right != nullptr) {
+					pending.push(node->right, depth + 1);
+				}
+				node = node->left;
+			}
+			depth++;
+			continue;
+		}
+		if (pending.empty()) {
+			return true;
+		}
+		pending.pop(node, depth);
+	}
+}
+
+/**
+ * The range of the subtree at node (not null). The top cutoff levels fork
+ * on pool, the rest is walked sequentially.
+ */
+static DepthRange parallelRange(Node * node, int cutoff, ThreadPool& pool, atomic<bool>& stop)
+{
+	DepthRange range;
+	if (cutoff == 0 || node->left == nullptr || node->right == nullptr) {
+		if (cutoff == 0 || (node->left == nullptr && node->right == nullptr)) {
+			Pending pending;
+			walkRange(node, SIZE_MAX, &stop, range, pending);
+		}
+		else { //one child: nothing to fork here
+			range = parallelRange(node->left != nullptr ? node->left : node->right, cutoff - 1, pool, stop);
+			range.shallowest++;
+			range.deepest++;
+		}
+	}
+	else {
+		DepthRange left, right;
+		pool.invoke([&] { left = parallelRange(node->left, cutoff - 1, pool, stop); },
+		            [&] { right = parallelRange(node->right, cutoff - 1, pool, stop); });
+		range.shallowest = min(left.shallowest, right.shallowest) + 1;
+		range.deepest = max(left.deepest, right.deepest) + 1;
+	}
+	if (range.shallowest != range.deepest) {
+		stop.store(true, memory_order_relaxed);
+	}
+	return range;
+}
+
+bool equalLeafDepths(Node * root, ThreadPool& pool)
+{
+	if (root == nullptr || pool.size() < 2) {
+		return equalLeafDepths(root);
+	}
+	int cutoff = 2; //four tasks per thread even out uneven subtrees
+	for (size_t n = 1; n < pool.size(); n *= 2) {
+		cutoff++;
+	}
+	atomic<bool> stop(false);
+	DepthRange range = parallelRange(root, cutoff, pool, stop);
+	return !stop.load() && range.shallowest == range.deepest;
+}
+
+static void batchRange(Node * const * roots, size_t first, size_t last, bool * results, ThreadPool& pool)
+{
+	if (last - first > BATCH_GRAIN) {
+		size_t middle = first + (last - first) / 2;
+		pool.invoke([&] { batchRange(roots, first, middle, results, pool); },
+		            [&] { batchRange(roots, middle, last, results, pool); });
+		return;
+	}
+	Pending pending;
+	for (size_t i = first; i < last; i++) {
+		DepthRange range;
+		if (roots[i] == nullptr) {
+			results[i] = true;
+		}
+		else if (walkRange(roots[i], TREE_BUDGET, nullptr, range, pending)) {
+			results[i] = range.shallowest == range.deepest;
+		}
+		else { //a huge tree: split it up
+			results[i] = equalLeafDepths(roots[i], pool);
+		}
+	}
+}
+
+void equalPathsBatch(Node * const * roots, size_t count, bool * results, ThreadPool& pool)
+{
+	if (count > 0) {
+		batchRange(roots, 0, count, results, pool);
+	}
+}
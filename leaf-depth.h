@@ -0,0 +1,50 @@
+#ifndef LEAF_DEPTH_H
+#define LEAF_DEPTH_H
+#include <cstddef>
+#include "equal-paths.h"
+#include "thread-pool.h"
+
+/**
+ * @brief Returns true if every leaf is at the same depth, like equalPaths,
+ *        but in one pass and without recursion.
+ *
+ *        The walk is depth first on an explicit stack kept on the heap, so
+ *        trees deeper than the thread stack are fine. It stops at the first
+ *        leaf whose depth differs from the first leaf seen, and at any inner
+ *        node already as deep as that leaf, since every leaf below it must
+ *        be deeper. Nodes one level above that depth check their children
+ *        in place rather than walking down to them.
+ *
+ * @param root Pointer to the root of the tree to check for equal paths
+ */
+bool equalLeafDepths(Node * root);
+
+/**
+ * @brief equalLeafDepths for one large tree, with the subtrees below the
+ *        top few levels checked in parallel on pool.
+ *
+ *        Each subtree task reports the shallowest and deepest leaf below it,
+ *        and the ranges are merged on the way up. As soon as any range
+ *        shows two depths, the other tasks stop early.
+ *
+ * @param root Pointer to the root of the tree to check for equal paths
+ * @param pool Threads to run the subtree tasks on
+ */
+bool equalLeafDepths(Node * root, ThreadPool& pool);
+
+/**
+ * @brief Checks a whole forest: results[i] = equalLeafDepths(roots[i]).
+ *
+ *        Runs of trees are spread over pool. Any tree still unfinished after
+ *        a fixed number of nodes is handed to the parallel single-tree check
+ *        instead, so a few huge trees in a batch of small ones do not hold
+ *        up one thread.
+ *
+ * @param roots Pointers to the roots of count trees
+ * @param count Number of trees
+ * @param results Receives count answers, in the order of roots
+ * @param pool Threads to run on
+ */
+void equalPathsBatch(Node * const * roots, std::size_t count, bool * results, ThreadPool& pool);
+
+#endif
@@ -0,0 +1,570 @@
+#ifndef LOCK_FREE_BST_H
+#define LOCK_FREE_BST_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "epoch.h"
+
+/**
+ * A node of LockFreeBST. Internal nodes only route searches; the items
+ * live in leaves (LockFreeLeaf). The three sentinel keys that sit above
+ * every real key have inf_ set to INF1, INF2 or INF3 and construct no Key
+ * at all, so Key needs no default constructor.
+ *
+ * Child pointers carry two mark bits in their low bits: FLAG marks the
+ * edge to a leaf that is being removed, TAG marks the edge to its sibling
+ * while the parent is unlinked. A marked edge never changes again.
+ */
+template <typename Key, typename Value>
+class LockFreeNode
+{
+public:
+    // Rank of a sentinel key; REAL for nodes with a Key.
+    enum Sentinel { REAL = 0, INF1, INF2, INF3 };
+
+    explicit LockFreeNode(Sentinel inf, bool leaf = false);
+    LockFreeNode(const Key& key, bool leaf = false);
+    ~LockFreeNode();
+
+    const Key& getKey() const;
+
+    static const uintptr_t FLAG = 1;
+    static const uintptr_t TAG = 2;
+
+    std::atomic<uintptr_t> left_;
+    std::atomic<uintptr_t> right_;
+    uint8_t inf_;
+    bool leaf_;
+
+private:
+    LockFreeNode(const LockFreeNode&);
+    LockFreeNode& operator=(const LockFreeNode&);
+
+    alignas(Key) unsigned char key_[sizeof(Key)];
+};
+
+template <typename Key, typename Value>
+class LockFreeLeaf : public LockFreeNode<Key, Value>
+{
+public:
+    explicit LockFreeLeaf(typename LockFreeNode<Key, Value>::Sentinel inf);
+    LockFreeLeaf(const Key& key, const Value& value);
+    ~LockFreeLeaf();
+
+    const Value& getValue() const;
+
+private:
+    alignas(Value) unsigned char value_[sizeof(Value)];
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the LockFreeNode classes.
+  -------------------------------------------------
+*/
+
+/**
+* A sentinel node.
+*/
+template<class Key, class Value>
+LockFreeNode<Key, Value>::LockFreeNode(Sentinel inf, bool leaf) :
+    left_(0),
+    right_(0),
+    inf_(inf),
+    leaf_(leaf)
+{
+
+}
+
+template<class Key, class Value>
+LockFreeNode<Key, Value>::LockFreeNode(const Key& key, bool leaf) :
+    left_(0),
+    right_(0),
+    inf_(0),
+    leaf_(leaf)
+{
+    ::new (static_cast<void*>(key_)) Key(key);
+}
+
+template<class Key, class Value>
+LockFreeNode<Key, Value>::~LockFreeNode()
+{
+    if (inf_ == REAL) {
+        reinterpret_cast<Key*>(key_)->~Key();
+    }
+}
+
+template<class Key, class Value>
+const Key& LockFreeNode<Key, Value>::getKey() const
+{
+    return *reinterpret_cast<const Key*>(key_);
+}
+
+template<class Key, class Value>
+LockFreeLeaf<Key, Value>::LockFreeLeaf(typename LockFreeNode<Key, Value>::Sentinel inf) :
+    LockFreeNode<Key, Value>(inf, true)
+{
+
+}
+
+template<class Key, class Value>
+LockFreeLeaf<Key, Value>::LockFreeLeaf(const Key& key, const Value& value) :
+    LockFreeNode<Key, Value>(key, true)
+{
+    ::new (static_cast<void*>(value_)) Value(value);
+}
+
+template<class Key, class Value>
+LockFreeLeaf<Key, Value>::~LockFreeLeaf()
+{
+    if (this->inf_ == LockFreeNode<Key, Value>::REAL) {
+        reinterpret_cast<Value*>(value_)->~Value();
+    }
+}
+
+template<class Key, class Value>
+const Value& LockFreeLeaf<Key, Value>::getValue() const
+{
+    return *reinterpret_cast<const Value*>(value_);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the LockFreeNode classes.
+  -----------------------------------------------
+*/
+
+/**
+ * A non-blocking binary search tree after Natarajan and Mittal, "Fast
+ * Concurrent Lock-Free Binary Search Trees" (PPoPP 2014).
+ *
+ * The tree is external: items live in leaves and internal nodes hold
+ * routing keys only. insert swings one edge with a CAS. remove first flags
+ * the edge to its leaf (the point where the remove takes effect), then
+ * tags the sibling edge and unlinks parent and leaf with a CAS on the
+ * edge above them. A thread that runs into a marked edge finishes that
+ * removal itself before it retries, so no thread ever waits on another.
+ *
+ * Nodes come from the global operator new (the pooled allocators are not
+ * thread safe). Every operation runs inside an EpochDomain guard, and
+ * the thread whose CAS unlinks a node retires it to the domain, which
+ * frees it in a batch once every thread has left the epochs that could
+ * still see it.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class LockFreeBST
+{
+public:
+    typedef LockFreeNode<Key, Value> NodeType;
+    typedef LockFreeLeaf<Key, Value> LeafType;
+
+    explicit LockFreeBST(const Compare& comp = Compare());
+    ~LockFreeBST();
+
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+
+    std::size_t size() const;
+    bool empty() const;
+
+    // Frees every retired node at once. No other thread may be inside the tree.
+    void reclaim();
+    std::size_t retiredCount() const;
+
+private:
+    LockFreeBST(const LockFreeBST&);
+    LockFreeBST& operator=(const LockFreeBST&);
+
+protected:
+    // The last untagged edge (ancestor -> successor) and the final edge
+    // (parent -> leaf) on the search path of a key.
+    struct SeekRecord
+    {
+        NodeType* ancestor;
+        NodeType* successor;
+        NodeType* parent;
+        NodeType* leaf;
+    };
+
+    static NodeType* address(uintptr_t edge);
+    static uintptr_t edgeTo(const NodeType* node);
+    bool goesLeft(const Key& key, const NodeType* node) const;
+    bool holds(const NodeType* leaf, const Key& key) const;
+    std::atomic<uintptr_t>& childEdge(NodeType* node, const Key& key) const;
+
+    void seek(const Key& key, SeekRecord& record) const;
+    bool cleanup(const Key& key, const SeekRecord& record);
+    void retireChain(const Key& key, NodeType* successor, NodeType* parent, NodeType* survivor);
+    void retire(NodeType* node);
+    static void destroyNode(NodeType* node);
+    static void freeRetired(void* node, void* context);
+    static void clearHelper(NodeType* node);
+
+    NodeType* root_;    // sentinel R (INF3), its left child is sentinel S (INF2)
+    std::atomic<std::size_t> size_;
+    Compare comp_;
+    mutable EpochDomain epochs_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the LockFreeBST class.
+  ---------------------------------------------
+*/
+
+/**
+* Builds the sentinel frame: R (INF3) with children S (INF2) and leaf
+* INF3; S with the leaves INF1 and INF2. Every real key goes below S
+* to the left.
+*/
+template<class Key, class Value, class Compare>
+LockFreeBST<Key, Value, Compare>::LockFreeBST(const Compare& comp) :
+    root_(new NodeType(NodeType::INF3)),
+    size_(0),
+    comp_(comp)
+{
+    NodeType* s = new NodeType(NodeType::INF2);
+    s->left_.store(edgeTo(new LeafType(NodeType::INF1)), std::memory_order_relaxed);
+    s->right_.store(edgeTo(new LeafType(NodeType::INF2)), std::memory_order_relaxed);
+    root_->left_.store(edgeTo(s), std::memory_order_relaxed);
+    root_->right_.store(edgeTo(new LeafType(NodeType::INF3)), std::memory_order_relaxed);
+}
+
+template<class Key, class Value, class Compare>
+LockFreeBST<Key, Value, Compare>::~LockFreeBST()
+{
+    clearHelper(root_);
+    epochs_.drain();
+}
+
+template<class Key, class Value, class Compare>
+typename LockFreeBST<Key, Value, Compare>::NodeType* LockFreeBST<Key, Value, Compare>::address(uintptr_t edge)
+{
+    return reinterpret_cast<NodeType*>(edge & ~(NodeType::FLAG | NodeType::TAG));
+}
+
+template<class Key, class Value, class Compare>
+uintptr_t LockFreeBST<Key, Value, Compare>::edgeTo(const NodeType* node)
+{
+    return reinterpret_cast<uintptr_t>(node);
+}
+
+/**
+* True if key sorts below the routing key of node (sentinels are above
+* every real key).
+*/
+template<class Key, class Value, class Compare>
+bool LockFreeBST<Key, Value, Compare>::goesLeft(const Key& key, const NodeType* node) const
+{
+    return node->inf_ != NodeType::REAL || comp_(key, node->getKey());
+}
+
+template<class Key, class Value, class Compare>
+bool LockFreeBST<Key, Value, Compare>::holds(const NodeType* leaf, const Key& key) const
+{
+    return leaf->inf_ == NodeType::REAL && !comp_(key, leaf->getKey()) && !comp_(leaf->getKey(), key);
+}
+
+template<class Key, class Value, class Compare>
+std::atomic<uintptr_t>& LockFreeBST<Key, Value, Compare>::childEdge(NodeType* node, const Key& key) const
+{
+    return goesLeft(key, node) ? node->left_ : node->right_;
+}
+
+/**
+* Walks down to the leaf where key is or would be. Besides the leaf and
+* its parent, records the last untagged edge on the way, which is the
+* edge a removal below it has to swing.
+*/
+template<class Key, class Value, class Compare>
+void LockFreeBST<Key, Value, Compare>::seek(const Key& key, SeekRecord& record) const
+{
+    NodeType* s = address(root_->left_.load(std::memory_order_acquire));
+    record.ancestor = root_;
+    record.successor = s;
+    record.parent = s;
+    uintptr_t parentEdge = s->left_.load(std::memory_order_acquire);
+    record.leaf = address(parentEdge);
+    uintptr_t currentEdge = childEdge(record.leaf, key).load(std::memory_order_acquire);
+    NodeType* current = address(currentEdge);
+    while (current != NULL) {
+        if ((parentEdge & NodeType::TAG) == 0) {
+            record.ancestor = record.parent;
+            record.successor = record.leaf;
+        }
+        record.parent = record.leaf;
+        record.leaf = current;
+        parentEdge = currentEdge;
+        currentEdge = childEdge(current, key).load(std::memory_order_acquire);
+        current = address(currentEdge);
+    }
+}
+
+/**
+* Finishes the removal of the leaf below record.parent whose edge is
+* flagged: tags the sibling edge so it cannot change, then points the
+* ancestor's edge at the sibling. Returns true if this call did the
+* unlinking.
+*/
+template<class Key, class Value, class Compare>
+bool LockFreeBST<Key, Value, Compare>::cleanup(const Key& key, const SeekRecord& record)
+{
+    NodeType* parent = record.parent;
+    std::atomic<uintptr_t>& successorEdge = childEdge(record.ancestor, key);
+    bool left = goesLeft(key, parent);
+    std::atomic<uintptr_t>* childPtr = left ? &parent->left_ : &parent->right_;
+    std::atomic<uintptr_t>* siblingPtr = left ? &parent->right_ : &parent->left_;
+    if ((childPtr->load(std::memory_order_acquire) & NodeType::FLAG) == 0) { //the flagged leaf is on the other side
+        siblingPtr = childPtr;
+    }
+    uintptr_t sibling = siblingPtr->fetch_or(NodeType::TAG, std::memory_order_acq_rel) | NodeType::TAG;
+    uintptr_t expected = edgeTo(record.successor);
+    if (!successorEdge.compare_exchange_strong(expected, sibling & ~NodeType::TAG, std::memory_order_acq_rel)) {
+        return false;
+    }
+    retireChain(key, record.successor, parent, address(sibling));
+    return true;
+}
+
+/**
+* Retires what the cleanup CAS cut out: the internal nodes from successor
+* down to parent and, at each of them, the flagged leaf that is not on
+* the way to survivor. All of these edges are marked, so they are stable.
+*/
+template<class Key, class Value, class Compare>
+void LockFreeBST<Key, Value, Compare>::retireChain(const Key& key, NodeType* successor, NodeType* parent, NodeType* survivor)
+{
+    NodeType* node = successor;
+    while (true) {
+        NodeType* l = address(node->left_.load(std::memory_order_acquire));
+        NodeType* r = address(node->right_.load(std::memory_order_acquire));
+        NodeType* next;
+        if (node == parent) {
+            retire(l == survivor ? r : l);
+            retire(node);
+            return;
+        }
+        next = goesLeft(key, node) ? l : r;
+        retire(next == l ? r : l);
+        retire(node);
+        node = next;
+    }
+}
+
+/**
+* Hands an unlinked node to the epoch domain.
+*/
+template<class Key, class Value, class Compare>
+void LockFreeBST<Key, Value, Compare>::retire(NodeType* node)
+{
+    epochs_.retire(node, &freeRetired, NULL);
+}
+
+template<class Key, class Value, class Compare>
+void LockFreeBST<Key, Value, Compare>::freeRetired(void* node, void*)
+{
+    destroyNode(static_cast<NodeType*>(node));
+}
+
+/**
+* Copies the value for key into value and returns true if key is in the
+* tree. Takes no locks and writes nothing shared.
+*/
+template<class Key, class Value, class Compare>
+bool LockFreeBST<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    EpochDomain::Guard guard(epochs_);
+    SeekRecord record;
+    seek(key, record);
+    if (!holds(record.leaf, key)) {
+        return false;
+    }
+    value = static_cast<LeafType*>(record.leaf)->getValue();
+    return true;
+}
+
+template<class Key, class Value, class Compare>
+bool LockFreeBST<Key, Value, Compare>::contains(const Key& key) const
+{
+    EpochDomain::Guard guard(epochs_);
+    SeekRecord record;
+    seek(key, record);
+    return holds(record.leaf, key);
+}
+
+/**
+* Inserts or overwrites a key. A new key replaces the leaf it lands on by
+* a routing node over both leaves; an existing key gets a fresh leaf. If
+* the CAS loses to a removal that marked the edge, that removal is helped
+* along before trying again.
+*/
+template<class Key, class Value, class Compare>
+void LockFreeBST<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    EpochDomain::Guard guard(epochs_);
+    const Key& key = keyValuePair.first;
+    LeafType* fresh = new LeafType(key, keyValuePair.second);
+    NodeType* router = NULL;
+    SeekRecord record;
+    while (true) {
+        seek(key, record);
+        NodeType* leaf = record.leaf;
+        std::atomic<uintptr_t>& edge = childEdge(record.parent, key);
+        uintptr_t expected = edgeTo(leaf);
+        bool replace = holds(leaf, key);
+        NodeType* replacement = fresh;
+        if (!replace) {
+            if (router != NULL) {
+                destroyNode(router);
+            }
+            bool freshLeft = goesLeft(key, leaf);
+            if (!freshLeft) { //the routing key is the larger of the two
+                router = new NodeType(key);
+            }
+            else if (leaf->inf_ != NodeType::REAL) {
+                router = new NodeType(static_cast<typename NodeType::Sentinel>(leaf->inf_));
+            }
+            else {
+                router = new NodeType(leaf->getKey());
+            }
+            router->left_.store(edgeTo(freshLeft ? fresh : leaf), std::memory_order_relaxed);
+            router->right_.store(edgeTo(freshLeft ? leaf : fresh), std::memory_order_relaxed);
+            replacement = router;
+        }
+        if (edge.compare_exchange_strong(expected, edgeTo(replacement), std::memory_order_acq_rel)) {
+            if (replace) {
+                retire(leaf);
+                if (router != NULL) {
+                    destroyNode(router);
+                }
+            }
+            else {
+                size_.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+        if (address(expected) == leaf && (expected & (NodeType::FLAG | NodeType::TAG)) != 0) {
+            cleanup(key, record);
+        }
+    }
+}
+
+/**
+* Removes a key if it is there. Flagging the edge to the leaf decides the
+* removal; the unlinking that follows may be finished by another thread.
+*/
+template<class Key, class Value, class Compare>
+void LockFreeBST<Key, Value, Compare>::remove(const Key& key)
+{
+    EpochDomain::Guard guard(epochs_);
+    SeekRecord record;
+    NodeType* leaf = NULL;
+    while (true) {
+        seek(key, record);
+        if (leaf == NULL) { //injection: flag the edge to the leaf
+            if (!holds(record.leaf, key)) {
+                return;
+            }
+            std::atomic<uintptr_t>& edge = childEdge(record.parent, key);
+            uintptr_t expected = edgeTo(record.leaf);
+            if (edge.compare_exchange_strong(expected, expected | NodeType::FLAG, std::memory_order_acq_rel)) {
+                leaf = record.leaf;
+                size_.fetch_sub(1, std::memory_order_relaxed);
+                if (cleanup(key, record)) {
+                    return;
+                }
+            }
+            else if (address(expected) == record.leaf && (expected & (NodeType::FLAG | NodeType::TAG)) != 0) {
+                cleanup(key, record);
+            }
+        }
+        else if (record.leaf != leaf || cleanup(key, record)) { //someone else may have unlinked it
+            return;
+        }
+    }
+}
+
+template<class Key, class Value, class Compare>
+std::size_t LockFreeBST<Key, Value, Compare>::size() const
+{
+    return size_.load(std::memory_order_relaxed);
+}
+
+template<class Key, class Value, class Compare>
+bool LockFreeBST<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Frees every node still waiting in the epoch domain. No other thread may
+* use the tree.
+*/
+template<class Key, class Value, class Compare>
+void LockFreeBST<Key, Value, Compare>::reclaim()
+{
+    epochs_.drain();
+}
+
+/**
+* Returns the number of unlinked nodes not freed yet.
+*/
+template<class Key, class Value, class Compare>
+std::size_t LockFreeBST<Key, Value, Compare>::retiredCount() const
+{
+    return epochs_.pendingCount();
+}
+
+template<class Key, class Value, class Compare>
+void LockFreeBST<Key, Value, Compare>::destroyNode(NodeType* node)
+{
+    if (node->leaf_) {
+        delete static_cast<LeafType*>(node);
+    }
+    else {
+        delete node;
+    }
+}
+
+/**
+* Frees the subtree at node. The tree never rebalances, so sorted inserts
+* build a spine as deep as the tree is large; the walk keeps its pending
+* subtrees on the heap instead of recursing.
+*/
+template<class Key, class Value, class Compare>
+void LockFreeBST<Key, Value, Compare>::clearHelper(NodeType* node)
+{
+    std::vector<NodeType*> pending;
+    if (node != NULL) {
+        pending.push_back(node);
+    }
+    while (!pending.empty()) {
+        NodeType* current = pending.back();
+        pending.pop_back();
+        NodeType* left = address(current->left_.load(std::memory_order_relaxed));
+        NodeType* right = address(current->right_.load(std::memory_order_relaxed));
+        if (left != NULL) {
+            pending.push_back(left);
+        }
+        if (right != NULL) {
+            pending.push_back(right);
+        }
+        destroyNode(current);
+    }
+}
+
+/*
+  -------------------------------------------
+  End implementations for the LockFreeBST class.
+  -------------------------------------------
+*/
+
+#endif
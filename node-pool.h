@@ -0,0 +1,298 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <cstddef>
+#include <new>
+#include <memory>
+#include <vector>
+
+/**
+ * A slab arena that hands out small fixed-size blocks for tree nodes.
+ *
+ * Requests are rounded up to a 16 byte size class. Each size class keeps
+ * a free list of returned blocks and bump-allocates new blocks out of the
+ * current slab, so consecutively inserted nodes end up next to each other
+ * in memory. Blocks that are too large or too strictly aligned for the
+ * size classes fall through to the global operator new.
+ *
+ * The arena is not thread safe.
+ */
+class NodeArena
+{
+public:
+    explicit NodeArena(std::size_t blocksPerSlab = 256);
+    ~NodeArena();
+
+    void* allocate(std::size_t bytes, std::size_t align);
+    void deallocate(void* block, std::size_t bytes, std::size_t align);
+    void release();
+
+    std::size_t slabCount() const;
+    std::size_t oversizedCount() const;
+
+private:
+    NodeArena(const NodeArena&);
+    NodeArena& operator=(const NodeArena&);
+
+    static const std::size_t GRANULE = 16;
+    static const std::size_t CLASSES = 16;
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    struct SizeClass
+    {
+        FreeBlock* freeList;
+        char* cursor;
+        char* limit;
+    };
+
+    static bool pooled(std::size_t bytes, std::size_t align);
+    static std::size_t classIndex(std::size_t bytes);
+    void refill(SizeClass& sc, std::size_t blockBytes);
+
+    std::size_t blocksPerSlab_;
+    SizeClass classes_[CLASSES];
+    std::vector<void*> slabs_;
+    std::size_t oversized_;
+};
+
+/*
+  ------------------------------------------
+  Begin implementations for NodeArena.
+  ------------------------------------------
+*/
+
+/**
+* Creates an empty arena. No memory is reserved until the first allocation.
+*/
+inline NodeArena::NodeArena(std::size_t blocksPerSlab) :
+    blocksPerSlab_(blocksPerSlab == 0 ? 1 : blocksPerSlab),
+    oversized_(0)
+{
+    for (std::size_t i = 0; i < CLASSES; i++) {
+        classes_[i].freeList = NULL;
+        classes_[i].cursor = NULL;
+        classes_[i].limit = NULL;
+    }
+}
+
+/**
+* Returns every slab to the system. Blocks still handed out become invalid.
+*/
+inline NodeArena::~NodeArena()
+{
+    release();
+}
+
+inline bool NodeArena::pooled(std::size_t bytes, std::size_t align)
+{
+    return bytes <= GRANULE * CLASSES && align <= GRANULE;
+}
+
+inline std::size_t NodeArena::classIndex(std::size_t bytes)
+{
+    return bytes == 0 ? 0 : (bytes - 1) / GRANULE;
+}
+
+/**
+* Starts a new slab for the given size class.
+*/
+inline void NodeArena::refill(SizeClass& sc, std::size_t blockBytes)
+{
+    std::size_t slabBytes = blockBytes * blocksPerSlab_;
+    char* slab = static_cast<char*>(::operator new(slabBytes));
+    slabs_.push_back(slab);
+    sc.cursor = slab;
+    sc.limit = slab + slabBytes;
+}
+
+/**
+* Hands out a block of at least the given size, reusing a freed block
+* of the same size class when one is available.
+*/
+inline void* NodeArena::allocate(std::size_t bytes, std::size_t align)
+{
+    if (!pooled(bytes, align)) {
+        void* block = ::operator new(bytes);
+        oversized_++;
+        return block;
+    }
+    std::size_t blockBytes = (classIndex(bytes) + 1) * GRANULE;
+    SizeClass& sc = classes_[classIndex(bytes)];
+    if (sc.freeList != NULL) {
+        FreeBlock* block = sc.freeList;
+        sc.freeList = block->next;
+        return block;
+    }
+    if (sc.cursor == sc.limit) {
+        refill(sc, blockBytes);
+    }
+    void* block = sc.cursor;
+    sc.cursor += blockBytes;
+    return block;
+}
+
+/**
+* Puts a block back on the free list of its size class. bytes and align
+* must match the values passed to allocate().
+*/
+inline void NodeArena::deallocate(void* block, std::size_t bytes, std::size_t align)
+{
+    if (block == NULL) {
+        return;
+    }
+    if (!pooled(bytes, align)) {
+        ::operator delete(block);
+        oversized_--;
+        return;
+    }
+    SizeClass& sc = classes_[classIndex(bytes)];
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->next = sc.freeList;
+    sc.freeList = freed;
+}
+
+/**
+* Frees every slab at once. Any pooled block handed out before the call is
+* invalidated, so callers must have finished with (and destroyed) all of
+* the objects living in the arena. Oversized blocks are not tracked and
+* must still be returned through deallocate().
+*/
+inline void NodeArena::release()
+{
+    for (std::size_t i = 0; i < slabs_.size(); i++) {
+        ::operator delete(slabs_[i]);
+    }
+    slabs_.clear();
+    for (std::size_t i = 0; i < CLASSES; i++) {
+        classes_[i].freeList = NULL;
+        classes_[i].cursor = NULL;
+        classes_[i].limit = NULL;
+    }
+}
+
+/**
+* Returns the number of slabs currently owned by the arena.
+*/
+inline std::size_t NodeArena::slabCount() const
+{
+    return slabs_.size();
+}
+
+/**
+* Returns the number of live blocks that bypassed the size classes.
+*/
+inline std::size_t NodeArena::oversizedCount() const
+{
+    return oversized_;
+}
+
+/*
+  ----------------------------------------
+  End implementations for NodeArena.
+  ----------------------------------------
+*/
+
+/**
+ * Node allocation policies for BinarySearchTree and AVLTree.
+ *
+ * A policy provides allocate<N>() / deallocate<N>() for raw node storage
+ * and release(), which frees every node of the tree in one step. release()
+ * returns false when the policy cannot do that, in which case the tree
+ * falls back to freeing node by node. concurrent() tells whether nodes
+ * may be freed from several threads at once.
+ */
+
+/**
+ * The default policy: every node comes from the global operator new.
+ */
+class HeapNodeAllocator
+{
+public:
+    template<typename N> N* allocate();
+    template<typename N> void deallocate(N* node);
+    bool release();
+    bool concurrent() const { return true; }
+
+    bool operator==(const HeapNodeAllocator&) const { return true; }
+    bool operator!=(const HeapNodeAllocator&) const { return false; }
+};
+
+template<typename N>
+N* HeapNodeAllocator::allocate()
+{
+    return static_cast<N*>(::operator new(sizeof(N)));
+}
+
+template<typename N>
+void HeapNodeAllocator::deallocate(N* node)
+{
+    ::operator delete(node);
+}
+
+inline bool HeapNodeAllocator::release()
+{
+    return false;
+}
+
+/**
+ * A policy that carves nodes out of a NodeArena.
+ *
+ * Copies of a PoolNodeAllocator share the same arena, so trees built from
+ * copies of one allocator can hand nodes to each other. The arena is only
+ * released wholesale when a single tree still refers to it.
+ */
+class PoolNodeAllocator
+{
+public:
+    explicit PoolNodeAllocator(std::size_t blocksPerSlab = 256);
+
+    template<typename N> N* allocate();
+    template<typename N> void deallocate(N* node);
+    bool release();
+    bool concurrent() const { return false; }
+
+    const std::shared_ptr<NodeArena>& arena() const { return arena_; }
+
+    bool operator==(const PoolNodeAllocator& rhs) const { return arena_ == rhs.arena_; }
+    bool operator!=(const PoolNodeAllocator& rhs) const { return arena_ != rhs.arena_; }
+
+private:
+    std::shared_ptr<NodeArena> arena_;
+};
+
+inline PoolNodeAllocator::PoolNodeAllocator(std::size_t blocksPerSlab) :
+    arena_(std::make_shared<NodeArena>(blocksPerSlab))
+{
+
+}
+
+template<typename N>
+N* PoolNodeAllocator::allocate()
+{
+    return static_cast<N*>(arena_->allocate(sizeof(N), alignof(N)));
+}
+
+template<typename N>
+void PoolNodeAllocator::deallocate(N* node)
+{
+    arena_->deallocate(node, sizeof(N), alignof(N));
+}
+
+/**
+* Frees the whole arena if no other allocator shares it and every node
+* in it came from the slabs.
+*/
+inline bool PoolNodeAllocator::release()
+{
+    if (arena_.use_count() != 1 || arena_->oversizedCount() != 0) {
+        return false;
+    }
+    arena_->release();
+    return true;
+}
+
+#endif
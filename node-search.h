@@ -0,0 +1,217 @@
+#ifndef NODE_SEARCH_H
+#define NODE_SEARCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Intra-node key search for wide tree nodes (see BTree in btree.h).
+ *
+ * Both searches work on the first count keys of a sorted array:
+ *   lowerBound returns the index of the first key that is not less than key,
+ *   upperBound returns the index of the first key greater than key.
+ *
+ * NodeSearch<Key> picks the implementation at compile time from the key
+ * type: integral keys are compared a whole vector register at a time
+ * (AVX2 when the compiler targets it, SSE2 otherwise) and every other key
+ * type falls back to a scalar binary search on operator<.
+ *
+ * The vector version reads whole registers, so the key array must stay
+ * readable up to NODE_SEARCH_PAD_BYTES past its start rounded up (see
+ * nodeSearchSlots below); the values in the padding are ignored.
+ */
+
+#if defined(__AVX2__)
+#define NODE_SEARCH_SIMD 1
+#define NODE_SEARCH_PAD_BYTES 32
+#elif defined(__SSE2__)
+#define NODE_SEARCH_SIMD 1
+#define NODE_SEARCH_PAD_BYTES 16
+#else
+#define NODE_SEARCH_SIMD 0
+#define NODE_SEARCH_PAD_BYTES 1
+#endif
+
+/**
+ * Number of array slots to reserve for capacity keys so that the vector
+ * search never reads past the end of the array.
+ */
+template<typename Key>
+constexpr std::size_t nodeSearchSlots(std::size_t capacity)
+{
+    return ((capacity * sizeof(Key) + NODE_SEARCH_PAD_BYTES - 1) / NODE_SEARCH_PAD_BYTES
+            * NODE_SEARCH_PAD_BYTES + sizeof(Key) - 1) / sizeof(Key);
+}
+
+/**
+ * Branchy binary search using only operator<. Works for any key type.
+ */
+template<typename Key>
+struct ScalarNodeSearch
+{
+    static std::size_t lowerBound(const Key* keys, std::size_t count, const Key& key)
+    {
+        std::size_t lo = 0;
+        std::size_t hi = count;
+        while (lo < hi) {
+            std::size_t mid = (lo + hi) / 2;
+            if (keys[mid] < key) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    static std::size_t upperBound(const Key* keys, std::size_t count, const Key& key)
+    {
+        std::size_t lo = 0;
+        std::size_t hi = count;
+        while (lo < hi) {
+            std::size_t mid = (lo + hi) / 2;
+            if (key < keys[mid]) {
+                hi = mid;
+            }
+            else {
+                lo = mid + 1;
+            }
+        }
+        return lo;
+    }
+};
+
+/**
+ * True for key types the vector search handles: integral types other
+ * than bool, 8 to 64 bits wide. 64 bit lanes need a 64 bit compare,
+ * which SSE2 alone does not have.
+ */
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#define NODE_SEARCH_SIMD64 NODE_SEARCH_SIMD
+#else
+#define NODE_SEARCH_SIMD64 0
+#endif
+
+template<typename Key>
+struct SimdSearchable
+{
+    static const bool value = NODE_SEARCH_SIMD &&
+        std::is_integral<Key>::value && !std::is_same<Key, bool>::value &&
+        (sizeof(Key) == 1 || sizeof(Key) == 2 || sizeof(Key) == 4 ||
+         (sizeof(Key) == 8 && NODE_SEARCH_SIMD64));
+};
+
+#if NODE_SEARCH_SIMD
+
+namespace node_search_detail {
+
+#if defined(__AVX2__)
+typedef __m256i Vec;
+inline Vec load(const void* p) { return _mm256_loadu_si256(static_cast<const __m256i*>(p)); }
+inline uint64_t movemask(Vec v) { return (uint32_t)_mm256_movemask_epi8(v); }
+inline Vec bitxor(Vec a, Vec b) { return _mm256_xor_si256(a, b); }
+inline Vec splat(int8_t k) { return _mm256_set1_epi8(k); }
+inline Vec splat(int16_t k) { return _mm256_set1_epi16(k); }
+inline Vec splat(int32_t k) { return _mm256_set1_epi32(k); }
+inline Vec splat(int64_t k) { return _mm256_set1_epi64x(k); }
+inline Vec greater(Vec a, Vec b, int8_t) { return _mm256_cmpgt_epi8(a, b); }
+inline Vec greater(Vec a, Vec b, int16_t) { return _mm256_cmpgt_epi16(a, b); }
+inline Vec greater(Vec a, Vec b, int32_t) { return _mm256_cmpgt_epi32(a, b); }
+inline Vec greater(Vec a, Vec b, int64_t) { return _mm256_cmpgt_epi64(a, b); }
+#else
+typedef __m128i Vec;
+inline Vec load(const void* p) { return _mm_loadu_si128(static_cast<const __m128i*>(p)); }
+inline uint64_t movemask(Vec v) { return (uint32_t)_mm_movemask_epi8(v); }
+inline Vec bitxor(Vec a, Vec b) { return _mm_xor_si128(a, b); }
+inline Vec splat(int8_t k) { return _mm_set1_epi8(k); }
+inline Vec splat(int16_t k) { return _mm_set1_epi16(k); }
+inline Vec splat(int32_t k) { return _mm_set1_epi32(k); }
+inline Vec splat(int64_t k) { return _mm_set1_epi64x(k); }
+inline Vec greater(Vec a, Vec b, int8_t) { return _mm_cmpgt_epi8(a, b); }
+inline Vec greater(Vec a, Vec b, int16_t) { return _mm_cmpgt_epi16(a, b); }
+inline Vec greater(Vec a, Vec b, int32_t) { return _mm_cmpgt_epi32(a, b); }
+#if defined(__SSE4_2__)
+inline Vec greater(Vec a, Vec b, int64_t) { return _mm_cmpgt_epi64(a, b); }
+#endif
+#endif
+
+template<std::size_t Bytes> struct SignedOf;
+template<> struct SignedOf<1> { typedef int8_t type; };
+template<> struct SignedOf<2> { typedef int16_t type; };
+template<> struct SignedOf<4> { typedef int32_t type; };
+template<> struct SignedOf<8> { typedef int64_t type; };
+
+/**
+ * Counts the keys below key (KeyIsLeft == false) or above key
+ * (KeyIsLeft == true) among the first count keys. Unsigned keys are
+ * flipped into signed order with bias. Lanes past count are masked off,
+ * so the loop has no data dependent branches.
+ */
+template<typename Lane, bool KeyIsLeft>
+std::size_t countCompare(const Lane* keys, std::size_t count, Lane key, Lane bias)
+{
+    const std::size_t LANES = sizeof(Vec) / sizeof(Lane);
+    Vec b = splat(bias);
+    Vec k = bitxor(splat(key), b);
+    std::size_t bits = 0;
+    for (std::size_t i = 0; i < count; i += LANES) {
+        Vec v = bitxor(load(keys + i), b);
+        uint64_t m = movemask(KeyIsLeft ? greater(v, k, Lane()) : greater(k, v, Lane()));
+        std::size_t valid = count - i < LANES ? count - i : LANES;
+        m &= ((uint64_t)1 << (valid * sizeof(Lane))) - 1;
+        bits += __builtin_popcountll(m);
+    }
+    return bits / sizeof(Lane);
+}
+
+} // namespace node_search_detail
+
+/**
+ * Vector search for integral keys. Keys are reinterpreted as signed lanes
+ * of the same width.
+ */
+template<typename Key>
+struct SimdNodeSearch
+{
+    typedef typename node_search_detail::SignedOf<sizeof(Key)>::type Lane;
+
+    static Lane bias()
+    {
+        return std::is_signed<Key>::value ? (Lane)0 : (Lane)((uint64_t)1 << (8 * sizeof(Key) - 1));
+    }
+
+    static std::size_t lowerBound(const Key* keys, std::size_t count, const Key& key)
+    {
+        return node_search_detail::countCompare<Lane, false>(
+            reinterpret_cast<const Lane*>(keys), count, (Lane)key, bias());
+    }
+
+    static std::size_t upperBound(const Key* keys, std::size_t count, const Key& key)
+    {
+        return count - node_search_detail::countCompare<Lane, true>(
+            reinterpret_cast<const Lane*>(keys), count, (Lane)key, bias());
+    }
+};
+
+template<typename Key>
+struct NodeSearch :
+    std::conditional<SimdSearchable<Key>::value, SimdNodeSearch<Key>, ScalarNodeSearch<Key> >::type
+{
+};
+
+#else
+
+template<typename Key>
+struct NodeSearch : ScalarNodeSearch<Key>
+{
+};
+
+#endif
+
+#endif
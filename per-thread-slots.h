@@ -0,0 +1,221 @@
+#ifndef PER_THREAD_SLOTS_H
+#define PER_THREAD_SLOTS_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * One T per thread for an object shared between threads, such as an
+ * EpochDomain or a LatencyRecorder.
+ *
+ * A thread gets its slot from local(): the first call claims a slot, and
+ * later calls find it again through a small thread-local table. When the
+ * thread exits, the slot goes back to the owner still holding its
+ * contents, and the next new thread reuses it. Slots are never freed
+ * before the owner, so the owner can walk all of them at any time with
+ * forEach().
+ *
+ * Slots live in a lock-free list inside a shared state. A thread's table
+ * keeps that state alive, so a thread that outlives the owner can still
+ * give its slot back. The owner marks the state closed when it goes away,
+ * and tables drop closed states the next time they grow.
+ */
+template<typename T>
+class PerThreadSlots
+{
+public:
+    // New slots are built as T(args...).
+    template<typename... Args>
+    explicit PerThreadSlots(const Args&... args);
+    ~PerThreadSlots();
+
+    T& local();
+
+    template<typename F>
+    void forEach(F visit) const;
+    template<typename F>
+    void forEachReleased(F visit);
+
+private:
+    PerThreadSlots(const PerThreadSlots&);
+    PerThreadSlots& operator=(const PerThreadSlots&);
+
+    struct alignas(64) Slot
+    {
+        T value;
+        std::atomic<bool> inUse;
+        Slot* next;
+
+        template<typename... Args>
+        explicit Slot(const Args&... args) : value(args...), inUse(true), next(NULL) { }
+    };
+
+    // Outlives the owner for as long as some thread still caches one of
+    // its slots.
+    struct State
+    {
+        std::function<Slot*()> make;
+        std::atomic<Slot*> slots;
+        std::atomic<bool> closed;
+
+        explicit State(const std::function<Slot*()>& make);
+        ~State();
+    };
+
+    struct ThreadSlots
+    {
+        std::vector<std::pair<std::shared_ptr<State>, Slot*> > entries;
+        ~ThreadSlots();
+    };
+
+    Slot* acquire();
+
+    std::shared_ptr<State> state_;
+
+    static thread_local ThreadSlots threadSlots_;
+};
+
+template<typename T>
+thread_local typename PerThreadSlots<T>::ThreadSlots PerThreadSlots<T>::threadSlots_;
+
+/*
+  ------------------------------------------
+  Begin implementations for PerThreadSlots.
+  ------------------------------------------
+*/
+
+template<typename T>
+PerThreadSlots<T>::State::State(const std::function<Slot*()>& make) :
+    make(make),
+    slots(NULL),
+    closed(false)
+{
+
+}
+
+template<typename T>
+PerThreadSlots<T>::State::~State()
+{
+    Slot* slot = slots.load();
+    while (slot != NULL) {
+        Slot* next = slot->next;
+        delete slot;
+        slot = next;
+    }
+}
+
+/**
+* Gives the slots of a finished thread back to their owners.
+*/
+template<typename T>
+PerThreadSlots<T>::ThreadSlots::~ThreadSlots()
+{
+    for (std::size_t i = 0; i < entries.size(); i++) {
+        entries[i].second->inUse.store(false, std::memory_order_release);
+    }
+}
+
+template<typename T>
+template<typename... Args>
+PerThreadSlots<T>::PerThreadSlots(const Args&... args) :
+    state_(std::make_shared<State>([args...] { return new Slot(args...); }))
+{
+
+}
+
+/**
+* No thread may still be using its slot.
+*/
+template<typename T>
+PerThreadSlots<T>::~PerThreadSlots()
+{
+    state_->closed.store(true, std::memory_order_release);
+}
+
+/**
+* Returns the calling thread's slot, claiming one the first time.
+*/
+template<typename T>
+T& PerThreadSlots<T>::local()
+{
+    std::vector<std::pair<std::shared_ptr<State>, Slot*> >& entries = threadSlots_.entries;
+    for (std::size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].first.get() == state_.get()) {
+            return entries[i].second->value;
+        }
+    }
+    for (std::size_t i = entries.size(); i-- > 0;) { //forget owners that are gone
+        if (entries[i].first->closed.load(std::memory_order_acquire)) {
+            entries.erase(entries.begin() + i);
+        }
+    }
+    Slot* mine = acquire();
+    entries.push_back(std::make_pair(state_, mine));
+    return mine->value;
+}
+
+/**
+* Claims a slot left behind by a finished thread, or adds a new one.
+*/
+template<typename T>
+typename PerThreadSlots<T>::Slot* PerThreadSlots<T>::acquire()
+{
+    for (Slot* slot = state_->slots.load(std::memory_order_acquire); slot != NULL; slot = slot->next) {
+        bool expected = false;
+        if (!slot->inUse.load(std::memory_order_relaxed) &&
+            slot->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return slot;
+        }
+    }
+    Slot* slot = state_->make();
+    Slot* head = state_->slots.load(std::memory_order_relaxed);
+    do {
+        slot->next = head;
+    } while (!state_->slots.compare_exchange_weak(head, slot, std::memory_order_release, std::memory_order_relaxed));
+    return slot;
+}
+
+/**
+* Calls visit(T&) on every slot, whether or not a thread holds it. Other
+* threads may be writing their slots meanwhile; visit must only read
+* what is safe to read concurrently.
+*/
+template<typename T>
+template<typename F>
+void PerThreadSlots<T>::forEach(F visit) const
+{
+    for (Slot* slot = state_->slots.load(std::memory_order_acquire); slot != NULL; slot = slot->next) {
+        visit(slot->value);
+    }
+}
+
+/**
+* Calls visit(T&) on every slot that no thread holds. Each one is claimed
+* for the duration of the call, so that a new thread cannot take it over
+* halfway.
+*/
+template<typename T>
+template<typename F>
+void PerThreadSlots<T>::forEachReleased(F visit)
+{
+    for (Slot* slot = state_->slots.load(std::memory_order_acquire); slot != NULL; slot = slot->next) {
+        bool expected = false;
+        if (!slot->inUse.load(std::memory_order_relaxed) &&
+            slot->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            visit(slot->value);
+            slot->inUse.store(false, std::memory_order_release);
+        }
+    }
+}
+
+/*
+  ----------------------------------------
+  End implementations for PerThreadSlots.
+  ----------------------------------------
+*/
+
+#endif
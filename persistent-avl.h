@@ -0,0 +1,658 @@
+#ifndef PERSISTENT_AVL_H
+#define PERSISTENT_AVL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * A node of PersistentAVLTree. Nodes never change once built; a new
+ * version of the tree builds new nodes along one root-to-leaf path and
+ * shares everything else. refs_ counts the parents and tree handles that
+ * point at the node.
+ */
+template <typename Key, typename Value>
+class PersistentAVLNode
+{
+public:
+    PersistentAVLNode(const std::pair<const Key, Value>& item,
+                      const PersistentAVLNode<Key, Value>* left, const PersistentAVLNode<Key, Value>* right);
+
+    const std::pair<const Key, Value>& getItem() const;
+    const Key& getKey() const;
+    const PersistentAVLNode<Key, Value>* getLeft() const;
+    const PersistentAVLNode<Key, Value>* getRight() const;
+    int getHeight() const;
+    std::size_t getSize() const;
+
+    // Reference counting. Both accept NULL.
+    static const PersistentAVLNode<Key, Value>* share(const PersistentAVLNode<Key, Value>* node);
+    static void release(const PersistentAVLNode<Key, Value>* node);
+
+    static int height(const PersistentAVLNode<Key, Value>* node);
+    static std::size_t size(const PersistentAVLNode<Key, Value>* node);
+
+private:
+    std::pair<const Key, Value> item_;
+    const PersistentAVLNode<Key, Value>* left_;     // owned references
+    const PersistentAVLNode<Key, Value>* right_;
+    mutable std::atomic<uint32_t> refs_;
+    int height_;
+    std::size_t size_;
+};
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the PersistentAVLNode class.
+  ----------------------------------------------------
+*/
+
+/**
+* Builds a node over two subtrees, taking over one reference to each.
+*/
+template<class Key, class Value>
+PersistentAVLNode<Key, Value>::PersistentAVLNode(const std::pair<const Key, Value>& item,
+                                                 const PersistentAVLNode<Key, Value>* left, const PersistentAVLNode<Key, Value>* right) :
+    item_(item),
+    left_(left),
+    right_(right),
+    refs_(1),
+    height_((height(left) > height(right) ? height(left) : height(right)) + 1),
+    size_(size(left) + size(right) + 1)
+{
+
+}
+
+template<class Key, class Value>
+const std::pair<const Key, Value>& PersistentAVLNode<Key, Value>::getItem() const
+{
+    return item_;
+}
+
+template<class Key, class Value>
+const Key& PersistentAVLNode<Key, Value>::getKey() const
+{
+    return item_.first;
+}
+
+template<class Key, class Value>
+const PersistentAVLNode<Key, Value>* PersistentAVLNode<Key, Value>::getLeft() const
+{
+    return left_;
+}
+
+template<class Key, class Value>
+const PersistentAVLNode<Key, Value>* PersistentAVLNode<Key, Value>::getRight() const
+{
+    return right_;
+}
+
+template<class Key, class Value>
+int PersistentAVLNode<Key, Value>::getHeight() const
+{
+    return height_;
+}
+
+template<class Key, class Value>
+std::size_t PersistentAVLNode<Key, Value>::getSize() const
+{
+    return size_;
+}
+
+/**
+* Adds a reference and returns node, for passing a shared subtree on.
+*/
+template<class Key, class Value>
+const PersistentAVLNode<Key, Value>* PersistentAVLNode<Key, Value>::share(const PersistentAVLNode<Key, Value>* node)
+{
+    if (node != NULL) {
+        node->refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return node;
+}
+
+/**
+* Drops a reference, freeing the node and releasing its children when it
+* was the last one. Only the subtrees no other version uses are freed.
+*/
+template<class Key, class Value>
+void PersistentAVLNode<Key, Value>::release(const PersistentAVLNode<Key, Value>* node)
+{
+    while (node != NULL && node->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        const PersistentAVLNode<Key, Value>* right = node->right_;
+        release(node->left_);
+        delete node;
+        node = right; //loop instead of recursing on one side
+    }
+}
+
+template<class Key, class Value>
+int PersistentAVLNode<Key, Value>::height(const PersistentAVLNode<Key, Value>* node)
+{
+    return node == NULL ? 0 : node->height_;
+}
+
+template<class Key, class Value>
+std::size_t PersistentAVLNode<Key, Value>::size(const PersistentAVLNode<Key, Value>* node)
+{
+    return node == NULL ? 0 : node->size_;
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the PersistentAVLNode class.
+  --------------------------------------------------
+*/
+
+/**
+ * An immutable version of a PersistentAVLTree. Copying one is O(1) and
+ * it stays valid, and unchanged, however the tree it came from changes.
+ * Any number of threads may read the same snapshot.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class AVLSnapshot
+{
+public:
+    typedef PersistentAVLNode<Key, Value> NodeType;
+
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+        iterator& operator++();
+        iterator operator++(int);
+
+    private:
+        friend class AVLSnapshot;
+        void pushLeft(const NodeType* node);
+
+        // The nodes whose items are still to come, innermost on top. Nodes
+        // have no parent pointers (a node may have many parents).
+        std::vector<const NodeType*> path_;
+    };
+
+    AVLSnapshot();
+    AVLSnapshot(const AVLSnapshot& other);
+    AVLSnapshot& operator=(const AVLSnapshot& other);
+    ~AVLSnapshot();
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    const Value& operator[](const Key& key) const;
+    std::size_t size() const;
+    bool empty() const;
+
+protected:
+    template <typename K, typename V, typename C> friend class PersistentAVLTree;
+    AVLSnapshot(const NodeType* root, const Compare& comp);
+
+    const NodeType* root_;    // owned reference
+    Compare comp_;
+};
+
+/**
+ * A persistent AVL map: insert and remove copy the O(log n) nodes on the
+ * path from the root and share the rest of the tree with earlier versions
+ * through reference counts, and snapshot() hands out the current version
+ * in O(1).
+ *
+ * Writers serialize on a writer mutex. Taking a snapshot and publishing a
+ * new root share a spinlock held for a pointer swap and a reference count
+ * increment, so a reader scanning a snapshot holds nothing that a writer
+ * could wait for.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class PersistentAVLTree
+{
+public:
+    typedef PersistentAVLNode<Key, Value> NodeType;
+    typedef AVLSnapshot<Key, Value, Compare> Snapshot;
+
+    explicit PersistentAVLTree(const Compare& comp = Compare());
+    ~PersistentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+
+    Snapshot snapshot() const;
+    std::size_t size() const;
+    bool empty() const;
+
+private:
+    PersistentAVLTree(const PersistentAVLTree&);
+    PersistentAVLTree& operator=(const PersistentAVLTree&);
+
+protected:
+    const NodeType* findNode(const NodeType* node, const Key& key) const;
+    static const NodeType* balance(const std::pair<const Key, Value>& item, const NodeType* left, const NodeType* right);
+    const NodeType* insertNode(const NodeType* node, const std::pair<const Key, Value>& keyValuePair);
+    const NodeType* removeNode(const NodeType* node, const Key& key);
+    static const NodeType* removeMin(const NodeType* node, const NodeType*& min);
+    void publish(const NodeType* root);
+
+    const NodeType* root_;    // owned reference
+    Compare comp_;
+    std::mutex writeLock_;
+    mutable std::atomic_flag rootLock_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the AVLSnapshot class.
+  ---------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+AVLSnapshot<Key, Value, Compare>::AVLSnapshot() :
+    root_(NULL)
+{
+
+}
+
+/**
+* Takes over one reference to root.
+*/
+template<class Key, class Value, class Compare>
+AVLSnapshot<Key, Value, Compare>::AVLSnapshot(const NodeType* root, const Compare& comp) :
+    root_(root),
+    comp_(comp)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+AVLSnapshot<Key, Value, Compare>::AVLSnapshot(const AVLSnapshot& other) :
+    root_(NodeType::share(other.root_)),
+    comp_(other.comp_)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+AVLSnapshot<Key, Value, Compare>& AVLSnapshot<Key, Value, Compare>::operator=(const AVLSnapshot& other)
+{
+    const NodeType* old = root_;
+    root_ = NodeType::share(other.root_);
+    comp_ = other.comp_;
+    NodeType::release(old);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+AVLSnapshot<Key, Value, Compare>::~AVLSnapshot()
+{
+    NodeType::release(root_);
+}
+
+template<class Key, class Value, class Compare>
+typename AVLSnapshot<Key, Value, Compare>::iterator AVLSnapshot<Key, Value, Compare>::begin() const
+{
+    iterator it;
+    it.pushLeft(root_);
+    return it;
+}
+
+template<class Key, class Value, class Compare>
+typename AVLSnapshot<Key, Value, Compare>::iterator AVLSnapshot<Key, Value, Compare>::end() const
+{
+    return iterator();
+}
+
+/**
+* Returns an iterator to key, or end(). The path to the key is kept so
+* that the iterator can go on from there.
+*/
+template<class Key, class Value, class Compare>
+typename AVLSnapshot<Key, Value, Compare>::iterator AVLSnapshot<Key, Value, Compare>::find(const Key& key) const
+{
+    iterator it;
+    const NodeType* node = root_;
+    while (node != NULL) {
+        if (comp_(key, node->getKey())) {
+            it.path_.push_back(node);
+            node = node->getLeft();
+        }
+        else if (comp_(node->getKey(), key)) {
+            node = node->getRight();
+        }
+        else {
+            it.path_.push_back(node);
+            return it;
+        }
+    }
+    return end();
+}
+
+/**
+ * @precondition The key exists in the snapshot
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare>
+const Value& AVLSnapshot<Key, Value, Compare>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if (it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<class Key, class Value, class Compare>
+std::size_t AVLSnapshot<Key, Value, Compare>::size() const
+{
+    return NodeType::size(root_);
+}
+
+template<class Key, class Value, class Compare>
+bool AVLSnapshot<Key, Value, Compare>::empty() const
+{
+    return root_ == NULL;
+}
+
+template<class Key, class Value, class Compare>
+AVLSnapshot<Key, Value, Compare>::iterator::iterator()
+{
+
+}
+
+template<class Key, class Value, class Compare>
+void AVLSnapshot<Key, Value, Compare>::iterator::pushLeft(const NodeType* node)
+{
+    while (node != NULL) {
+        path_.push_back(node);
+        node = node->getLeft();
+    }
+}
+
+template<class Key, class Value, class Compare>
+typename AVLSnapshot<Key, Value, Compare>::iterator::reference AVLSnapshot<Key, Value, Compare>::iterator::operator*() const
+{
+    return path_.back()->getItem();
+}
+
+template<class Key, class Value, class Compare>
+typename AVLSnapshot<Key, Value, Compare>::iterator::pointer AVLSnapshot<Key, Value, Compare>::iterator::operator->() const
+{
+    return &path_.back()->getItem();
+}
+
+template<class Key, class Value, class Compare>
+bool AVLSnapshot<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    if (path_.empty() || rhs.path_.empty()) {
+        return path_.empty() && rhs.path_.empty();
+    }
+    return path_.back() == rhs.path_.back();
+}
+
+template<class Key, class Value, class Compare>
+bool AVLSnapshot<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<class Key, class Value, class Compare>
+typename AVLSnapshot<Key, Value, Compare>::iterator& AVLSnapshot<Key, Value, Compare>::iterator::operator++()
+{
+    const NodeType* node = path_.back();
+    path_.pop_back();
+    pushLeft(node->getRight());
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename AVLSnapshot<Key, Value, Compare>::iterator AVLSnapshot<Key, Value, Compare>::iterator::operator++(int)
+{
+    iterator before(*this);
+    ++*this;
+    return before;
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the AVLSnapshot class.
+  -------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------------
+  Begin implementations for the PersistentAVLTree class.
+  ---------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const Compare& comp) :
+    root_(NULL),
+    comp_(comp)
+{
+    rootLock_.clear();
+}
+
+/**
+* Drops the tree's reference. Nodes still used by snapshots stay alive
+* until the last of those snapshots goes.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::~PersistentAVLTree()
+{
+    NodeType::release(root_);
+}
+
+/**
+* Returns the current version in O(1).
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot PersistentAVLTree<Key, Value, Compare>::snapshot() const
+{
+    while (rootLock_.test_and_set(std::memory_order_acquire)) { }
+    const NodeType* root = NodeType::share(root_);
+    rootLock_.clear(std::memory_order_release);
+    return Snapshot(root, comp_);
+}
+
+/**
+* Makes root the current version and drops the tree's reference to the
+* previous one, which frees whatever no snapshot still uses.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::publish(const NodeType* root)
+{
+    while (rootLock_.test_and_set(std::memory_order_acquire)) { }
+    const NodeType* old = root_;
+    root_ = root;
+    rootLock_.clear(std::memory_order_release);
+    NodeType::release(old);
+}
+
+/**
+* Inserts or overwrites a key. Either way the path to the key is copied:
+* an overwritten value lives in a new node too.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::lock_guard<std::mutex> guard(writeLock_);
+    publish(insertNode(root_, keyValuePair));
+}
+
+/**
+* Removes a key if it is there. A missing key leaves the version as is.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    std::lock_guard<std::mutex> guard(writeLock_);
+    if (findNode(root_, key) == NULL) {
+        return;
+    }
+    publish(removeNode(root_, key));
+}
+
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::clear()
+{
+    std::lock_guard<std::mutex> guard(writeLock_);
+    publish(NULL);
+}
+
+/**
+* The size of the current version. Only meaningful to writers or when no
+* writer is running; readers should ask a snapshot.
+*/
+template<class Key, class Value, class Compare>
+std::size_t PersistentAVLTree<Key, Value, Compare>::size() const
+{
+    return snapshot().size();
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::findNode(const NodeType* node, const Key& key) const
+{
+    while (node != NULL) {
+        if (comp_(key, node->getKey())) {
+            node = node->getLeft();
+        }
+        else if (comp_(node->getKey(), key)) {
+            node = node->getRight();
+        }
+        else {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/**
+* Builds a node for item over left and right (taking over a reference to
+* each), rotating once if their heights differ by two. Rotated nodes are
+* rebuilt, since existing nodes may be shared.
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::balance(const std::pair<const Key, Value>& item, const NodeType* left, const NodeType* right)
+{
+    int lh = NodeType::height(left);
+    int rh = NodeType::height(right);
+    if (lh > rh + 1) {
+        const NodeType* ll = left->getLeft();
+        const NodeType* lr = left->getRight();
+        const NodeType* top;
+        if (NodeType::height(ll) >= NodeType::height(lr)) { //single rotation
+            top = new NodeType(left->getItem(), NodeType::share(ll), new NodeType(item, NodeType::share(lr), right));
+        }
+        else { //double rotation through lr
+            top = new NodeType(lr->getItem(),
+                               new NodeType(left->getItem(), NodeType::share(ll), NodeType::share(lr->getLeft())),
+                               new NodeType(item, NodeType::share(lr->getRight()), right));
+        }
+        NodeType::release(left);
+        return top;
+    }
+    if (rh > lh + 1) {
+        const NodeType* rl = right->getLeft();
+        const NodeType* rr = right->getRight();
+        const NodeType* top;
+        if (NodeType::height(rr) >= NodeType::height(rl)) {
+            top = new NodeType(right->getItem(), new NodeType(item, left, NodeType::share(rl)), NodeType::share(rr));
+        }
+        else {
+            top = new NodeType(rl->getItem(),
+                               new NodeType(item, left, NodeType::share(rl->getLeft())),
+                               new NodeType(right->getItem(), NodeType::share(rl->getRight()), NodeType::share(rr)));
+        }
+        NodeType::release(right);
+        return top;
+    }
+    return new NodeType(item, left, right);
+}
+
+/**
+* Returns a new version of the subtree at node with the item inserted.
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::insertNode(const NodeType* node, const std::pair<const Key, Value>& keyValuePair)
+{
+    if (node == NULL) {
+        return new NodeType(keyValuePair, NULL, NULL);
+    }
+    if (comp_(keyValuePair.first, node->getKey())) {
+        return balance(node->getItem(), insertNode(node->getLeft(), keyValuePair), NodeType::share(node->getRight()));
+    }
+    if (comp_(node->getKey(), keyValuePair.first)) {
+        return balance(node->getItem(), NodeType::share(node->getLeft()), insertNode(node->getRight(), keyValuePair));
+    }
+    return new NodeType(keyValuePair, NodeType::share(node->getLeft()), NodeType::share(node->getRight()));
+}
+
+/**
+* Returns a new version of the subtree at node without key, which must be
+* in it.
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::removeNode(const NodeType* node, const Key& key)
+{
+    if (comp_(key, node->getKey())) {
+        return balance(node->getItem(), removeNode(node->getLeft(), key), NodeType::share(node->getRight()));
+    }
+    if (comp_(node->getKey(), key)) {
+        return balance(node->getItem(), NodeType::share(node->getLeft()), removeNode(node->getRight(), key));
+    }
+    if (node->getLeft() == NULL) {
+        return NodeType::share(node->getRight());
+    }
+    if (node->getRight() == NULL) {
+        return NodeType::share(node->getLeft());
+    }
+    const NodeType* successor;
+    const NodeType* right = removeMin(node->getRight(), successor);
+    return balance(successor->getItem(), NodeType::share(node->getLeft()), right);
+}
+
+/**
+* Returns a new version of the subtree at node without its smallest node,
+* which is returned through min (it stays owned by the old version).
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::removeMin(const NodeType* node, const NodeType*& min)
+{
+    if (node->getLeft() == NULL) {
+        min = node;
+        return NodeType::share(node->getRight());
+    }
+    return balance(node->getItem(), removeMin(node->getLeft(), min), NodeType::share(node->getRight()));
+}
+
+/*
+  -------------------------------------------------------
+  End implementations for the PersistentAVLTree class.
+  -------------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,426 @@
+#ifndef SHARDED_AVL_MAP_H
+#define SHARDED_AVL_MAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "avlbst.h"
+
+/**
+ * A map spread over Shards independent AVLTrees, each behind its own
+ * reader/writer lock, so threads working on different shards never wait
+ * for each other.
+ *
+ * Keys are placed either by hash (the default constructor) or by range:
+ * given Shards - 1 ascending bounds, shard i holds the keys from
+ * bounds[i - 1] up to but not including bounds[i]. Hashing spreads any
+ * key set evenly; ranges keep neighbouring keys together so range scans
+ * touch few shards.
+ *
+ * Lookups copy the value out, since a reference would outlive the shard
+ * lock. Ordered iteration goes through ordered(), which holds every shard
+ * lock for its lifetime and merges the shards with a k-way heap merge.
+ */
+template <typename Key, typename Value, std::size_t Shards,
+          typename Compare = std::less<Key>, typename Hash = std::hash<Key> >
+class ShardedAVLMap
+{
+public:
+    typedef AVLTree<Key, Value, Compare> ShardType;
+
+    class OrderedView;
+
+    ShardedAVLMap();
+    explicit ShardedAVLMap(const std::vector<Key>& bounds, const Compare& comp = Compare());
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    Value operator[](const Key& key) const;
+    void clear();
+
+    std::size_t size() const;
+    bool empty() const;
+    bool rangePartitioned() const;
+    std::size_t shardOf(const Key& key) const;
+    std::size_t shardSize(std::size_t shard) const;
+
+    OrderedView ordered() const;
+
+private:
+    ShardedAVLMap(const ShardedAVLMap&);
+    ShardedAVLMap& operator=(const ShardedAVLMap&);
+
+protected:
+    // Padded to a cache line so that the locks of neighbouring shards do
+    // not share one.
+    struct alignas(64) Shard
+    {
+        mutable std::shared_mutex lock;
+        ShardType tree;
+
+        Shard() { }
+        explicit Shard(const Compare& comp) : tree(comp) { }
+    };
+
+    std::vector<Key> bounds_;    // empty in hash mode
+    Compare comp_;
+    Hash hash_;
+    Shard shards_[Shards];
+};
+
+/**
+ * All items of a ShardedAVLMap in key order. Holds a shared lock on every
+ * shard until destroyed, so writers wait while it is alive.
+ */
+template <typename Key, typename Value, std::size_t Shards, typename Compare, typename Hash>
+class ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView
+{
+public:
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+        iterator& operator++();
+        iterator operator++(int);
+
+    private:
+        friend class OrderedView;
+        typedef typename ShardType::iterator ShardIterator;
+        typedef std::pair<ShardIterator, ShardIterator> Cursor;    // current, end
+
+        iterator(const ShardedAVLMap* map);
+        bool later(std::size_t a, std::size_t b) const;
+
+        const ShardedAVLMap* map_;
+        std::vector<Cursor> cursors_;
+        std::vector<std::size_t> heap_;    // shards with items left, smallest key on top
+    };
+
+    explicit OrderedView(const ShardedAVLMap* map);
+    OrderedView(OrderedView&& other);
+
+    iterator begin() const;
+    iterator end() const;
+
+private:
+    const ShardedAVLMap* map_;
+    std::vector<std::shared_lock<std::shared_mutex> > locks_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the ShardedAVLMap class.
+  ---------------------------------------------------
+*/
+
+/**
+* Hash partitioned map.
+*/
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+ShardedAVLMap<Key, Value, Shards, Compare, Hash>::ShardedAVLMap()
+{
+
+}
+
+/**
+* Range partitioned map. bounds must hold Shards - 1 ascending keys.
+*/
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+ShardedAVLMap<Key, Value, Shards, Compare, Hash>::ShardedAVLMap(const std::vector<Key>& bounds, const Compare& comp) :
+    bounds_(bounds),
+    comp_(comp)
+{
+    if (bounds_.size() + 1 != Shards) {
+        throw std::invalid_argument("ShardedAVLMap: need Shards - 1 bounds");
+    }
+    for (std::size_t i = 1; i < bounds_.size(); i++) {
+        if (!comp_(bounds_[i - 1], bounds_[i])) {
+            throw std::invalid_argument("ShardedAVLMap: bounds must ascend");
+        }
+    }
+    for (std::size_t i = 0; i < Shards; i++) {
+        shards_[i].tree = ShardType(comp);
+    }
+}
+
+/**
+* Returns the shard a key lives in. Hash codes are scrambled first, since
+* std::hash is the identity for integers and strided keys would otherwise
+* pile up in a few shards.
+*/
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+std::size_t ShardedAVLMap<Key, Value, Shards, Compare, Hash>::shardOf(const Key& key) const
+{
+    if (!bounds_.empty()) {
+        return std::upper_bound(bounds_.begin(), bounds_.end(), key, comp_) - bounds_.begin();
+    }
+    uint64_t h = (uint64_t)hash_(key) * 0x9E3779B97F4A7C15ull;
+    return (std::size_t)((h >> 32) % Shards);
+}
+
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+void ShardedAVLMap<Key, Value, Shards, Compare, Hash>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Shard& shard = shards_[shardOf(keyValuePair.first)];
+    std::unique_lock<std::shared_mutex> guard(shard.lock);
+    shard.tree.insert(keyValuePair);
+}
+
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+void ShardedAVLMap<Key, Value, Shards, Compare, Hash>::remove(const Key& key)
+{
+    Shard& shard = shards_[shardOf(key)];
+    std::unique_lock<std::shared_mutex> guard(shard.lock);
+    shard.tree.remove(key);
+}
+
+/**
+* Copies the value for key into value and returns true if key is present.
+*/
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+bool ShardedAVLMap<Key, Value, Shards, Compare, Hash>::find(const Key& key, Value& value) const
+{
+    const Shard& shard = shards_[shardOf(key)];
+    std::shared_lock<std::shared_mutex> guard(shard.lock);
+    typename ShardType::iterator it = shard.tree.find(key);
+    if (it == shard.tree.end()) {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns a copy of the value associated with the key
+ */
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+Value ShardedAVLMap<Key, Value, Shards, Compare, Hash>::operator[](const Key& key) const
+{
+    const Shard& shard = shards_[shardOf(key)];
+    std::shared_lock<std::shared_mutex> guard(shard.lock);
+    return shard.tree[key];
+}
+
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+void ShardedAVLMap<Key, Value, Shards, Compare, Hash>::clear()
+{
+    for (std::size_t i = 0; i < Shards; i++) {
+        std::unique_lock<std::shared_mutex> guard(shards_[i].lock);
+        shards_[i].tree.clear();
+    }
+}
+
+/**
+* The total number of items. Shards are counted one after the other, so
+* under concurrent writes the result is only approximate.
+*/
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+std::size_t ShardedAVLMap<Key, Value, Shards, Compare, Hash>::size() const
+{
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < Shards; i++) {
+        total += shardSize(i);
+    }
+    return total;
+}
+
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+bool ShardedAVLMap<Key, Value, Shards, Compare, Hash>::empty() const
+{
+    return size() == 0;
+}
+
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+bool ShardedAVLMap<Key, Value, Shards, Compare, Hash>::rangePartitioned() const
+{
+    return !bounds_.empty();
+}
+
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+std::size_t ShardedAVLMap<Key, Value, Shards, Compare, Hash>::shardSize(std::size_t shard) const
+{
+    std::shared_lock<std::shared_mutex> guard(shards_[shard].lock);
+    return shards_[shard].tree.size();
+}
+
+/**
+* Locks every shard for reading (always in index order, so two views
+* cannot deadlock) and returns a view of all items in key order.
+*/
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+typename ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView
+ShardedAVLMap<Key, Value, Shards, Compare, Hash>::ordered() const
+{
+    return OrderedView(this);
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the ShardedAVLMap class.
+  -------------------------------------------------
+*/
+
+/*
+  ------------------------------------------------------------
+  Begin implementations for the ShardedAVLMap::OrderedView class.
+  ------------------------------------------------------------
+*/
+
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::OrderedView(const ShardedAVLMap* map) :
+    map_(map)
+{
+    for (std::size_t i = 0; i < Shards; i++) {
+        locks_.push_back(std::shared_lock<std::shared_mutex>(map->shards_[i].lock));
+    }
+}
+
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::OrderedView(OrderedView&& other) :
+    map_(other.map_),
+    locks_(std::move(other.locks_))
+{
+
+}
+
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+typename ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator
+ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::begin() const
+{
+    return iterator(map_);
+}
+
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+typename ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator
+ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::end() const
+{
+    return iterator();
+}
+
+/**
+* The end iterator: no shard has items left.
+*/
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator::iterator() :
+    map_(NULL)
+{
+
+}
+
+/**
+* Starts a cursor at the front of every non-empty shard and heaps them by
+* their current key.
+*/
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator::iterator(const ShardedAVLMap* map) :
+    map_(map)
+{
+    for (std::size_t i = 0; i < Shards; i++) {
+        const ShardType& tree = map->shards_[i].tree;
+        cursors_.push_back(Cursor(tree.begin(), tree.end()));
+        if (!tree.empty()) {
+            heap_.push_back(i);
+        }
+    }
+    std::make_heap(heap_.begin(), heap_.end(), [this](std::size_t a, std::size_t b) { return later(a, b); });
+}
+
+/**
+* Heap order: true if shard a's current key comes after shard b's.
+*/
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+bool ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator::later(std::size_t a, std::size_t b) const
+{
+    return map_->comp_(cursors_[b].first->first, cursors_[a].first->first);
+}
+
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+typename ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator::reference
+ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator::operator*() const
+{
+    return *cursors_[heap_.front()].first;
+}
+
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+typename ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator::pointer
+ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator::operator->() const
+{
+    return &**this;
+}
+
+/**
+* Iterators are equal when both are at the end, or both point at the same
+* item of the same map.
+*/
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+bool ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator::operator==(const iterator& rhs) const
+{
+    if (heap_.empty() || rhs.heap_.empty()) {
+        return heap_.empty() && rhs.heap_.empty();
+    }
+    return map_ == rhs.map_ && &**this == &*rhs;
+}
+
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+bool ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances the shard on top of the heap and sifts it back down, or drops
+* it once it runs out. O(log Shards) per step.
+*/
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+typename ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator&
+ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator::operator++()
+{
+    auto order = [this](std::size_t a, std::size_t b) { return later(a, b); };
+    std::pop_heap(heap_.begin(), heap_.end(), order);
+    Cursor& cursor = cursors_[heap_.back()];
+    ++cursor.first;
+    if (cursor.first == cursor.second) {
+        heap_.pop_back();
+    }
+    else {
+        std::push_heap(heap_.begin(), heap_.end(), order);
+    }
+    return *this;
+}
+
+template<class Key, class Value, std::size_t Shards, class Compare, class Hash>
+typename ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator
+ShardedAVLMap<Key, Value, Shards, Compare, Hash>::OrderedView::iterator::operator++(int)
+{
+    iterator before(*this);
+    ++*this;
+    return before;
+}
+
+/*
+  ----------------------------------------------------------
+  End implementations for the ShardedAVLMap::OrderedView class.
+  ----------------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * A small work-stealing pool for fork-join recursion.
+ *
+ * invoke(first, second) runs two calls that may run in parallel and
+ * returns when both are done. second is pushed on the calling worker's
+ * own deque and first runs right away; idle workers steal from the other
+ * end of the deques, so the oldest (largest) pieces of a recursion are
+ * the ones that move between threads. A worker waiting for a stolen task
+ * keeps running other tasks meanwhile, so nested invokes never block a
+ * thread.
+ *
+ * A pool of n threads starts n - 1 workers; the thread calling invoke
+ * from outside the pool takes part as the n-th. A pool of size 1 runs
+ * everything inline.
+ */
+class ThreadPool
+{
+public:
+    explicit ThreadPool(std::size_t threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    std::size_t size() const;
+
+    template<typename F1, typename F2>
+    void invoke(F1&& first, F2&& second);
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    // A task lives on the stack of the invoke that pushed it.
+    struct Task
+    {
+        void (*run)(void*);
+        void* arg;
+        std::atomic<bool> done;
+        std::exception_ptr error;
+    };
+
+    struct Worker
+    {
+        std::mutex lock;
+        std::deque<Task*> tasks;
+    };
+
+    template<typename F>
+    static void call(void* f);
+    static void execute(Task* task);
+
+    std::size_t self() const;
+    void push(std::size_t index, Task* task);
+    bool reclaim(std::size_t index, Task* task);
+    Task* take(std::size_t index);
+    void workerLoop(std::size_t index);
+
+    std::vector<std::unique_ptr<Worker> > workers_;
+    std::vector<std::thread> threads_;
+    std::atomic<bool> stop_;
+    std::atomic<std::size_t> queued_;
+    std::atomic<std::size_t> sleepers_;
+    std::mutex sleepLock_;
+    std::condition_variable wake_;
+
+    static thread_local ThreadPool* currentPool_;
+    static thread_local std::size_t currentIndex_;
+};
+
+inline thread_local ThreadPool* ThreadPool::currentPool_ = NULL;
+inline thread_local std::size_t ThreadPool::currentIndex_ = 0;
+
+/*
+  ------------------------------------------
+  Begin implementations for ThreadPool.
+  ------------------------------------------
+*/
+
+/**
+* Starts threads - 1 workers (at least one slot is always there for the
+* calling thread).
+*/
+inline ThreadPool::ThreadPool(std::size_t threads) :
+    stop_(false),
+    queued_(0),
+    sleepers_(0)
+{
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (std::size_t i = 0; i < threads; i++) {
+        workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+    for (std::size_t i = 1; i < threads; i++) {
+        threads_.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+/**
+* Stops and joins the workers. No invoke may be running.
+*/
+inline ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(sleepLock_);
+        stop_.store(true);
+    }
+    wake_.notify_all();
+    for (std::size_t i = 0; i < threads_.size(); i++) {
+        threads_[i].join();
+    }
+}
+
+/**
+* Returns the number of threads that run tasks, the caller included.
+*/
+inline std::size_t ThreadPool::size() const
+{
+    return workers_.size();
+}
+
+/**
+* Runs first and second, possibly in parallel, and returns once both have
+* finished. An exception from either call is rethrown here (the one from
+* first if both throw).
+*/
+template<typename F1, typename F2>
+void ThreadPool::invoke(F1&& first, F2&& second)
+{
+    Task task;
+    task.run = &call<typename std::remove_reference<F2>::type>;
+    task.arg = static_cast<void*>(&second);
+    task.done.store(false, std::memory_order_relaxed);
+    std::size_t me = self();
+    push(me, &task);
+
+    std::exception_ptr firstError;
+    try {
+        first();
+    }
+    catch (...) {
+        firstError = std::current_exception();
+    }
+
+    if (reclaim(me, &task)) { //nobody stole it: run it here
+        execute(&task);
+    }
+    else {
+        while (!task.done.load(std::memory_order_acquire)) { //help out until the thief is done
+            Task* other = take(me);
+            if (other != NULL) {
+                execute(other);
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+    }
+    if (firstError) {
+        std::rethrow_exception(firstError);
+    }
+    if (task.error) {
+        std::rethrow_exception(task.error);
+    }
+}
+
+template<typename F>
+void ThreadPool::call(void* f)
+{
+    (*static_cast<F*>(f))();
+}
+
+inline void ThreadPool::execute(Task* task)
+{
+    try {
+        task->run(task->arg);
+    }
+    catch (...) {
+        task->error = std::current_exception();
+    }
+    task->done.store(true, std::memory_order_release);
+}
+
+/**
+* Returns the deque index of the calling thread: its worker slot inside
+* the pool, slot 0 for any thread outside of it.
+*/
+inline std::size_t ThreadPool::self() const
+{
+    return currentPool_ == this ? currentIndex_ : 0;
+}
+
+inline void ThreadPool::push(std::size_t index, Task* task)
+{
+    {
+        std::lock_guard<std::mutex> guard(workers_[index]->lock);
+        workers_[index]->tasks.push_back(task);
+    }
+    queued_.fetch_add(1);
+    if (sleepers_.load() > 0) {
+        std::lock_guard<std::mutex> guard(sleepLock_);
+        wake_.notify_one();
+    }
+}
+
+/**
+* Takes task back off the owner's deque if it is still there. Pushes and
+* reclaims nest, so an unstolen task is always the newest one.
+*/
+inline bool ThreadPool::reclaim(std::size_t index, Task* task)
+{
+    std::lock_guard<std::mutex> guard(workers_[index]->lock);
+    std::deque<Task*>& tasks = workers_[index]->tasks;
+    if (tasks.empty() || tasks.back() != task) {
+        return false;
+    }
+    tasks.pop_back();
+    queued_.fetch_sub(1);
+    return true;
+}
+
+/**
+* Finds something to run: the newest task on the thread's own deque, or
+* else the oldest task of another worker.
+*/
+inline ThreadPool::Task* ThreadPool::take(std::size_t index)
+{
+    std::size_t count = workers_.size();
+    for (std::size_t i = 0; i < count; i++) {
+        std::size_t victim = (index + i) % count;
+        std::lock_guard<std::mutex> guard(workers_[victim]->lock);
+        std::deque<Task*>& tasks = workers_[victim]->tasks;
+        if (tasks.empty()) {
+            continue;
+        }
+        Task* task;
+        if (victim == index) {
+            task = tasks.back();
+            tasks.pop_back();
+        }
+        else {
+            task = tasks.front();
+            tasks.pop_front();
+        }
+        queued_.fetch_sub(1);
+        return task;
+    }
+    return NULL;
+}
+
+inline void ThreadPool::workerLoop(std::size_t index)
+{
+    currentPool_ = this;
+    currentIndex_ = index;
+    while (true) {
+        Task* task = take(index);
+        if (task != NULL) {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(sleepLock_);
+        if (stop_.load()) {
+            return;
+        }
+        sleepers_.fetch_add(1);
+        wake_.wait(guard, [this] { return stop_.load() || queued_.load() > 0; });
+        sleepers_.fetch_sub(1);
+    }
+}
+
+/*
+  ----------------------------------------
+  End implementations for ThreadPool.
+  ----------------------------------------
+*/
+
+#endif
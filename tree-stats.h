@@ -0,0 +1,45 @@
+#ifndef TREE_STATS_H
+#define TREE_STATS_H
+
+#include <cstdint>
+
+/**
+ * Hot-path counters for BinarySearchTree and AVLTree, compiled in only
+ * with -DBST_STATS.
+ *
+ * Each thread counts into its own block, so counting takes no atomics and
+ * no locks. The counts cover every tree the thread touches. Read them with
+ * BinarySearchTree<...>::stats(), which also resets them. Without BST_STATS
+ * every BST_STAT expands to nothing and stats() returns zeros.
+ */
+struct TreeStats
+{
+    uint64_t comparisons;       // calls to the comparator on a search path
+    uint64_t nodeVisits;        // nodes stepped through on a search path
+    uint64_t rotations;         // single rotations; a double rotation is two
+    uint64_t insertFixSteps;    // levels insertFix walked up
+    uint64_t nodeSwaps;         // nodeSwap calls, one per two-child remove
+};
+
+#ifdef BST_STATS
+inline thread_local TreeStats treeStatsCounters = TreeStats();
+#define BST_STAT(counter) (++treeStatsCounters.counter)
+#else
+#define BST_STAT(counter) ((void)0)
+#endif
+
+/**
+* Returns the calling thread's counters and sets them back to zero.
+*/
+inline TreeStats takeTreeStats()
+{
+#ifdef BST_STATS
+    TreeStats taken = treeStatsCounters;
+    treeStatsCounters = TreeStats();
+    return taken;
+#else
+    return TreeStats();
+#endif
+}
+
+#endif